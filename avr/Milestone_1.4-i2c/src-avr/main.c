@@ -31,6 +31,18 @@
     - 3.x ms: turn channel 2 off
     - start at 0.0 ms
 
+    Several slaves can share one bus. The address of each slave is read from the EEPROM
+    or, if the EEPROM is not programmed, derived from two strap pins (@sa slaveAddressInit).
+    If the sync latch bit is set in the control register the new duty cycles are only
+    staged. They are applied by all slaves at their next frame boundary after the master
+    sent the GENERAL_CALL_LATCH command to the general call address.
+
+    Besides the 4 big-endian 16 bit registers the master can write all channels at once
+    with a packed frame starting at PACKED_REGISTER: 4 channels with 12 bit each
+    (value / 2, big-endian bit stream, 6 bytes) followed by a CRC8 (polynomial 0x07, init 0)
+    over PACKED_REGISTER and the 6 data bytes. Frames with a wrong CRC are rejected and
+    counted in txbuffer[REJECTED_REGISTER].
+
 */
 
 
@@ -40,10 +52,16 @@
 #include 	<avr/pgmspace.h>
 #include    <stdint.h>
 #include    <util/atomic.h>
+#include    <avr/eeprom.h>
+#include    <util/delay.h>
+#include    <util/crc16.h>
 
 //################################################################## USI-TWI-I2C
 
 #include 	"usiTwiSlave.h"     		
+#ifdef TRANSPORT_UART
+#include    "usartSlave.h"
+#endif
 
 /** Note: The LSB is the I2C r/w flag and must not be used for addressing!
   I2C-address for the slave (only the first 7 bit)
@@ -51,6 +69,22 @@
 */
 #define 	SLAVE_ADDR_ATTINY       0b00110100
 
+#ifndef     EEPROM_SLAVE_ADDR
+#define     EEPROM_SLAVE_ADDR       0xFF    ///< 7 bit address stored in the EEPROM (0xFF == use strap pins)
+#endif
+
+#define     STRAP_PINS              PIND    ///< Port with the address strap pins
+#define     STRAP_SHIFT             PIND2   ///< Strap pins PD2 (bit 0) and PD3 (bit 1), pulled up, connect to GND to set
+
+#define     CONTROL_REGISTER        8       ///< rxbuffer index of the control register
+#define     ADDRESS_REGISTER        9       ///< txbuffer index where the own 7 bit address can be read back
+#define     CTRL_SYNC_LATCH         0x01    ///< Control bit: stage duty cycles until GENERAL_CALL_LATCH
+#define     PACKED_REGISTER         10      ///< rxbuffer index of the packed frame (6 data bytes + CRC8)
+#define     PACKED_LENGTH           7       ///< Length of the packed frame including the CRC8
+#define     REJECTED_REGISTER       10      ///< txbuffer index of the counter of rejected packed frames
+
+#define     GENERAL_CALL_LATCH      0x80    ///< General call command: apply staged duty cycles at the next frame
+
 #ifndef 	F_CPU
 #define 	F_CPU 8000000UL ///< CPU clock frequency
 #endif
@@ -81,11 +115,21 @@
 
     static uint16_t onValues[4] = {0, 8191, 16383, 24575};       //OCRA1 values for every ms
     static uint16_t dutyCycles[4] = {12287, 20479, 28671, 4095}; //Stores the duty cycles for each channel
+    static uint16_t stagedCycles[4];     ///< Duty cycles received in sync latch mode
+    static uint16_t latchedCycles[4];    ///< Duty cycles to be applied at the next frame boundary
+    static volatile uint8_t latchPending; ///< latchedCycles are valid and wait for the frame boundary
+    static uint8_t control;              ///< Copy of the control register
+
+    uint8_t EEMEM eeSlaveAddress = EEPROM_SLAVE_ADDR; ///< Address of the slave in the EEPROM
 
 
 //################################################################# Main routine
 
 static void ppmInit(void);
+static uint8_t slaveAddressInit(void);
+static void setDutyCycle(uint8_t ch, uint16_t value);
+static void processRegister(uint8_t index);
+static void processPackedFrame(void);
 
 /*!
  @brief main program of the I2C-slave
@@ -97,11 +141,16 @@ static void ppmInit(void);
 */
 int main(void)
 {	 
-    int i;
+    uint8_t i;
 
     cli();  // Disable interrupts
 	
-    usiTwiSlaveInit(SLAVE_ADDR_ATTINY);	// TWI slave init
+    i = slaveAddressInit();
+#ifdef TRANSPORT_UART
+    usartSlaveInit();                       // USART slave init
+#else
+    usiTwiSlaveInit(i);                     // TWI slave init
+#endif
 
     //Initialize rxbuffer
     rxbuffer[0] = HIGH_BYTE( (dutyCycles[0] - 1*8192) );
@@ -116,73 +165,204 @@ int main(void)
     rxbuffer[6] = HIGH_BYTE( (dutyCycles[3] - 0*8192) );
     rxbuffer[7] = LOW_BYTE(  (dutyCycles[3] - 0*8192) );
 
+    for (i = 0; i < 8; i++)
+        txbuffer[i] = rxbuffer[i];
+
     ppmInit();
 	
 	sei();  // Re-enable interrupts
 
     while(1)
     {
+#ifdef TRANSPORT_UART
         /*
-            receivedNewValue is updated whenever a new value is written
-            to the rxbuffer with the corresponding index
-            As always 2 bytes are used for one dutyCycle the interesting values are 1, 3, 5, 7
-            Then the corresponding value in the dutyCycle array is updated
-
-            The new value for a dutyCycle is calculated first in a temp-variable.
-            In a previous version it was directly assigned within the atomic block which caused severs problems
-            that the ucontroller stopped responding to the I2C-master.
-            Therefore now only the assignment to dutyCycles[x] is done in atomic block
+            The USART driver only commits complete frames with a valid checksum.
+            All registers written by the frame are processed at once.
         */
-        uint16_t temp;
-        switch (receivedNewValue)
+        if (usartFrameLength)
         {
-        case 1:  //update dutyCycle for channel 0
-            receivedNewValue = 0;
-            temp = uniq(rxbuffer[1], rxbuffer[0]) + 1 * 8192;
-            ATOMIC_BLOCK(ATOMIC_FORCEON)
-            {
-                dutyCycles[0] = temp;
-            }
-            txbuffer[0]   = rxbuffer[0];
-            txbuffer[1]   = rxbuffer[1];
-            break;
-
-        case  3:  //update dutyCycle for channel 1
-            receivedNewValue = 0;
-            temp = uniq(rxbuffer[3], rxbuffer[2]) + 2 * 8192;
-            ATOMIC_BLOCK(ATOMIC_FORCEON)
-            {
-                dutyCycles[1] = temp;
-            }
-            txbuffer[2]   = rxbuffer[2];
-            txbuffer[3]   = rxbuffer[3];
-            break;
-
-        case 5:  //update dutyCycle for channel 2
-            receivedNewValue = 0;
-            temp = uniq(rxbuffer[5], rxbuffer[4]) + 3 * 8192;
+            uint8_t first, last;
             ATOMIC_BLOCK(ATOMIC_FORCEON)
             {
-                dutyCycles[2] = temp;
+                first = usartFirstRegister;
+                last  = first + usartFrameLength;
+                usartFrameLength = 0;
             }
-            txbuffer[4]   = rxbuffer[4];
-            txbuffer[5]   = rxbuffer[5];
-            break;
+            for (i = first; i < last; i++)
+                processRegister(i);
+        }
+#else
+        processRegister(receivedNewValue);
+#endif
 
-        case 7:   //update dutyCycle for channel 3
-            receivedNewValue = 0;
-            temp = uniq(rxbuffer[7], rxbuffer[6]) + 0 * 8192;
+        /*
+            A latch command copies the staged duty cycles. They are applied
+            by the ISR at the beginning of the next ppm-cycle so that all
+            four channels (and all slaves on the bus) change in the same frame.
+        */
+        if (generalCallCommand == GENERAL_CALL_LATCH)
+        {
+            generalCallCommand = 0;
             ATOMIC_BLOCK(ATOMIC_FORCEON)
             {
-                dutyCycles[3] = temp;
+                for (i = 0; i < 4; i++)
+                    latchedCycles[i] = stagedCycles[i];
+                latchPending = 1;
             }
-            txbuffer[6]   = rxbuffer[6];
-            txbuffer[7]   = rxbuffer[7];
-            break;
-        } //end.switch
+        }
     } //end.while
 } //end.main
 
+/*!
+ @brief Process a register of the rxbuffer which was written by the master
+
+ @param index the index of the register in the rxbuffer
+*/
+static void processRegister(uint8_t index)
+{
+    /*
+        receivedNewValue is updated whenever a new value is written
+        to the rxbuffer with the corresponding index
+        As always 2 bytes are used for one dutyCycle the interesting values are 1, 3, 5, 7
+        Then the corresponding value in the dutyCycle array is updated
+
+        The new value for a dutyCycle is calculated first in a temp-variable.
+        In a previous version it was directly assigned within the atomic block which caused severs problems
+        that the ucontroller stopped responding to the I2C-master.
+        Therefore now only the assignment to dutyCycles[x] is done in atomic block
+    */
+    uint16_t temp;
+    switch (index)
+    {
+    case 1:  //update dutyCycle for channel 0
+        receivedNewValue = 0;
+        temp = uniq(rxbuffer[1], rxbuffer[0]) + 1 * 8192;
+        setDutyCycle(0, temp);
+        txbuffer[0]   = rxbuffer[0];
+        txbuffer[1]   = rxbuffer[1];
+        break;
+
+    case  3:  //update dutyCycle for channel 1
+        receivedNewValue = 0;
+        temp = uniq(rxbuffer[3], rxbuffer[2]) + 2 * 8192;
+        setDutyCycle(1, temp);
+        txbuffer[2]   = rxbuffer[2];
+        txbuffer[3]   = rxbuffer[3];
+        break;
+
+    case 5:  //update dutyCycle for channel 2
+        receivedNewValue = 0;
+        temp = uniq(rxbuffer[5], rxbuffer[4]) + 3 * 8192;
+        setDutyCycle(2, temp);
+        txbuffer[4]   = rxbuffer[4];
+        txbuffer[5]   = rxbuffer[5];
+        break;
+
+    case 7:   //update dutyCycle for channel 3
+        receivedNewValue = 0;
+        temp = uniq(rxbuffer[7], rxbuffer[6]) + 0 * 8192;
+        setDutyCycle(3, temp);
+        txbuffer[6]   = rxbuffer[6];
+        txbuffer[7]   = rxbuffer[7];
+        break;
+
+    case CONTROL_REGISTER:
+        receivedNewValue = 0;
+        control = rxbuffer[CONTROL_REGISTER];
+        txbuffer[CONTROL_REGISTER] = control;
+        break;
+
+    case PACKED_REGISTER + PACKED_LENGTH - 1:  //CRC of the packed frame
+        receivedNewValue = 0;
+        processPackedFrame();
+        break;
+    } //end.switch
+}
+
+/*!
+ @brief Check the CRC of the packed frame and update all 4 channels
+
+ The 12 bit values are expanded to the 13 bit range of the 16 bit registers.
+ The txbuffer mirrors the new values in the format of the 16 bit registers.
+*/
+static void processPackedFrame()
+{
+    uint8_t frame[PACKED_LENGTH];
+    uint16_t value[4];
+    uint8_t crc = _crc8_ccitt_update(0, PACKED_REGISTER);
+    uint8_t i;
+
+    for (i = 0; i < PACKED_LENGTH; i++)
+    {
+        frame[i] = rxbuffer[PACKED_REGISTER + i];
+        crc = _crc8_ccitt_update(crc, frame[i]);
+    }
+    if (crc != 0)   //CRC over data and CRC byte is 0 for a valid frame
+    {
+        txbuffer[REJECTED_REGISTER]++;
+        return;
+    }
+
+    value[0] = (uniq(frame[1], frame[0]) >> 4) << 1;
+    value[1] = (uniq(frame[2], frame[1]) & 0x0fff) << 1;
+    value[2] = (uniq(frame[4], frame[3]) >> 4) << 1;
+    value[3] = (uniq(frame[5], frame[4]) & 0x0fff) << 1;
+
+    for (i = 0; i < 4; i++)
+    {
+        setDutyCycle(i, value[i] + ((i + 1) & 3) * 8192);
+        txbuffer[2*i]   = HIGH_BYTE(value[i]);
+        txbuffer[2*i+1] = LOW_BYTE(value[i]);
+    }
+}
+
+/*!
+ @brief Determine the I2C-address of the slave
+
+ If the EEPROM contains a valid 7 bit address (0x08..0x77) it is used. 0 is the general
+ call and the other addresses are reserved, so they count as an empty EEPROM: the address
+ is SLAVE_ADDR_ATTINY plus the value of the two strap pins PD2 and PD3 (a pin connected
+ to GND counts as 1). This way up to 4 identical slaves can share one bus.
+
+ @return uint8_t the address in the format expected by usiTwiSlaveInit (r/w flag as LSB)
+*/
+static uint8_t slaveAddressInit()
+{
+    uint8_t address = eeprom_read_byte(&eeSlaveAddress);
+
+    if (address < 0x08 || address > 0x77)
+    {
+        //Enable pull-ups of the strap pins and give them time to settle
+        PORTD |= (3 << STRAP_SHIFT);
+        _delay_us(10);
+        address = (SLAVE_ADDR_ATTINY >> 1) + ((~STRAP_PINS >> STRAP_SHIFT) & 3);
+    }
+
+    txbuffer[ADDRESS_REGISTER] = address;
+    return address << 1;
+}
+
+/*!
+ @brief Apply a new duty cycle or stage it if the sync latch is enabled
+
+ @param ch the channel to update
+ @param value the new OCR1B value of the channel (including the offset of the channel)
+*/
+static void setDutyCycle(uint8_t ch, uint16_t value)
+{
+    if (control & CTRL_SYNC_LATCH)
+    {
+        stagedCycles[ch] = value;
+    }
+    else
+    {
+        ATOMIC_BLOCK(ATOMIC_FORCEON)
+        {
+            dutyCycles[ch] = value;
+        }
+    }
+}
+
 /*!
  @brief Initialize the timercounter and interrupts for the ppm signals
 
@@ -195,6 +375,7 @@ int main(void)
 */
 static void ppmInit()
 {
+      uint8_t i;
 
       //Set output pins of all 4 channels to output
       sbi(DDRD, DDD5);		//pin PD5 (OC0B): ch0
@@ -214,6 +395,8 @@ static void ppmInit()
       //Initialize registers and variables
       OCR1A = onValues[1];
       OCR1B = dutyCycles[3];
+      for (i = 0; i < 4; i++)
+          stagedCycles[i] = dutyCycles[i];
       onCounter  = 1;
       offCounter = 0;
 
@@ -230,6 +413,16 @@ ISR(TIMER1_CAPT_vect)
     OCR1A = 8191;       //Next OCR1A interrupt after 1ms
     onCounter = 1;
     offCounter = 0;
+
+    //Apply latched duty cycles at the frame boundary
+    if (latchPending)
+    {
+        dutyCycles[0] = latchedCycles[0];
+        dutyCycles[1] = latchedCycles[1];
+        dutyCycles[2] = latchedCycles[2];
+        dutyCycles[3] = latchedCycles[3];
+        latchPending = 0;
+    }
 }
 
 /**
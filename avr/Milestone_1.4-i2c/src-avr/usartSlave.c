@@ -0,0 +1,169 @@
+/**
+
+    @file   usartSlave.c
+    @brief  USART slave driver - alternative transport to the USI TWI Slave driver
+    @author Jan Sommer
+
+    Receiving and sending is completely interrupt driven. See usartSlave.h for the
+    frame format.
+
+*/
+
+#include <avr/io.h>
+#include <avr/interrupt.h>
+#include "usartSlave.h"
+
+#ifndef F_CPU
+#define F_CPU 8000000UL ///< CPU clock frequency
+#endif
+
+#define UBRR_VALUE  ((F_CPU / (8 * USART_BAUD)) - 1)   ///< Baud rate register in double speed mode
+
+typedef enum
+{
+    USART_WAIT_SYNC,
+    USART_HEADER,
+    USART_REGISTER,
+    USART_DATA,
+    USART_CHECKSUM
+} rxState_t;
+
+static volatile rxState_t rxState;      ///< State of the receiving state machine
+static uint8_t rxHeader;                ///< Header of the current frame
+static uint8_t rxRegister;              ///< Register (or command) of the current frame
+static uint8_t rxCount;                 ///< Number of data bytes received so far
+static uint8_t rxSum;                   ///< Running checksum of the current frame
+static uint8_t rxData[buffer_size];     ///< Data of the current frame (committed after the checksum)
+
+static uint8_t txFrame[buffer_size + 3]; ///< Reply which is being sent
+static volatile uint8_t txLength;       ///< Length of the reply
+static volatile uint8_t txIndex;        ///< Next byte of the reply to send
+
+/*!
+ \brief Start sending the first length bytes of txFrame
+*/
+static void usartReply(uint8_t length)
+{
+    txLength = length;
+    txIndex  = 0;
+    UCSRB |= (1 << UDRIE);  // UDRE interrupt sends the reply
+}
+
+/*!
+ \brief Handle a frame with a valid checksum
+*/
+static void usartFrameComplete(void)
+{
+    uint8_t i;
+    uint8_t length = rxHeader & ~UART_READ;
+
+    if (rxHeader & UART_READ)
+    {
+        txFrame[0] = UART_SYNC;
+        txFrame[1] = length;
+        rxSum = length;
+        for (i = 0; i < length; i++)
+        {
+            txFrame[i + 2] = txbuffer[rxRegister + i];
+            rxSum += txFrame[i + 2];
+        }
+        txFrame[length + 2] = -rxSum;
+        usartReply(length + 3);
+    }
+    else
+    {
+        if (length == 0 && rxRegister >= GENERAL_CALL_COMMAND)
+        {
+            generalCallCommand = rxRegister;
+        }
+        else
+        {
+            for (i = 0; i < length; i++)
+                rxbuffer[rxRegister + i] = rxData[i];
+            usartFirstRegister = rxRegister;
+            usartFrameLength   = length;
+        }
+        txFrame[0] = UART_ACK;
+        usartReply(1);
+    }
+}
+
+void usartSlaveInit(void)
+{
+    UBRRH = (uint8_t)(UBRR_VALUE >> 8);
+    UBRRL = (uint8_t)UBRR_VALUE;
+    UCSRA = (1 << U2X);                                 // Double speed for exact high baud rates
+    UCSRC = (1 << UCSZ1) | (1 << UCSZ0);                // 8N1
+    UCSRB = (1 << RXCIE) | (1 << RXEN) | (1 << TXEN);   // Receive interrupt, enable receiver and transmitter
+    rxState = USART_WAIT_SYNC;
+}
+
+/**
+  @brief ISR for a received byte --> runs the frame state machine
+*/
+ISR(USART_RX_vect)
+{
+    uint8_t error = UCSRA & ((1 << FE) | (1 << DOR));
+    uint8_t data  = UDR;
+
+    if (error)
+    {
+        rxState = USART_WAIT_SYNC;
+        return;
+    }
+
+    rxSum += data;
+    switch (rxState)
+    {
+    case USART_WAIT_SYNC:
+        if (data == UART_SYNC)
+        {
+            rxSum   = 0;
+            rxState = USART_HEADER;
+        }
+        break;
+
+    case USART_HEADER:
+        rxHeader = data;
+        rxCount  = 0;
+        rxState  = USART_REGISTER;
+        break;
+
+    case USART_REGISTER:
+        rxRegister = data;
+        rxState = (rxHeader & UART_READ) || rxHeader == 0 ? USART_CHECKSUM : USART_DATA;
+        break;
+
+    case USART_DATA:
+        if (rxCount < buffer_size)
+            rxData[rxCount] = data;
+        if (++rxCount == rxHeader)
+            rxState = USART_CHECKSUM;
+        break;
+
+    case USART_CHECKSUM:
+        rxState = USART_WAIT_SYNC;
+        if (rxSum == 0 &&
+            (rxRegister + (rxHeader & ~UART_READ) <= buffer_size ||
+             (rxHeader == 0 && rxRegister >= GENERAL_CALL_COMMAND)))
+        {
+            usartFrameComplete();
+        }
+        else if (!(rxHeader & UART_READ))
+        {
+            txFrame[0] = UART_NACK;
+            usartReply(1);
+        }
+        break;
+    }
+}
+
+/**
+  @brief ISR for an empty data register --> send the next byte of the reply
+*/
+ISR(USART_UDRE_vect)
+{
+    UDR = txFrame[txIndex++];
+    if (txIndex >= txLength)
+        UCSRB &= ~(1 << UDRIE);
+}
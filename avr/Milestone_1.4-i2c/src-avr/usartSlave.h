@@ -0,0 +1,50 @@
+/**
+
+    @file   usartSlave.h
+    @brief  USART slave driver - alternative transport to the USI TWI Slave driver
+    @author Jan Sommer
+
+    The USART driver feeds the same register buffers (rxbuffer, txbuffer) as the
+    I2C driver. It is selected with TRANSPORT = uart in the Makefile.
+    Compared to I2C there is no clock stretching and no bus arbitration and the
+    USART runs at up to 1 MBaud (8 data bits, no parity, 1 stop bit).
+
+    Every frame from the master has the following format:
+
+        1. UART_SYNC
+        2. header: bit 7 = UART_READ flag, bit 0-6 = number of data bytes n
+        3. buffer address (register) or a command (>= GENERAL_CALL_COMMAND, n == 0)
+        4. n data bytes (write only)
+        5. checksum: the sum of all bytes from the header to the checksum is 0 (mod 256)
+
+    The slave answers
+        - a write with UART_ACK if the checksum was valid and all data fit into the rxbuffer,
+          else with UART_NACK. Only complete valid frames are written to the rxbuffer.
+        - a read with UART_SYNC, n, txbuffer[register ... register+n-1], checksum
+
+*/
+
+#ifndef _USART_SLAVE_H_
+#define _USART_SLAVE_H_
+
+#include <stdint.h>
+#include "usiTwiSlave.h"    // rxbuffer, txbuffer and generalCallCommand are shared with the I2C driver
+
+#ifndef USART_BAUD
+#define USART_BAUD 500000UL     ///< Baud rate of the USART (250000, 500000 or 1000000 at 8 MHz)
+#endif
+
+#define UART_SYNC   0xA5        ///< First byte of every frame
+#define UART_READ   0x80        ///< Header flag for a read request
+#define UART_ACK    0x79        ///< Reply to a valid write frame
+#define UART_NACK   0x1F        ///< Reply to an invalid write frame
+
+/*!
+ \brief Initialize the USART and its interrupts
+*/
+void usartSlaveInit(void);
+
+volatile uint8_t usartFirstRegister;    ///< First register written by the last valid frame
+volatile uint8_t usartFrameLength;      ///< Number of registers written by the last valid frame (0 == processed)
+
+#endif  // ifndef _USART_SLAVE_H_
@@ -216,6 +216,7 @@ typedef enum
 
  volatile uint8_t         	slaveAddress;
  volatile overflowState_t 	overflowState;
+ volatile uint8_t         	generalCall;		// Current transfer is addressed to the general call address
 
 //############################################ initialize USI for TWI slave mode
 
@@ -292,6 +293,7 @@ ISR( USI_OVERFLOW_VECTOR )	// Handles all the communication. Only disabled when
 		case USI_SLAVE_CHECK_ADDRESS:
 			if (USIDR == 0 || (USIDR & ~1) == slaveAddress)     // If adress is either 0 or own address		
 				{
+				generalCall = ( USIDR == 0 );
 				if (  USIDR & 0x01 )
 					{
 					overflowState = USI_SLAVE_SEND_DATA;		// Master Write Data Mode - Slave transmit
@@ -360,7 +362,12 @@ ISR( USI_OVERFLOW_VECTOR )	// Handles all the communication. Only disabled when
 			data=USIDR; 					// Read data received
 			if (buffer_adr == 0xFF) 		// First access, read buffer position
 				{
-				if(data<=buffer_size)		// Check if address within buffer size
+				if (generalCall && data >= GENERAL_CALL_COMMAND)	// Command to all slaves
+					{
+					generalCallCommand = data;
+					buffer_adr = buffer_size;	// Ignore any further data of this transfer
+					}
+				else if(data<=buffer_size)		// Check if address within buffer size
 					{
 					buffer_adr= data; 		// Set position as received
 					}
@@ -369,7 +376,7 @@ ISR( USI_OVERFLOW_VECTOR )	// Handles all the communication. Only disabled when
 					buffer_adr=0; 			// Set address to 0
 					}				
 				}
-			else 							// Ongoing access, receive data
+			else if (buffer_adr < buffer_size)	// Ongoing access, receive data
 				{
 				rxbuffer[buffer_adr]=data; 				// Write data to buffer
                 receivedNewValue = buffer_adr;          // Set flag that new value in buffer
@@ -46,6 +46,12 @@
 		3. Master sends slave address (bit 7-1) + r/w flag (bit 0), which must be set to 1
 		4. Master waits for callback, demanding the slave to send data starting with txbuffer[buffer address]
 
+    General call (address 0):
+
+        1. Master sends address 0 + r/w flag 0 (received by every slave on the bus)
+        2. Master sends either a buffer address (< GENERAL_CALL_COMMAND, handled like a normal write)
+           or a command byte (>= GENERAL_CALL_COMMAND) which is stored in generalCallCommand
+
 	Info:
 		- You have to change the buffer_size in the usiTwiSlave.h file
 		- Buffer address is automatically incremented
@@ -71,9 +77,12 @@ void    usiTwiSlaveInit(uint8_t ownAddress);	// send slave address
 
 //#################################################################### variables
 
-#define buffer_size 8						     ///< in bytes (2..254), change ONLY here!!!!!
+#define buffer_size 17						     ///< in bytes (2..254), change ONLY here!!!!!
+
+#define GENERAL_CALL_COMMAND 0x80                ///< First byte of a general call >= this value is a command
 
 volatile uint8_t receivedNewValue;
+volatile uint8_t generalCallCommand;            ///< Last command received via general call (0 == none)
 volatile uint8_t rxbuffer[buffer_size];         ///< Buffer to write data received from the master
 volatile uint8_t txbuffer[buffer_size];			///< Transmission buffer to be read from the master
 volatile uint8_t buffer_adr; 					///< Virtual buffer address register
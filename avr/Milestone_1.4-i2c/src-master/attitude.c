@@ -0,0 +1,259 @@
+/**
+    @file src-master/attitude.c
+    @brief closed-loop attitude control: cascaded fixed-point angle and rate PID controllers
+    @author Jan Sommer
+
+    Threads:
+        - the producer of the sensor samples: the only writer of the sensor mailbox
+        - the pilot (e.g. the UI): the only writer of the command mailbox
+        - the loop thread: the only reader of both, it writes the duty cycles with
+          copterSubmitInput() and publishes them in the motor mailbox
+
+    The counters are written by the loop thread only, attitudeStats() may see slightly
+    outdated values.
+*/
+
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <errno.h>
+#include "attitude.h"
+#include "histogram.h"
+#include "realtime.h"
+
+/**
+    @brief a command of the pilot in the command mailbox
+*/
+typedef struct
+{
+    mixerInput_t stick;                     ///< throttle, roll and pitch angle, yaw rate
+    long long inputTime;                    ///< @sa attitudeCommand
+} command_t;
+
+/**
+    @brief state of a loop
+*/
+struct attitude
+{
+    attitudeConfig_t cfg;                   ///< rate and gains
+    copter_t *copter;                       ///< receives the duty cycles
+    mixer_t *mixer;                         ///< the mixer of the motors
+    int numSlaves;                          ///< slaves with motors of the mixer
+    mailbox_t *sensor;                      ///< sensorSample_t from the producer
+    mailbox_t *command;                     ///< command_t from the pilot
+    mailbox_t *motors;                      ///< int[COPTER_MAX_SLAVES][4] of every tick
+    pidController_t angle[2];               ///< angle controllers of roll and pitch
+    pidController_t rate[ATT_AXES];         ///< rate controllers
+
+    pthread_t thread;                       ///< the loop thread
+    int started;                            ///< 1 after attitudeStart()
+    volatile int running;                   ///< the loop thread runs until this is 0
+    int timerFd;                            ///< periodic timer of the ticks
+    long long start;                        ///< time of tick 0 in ns
+
+    unsigned long ticks;                    ///< @sa attitudeStats_t::ticks
+    unsigned long overruns;                 ///< @sa attitudeStats_t::overruns
+    unsigned long staleSamples;             ///< @sa attitudeStats_t::staleSamples
+    int error[ATT_AXES];                    ///< @sa attitudeStats_t::error
+    histogram_t wakeup;                     ///< @sa attitudeStats_t::wakeup
+    histogram_t loopTime;                   ///< @sa attitudeStats_t::loopTime
+    histogram_t sampleAge;                  ///< @sa attitudeStats_t::sampleAge
+};
+
+/*!
+ \brief Run the controllers for a sample and a command and submit the duty cycles
+
+ With zero throttle the motors idle and the controllers are reset, so nothing winds
+ up while the copter is on the ground.
+*/
+static void attitudeTick(attitude_t *a, const sensorSample_t *s, const command_t *command)
+{
+    const mixerInput_t *cmd = &command->stick;
+    int (*value)[4] = mailboxBack(a->motors);
+    int setpoint[ATT_AXES];
+    mixerInput_t in = {cmd->throttle, 0, 0, 0};
+    int i;
+
+    if (cmd->throttle <= 0)
+    {
+        for (i = 0; i < ATT_AXES; i++)
+        {
+            pidReset(&a->rate[i]);
+            if (i < 2)
+                pidReset(&a->angle[i]);
+        }
+    }
+    else
+    {
+        // outer loop: angle -> rate (fixed point, the stick is Q12)
+        for (i = 0; i < 2; i++)
+        {
+            setpoint[i] = (int)(((long long)(i == ATT_ROLL ? cmd->roll : cmd->pitch) * a->cfg.maxAngle) >> MIXER_SHIFT);
+            a->error[i] = setpoint[i] - s->angle[i];
+            setpoint[i] = pidRun(&a->angle[i], setpoint[i], s->angle[i]);
+        }
+        setpoint[ATT_YAW] = (int)(((long long)cmd->yaw * a->cfg.maxYawRate) >> MIXER_SHIFT);
+        a->error[ATT_YAW] = setpoint[ATT_YAW] - s->rate[ATT_YAW];
+
+        // inner loop: rate -> differential thrust
+        in.roll  = pidRun(&a->rate[ATT_ROLL], setpoint[ATT_ROLL], s->rate[ATT_ROLL]);
+        in.pitch = pidRun(&a->rate[ATT_PITCH], setpoint[ATT_PITCH], s->rate[ATT_PITCH]);
+        in.yaw   = pidRun(&a->rate[ATT_YAW], setpoint[ATT_YAW], s->rate[ATT_YAW]);
+    }
+    mixerRun(a->mixer, &in, value);
+    // every tick carries the input time of its command, the library measures only the first delivery
+    copterSubmitInput(a->copter, 0, a->numSlaves, (const int (*)[4])value, command->inputTime);  // a failure is counted by the library
+    mailboxPublish(a->motors);
+}
+
+/*!
+ \brief Thread of the loop: one tick per expiration of the timer
+
+ \param arg the loop
+ \return void* NULL
+*/
+static void *attitudeThread(void *arg)
+{
+    attitude_t *a = arg;
+    long period = 1000000000L / a->cfg.rate;
+    const sensorSample_t *s;
+    uint64_t expirations;
+    long long now;
+
+    realtimePrefaultStack();
+    while (a->running)
+    {
+        if (read(a->timerFd, &expirations, sizeof(expirations)) != sizeof(expirations))
+            continue;
+        now = nowNs();
+        a->ticks += expirations;
+        a->overruns += expirations - 1;
+        histogramRecord(&a->wakeup, now - (a->start + (long long)a->ticks * period));
+
+        if (mailboxFetch(a->sensor) == 0)
+            a->staleSamples++;
+        s = mailboxFront(a->sensor);
+        if (s->time == 0)
+            continue;       // no sample yet
+        histogramRecord(&a->sampleAge, now - s->time);
+        mailboxFetch(a->command);
+        attitudeTick(a, s, mailboxFront(a->command));
+        histogramRecord(&a->loopTime, nowNs() - now);
+    }
+    return NULL;
+}
+
+void attitudeDefaults(attitudeConfig_t *cfg)
+{
+    memset(cfg, 0, sizeof(attitudeConfig_t));
+    cfg->rate       = ATTITUDE_RATE;
+    cfg->maxAngle   = 30000;
+    cfg->maxYawRate = 180000;
+    cfg->angle         = (pidGains_t){PID_GAIN(6.0),   0,               0,                400000};
+    cfg->rateRollPitch = (pidGains_t){PID_GAIN(0.015), PID_GAIN(0.05),  PID_GAIN(0.0003), MIXER_ONE / 2};
+    cfg->rateYaw       = (pidGains_t){PID_GAIN(0.02),  PID_GAIN(0.05),  0,                MIXER_ONE / 4};
+}
+
+attitude_t *attitudeOpen(copter_t *c, mixer_t *mixer, const attitudeConfig_t *cfg)
+{
+    attitude_t *a;
+    int i;
+
+    if (cfg->rate < 1 || cfg->rate > ATTITUDE_MAX_RATE)
+    {
+        errno = EINVAL;
+        return NULL;
+    }
+    a = calloc(1, sizeof(attitude_t));
+    if (a == NULL)
+        return NULL;
+    a->cfg = *cfg;
+    a->copter = c;
+    a->mixer = mixer;
+    a->numSlaves = (mixer->numMotors + 3) / 4;
+    a->timerFd = -1;
+    a->sensor = mailboxCreate(sizeof(sensorSample_t));
+    a->command = mailboxCreate(sizeof(command_t));
+    a->motors = mailboxCreate(sizeof(int[COPTER_MAX_SLAVES][4]));
+    if (a->sensor == NULL || a->command == NULL || a->motors == NULL)
+    {
+        attitudeClose(a);
+        return NULL;
+    }
+    for (i = 0; i < ATT_AXES; i++)
+    {
+        pidInit(&a->rate[i], i == ATT_YAW ? &cfg->rateYaw : &cfg->rateRollPitch, cfg->rate);
+        if (i < 2)
+            pidInit(&a->angle[i], &cfg->angle, cfg->rate);
+    }
+    return a;
+}
+
+int attitudeStart(attitude_t *a, const pthread_attr_t *attr)
+{
+    a->start = nowNs();
+    a->timerFd = periodicTimer(1000000000L / a->cfg.rate);
+    if (a->timerFd == -1)
+        return -1;
+    a->running = 1;
+    if (threadCreate(&a->thread, attr, attitudeThread, a) != 0)
+    {
+        a->running = 0;
+        return -1;
+    }
+    a->started = 1;
+    return 0;
+}
+
+sensorSample_t *attitudeSensorBack(attitude_t *a)
+{
+    return mailboxBack(a->sensor);
+}
+
+void attitudeSensorPublish(attitude_t *a)
+{
+    mailboxPublish(a->sensor);
+}
+
+void attitudeCommand(attitude_t *a, const mixerInput_t *command, long long inputTime)
+{
+    command_t *back = mailboxBack(a->command);
+
+    back->stick = *command;
+    back->inputTime = inputTime;
+    mailboxPublish(a->command);
+}
+
+mailbox_t *attitudeMotors(attitude_t *a)
+{
+    return a->motors;
+}
+
+void attitudeStats(attitude_t *a, attitudeStats_t *stats)
+{
+    stats->ticks            = a->ticks;
+    stats->overruns         = a->overruns;
+    stats->staleSamples     = a->staleSamples;
+    stats->samples          = a->sensor->published;
+    stats->coalescedSamples = a->sensor->coalesced;
+    histogramLatency(&a->wakeup, &stats->wakeup);
+    histogramLatency(&a->loopTime, &stats->loopTime);
+    histogramLatency(&a->sampleAge, &stats->sampleAge);
+    memcpy(stats->error, a->error, sizeof(stats->error));
+}
+
+void attitudeClose(attitude_t *a)
+{
+    a->running = 0;
+    if (a->started)
+        pthread_join(a->thread, NULL);     // wakes up with the next tick
+    if (a->timerFd != -1)
+        close(a->timerFd);
+    if (a->sensor != NULL)
+        mailboxFree(a->sensor);
+    if (a->command != NULL)
+        mailboxFree(a->command);
+    if (a->motors != NULL)
+        mailboxFree(a->motors);
+    free(a);
+}
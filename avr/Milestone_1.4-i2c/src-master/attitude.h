@@ -0,0 +1,151 @@
+/**
+    @file src-master/attitude.h
+    @brief closed-loop attitude control: cascaded fixed-point angle and rate PID controllers
+    @author Jan Sommer
+
+    A thread of the loop wakes up with a fixed rate (up to ATTITUDE_MAX_RATE) and
+        - fetches the newest sensor sample from a mailbox (triple buffer): it never
+          waits for the producer, a tick without a new sample reuses the last one
+        - runs the angle controllers of roll and pitch, whose outputs are the setpoints
+          of the rate controllers (yaw only has a rate controller)
+        - mixes throttle and the outputs of the rate controllers @sa mixer.h and hands
+          the duty cycles over to libcopter with copterSubmitInput(), which never waits for the bus
+
+    The pilot commands the loop with a mixerInput_t: throttle, the roll and pitch angle
+    (MIXER_ONE == maxAngle) and the yaw rate (MIXER_ONE == maxYawRate).
+
+    Units: angles in mdeg, rates in mdeg/s. Positive roll lowers the right side, positive
+    pitch raises the nose, positive yaw turns the nose to the right.
+*/
+
+#ifndef ATTITUDE_H
+#define ATTITUDE_H
+
+#include <pthread.h>
+#include "copter.h"
+#include "mixer.h"
+#include "mailbox.h"
+#include "pid.h"
+
+#define ATTITUDE_MAX_RATE   1000    ///< Maximum rate of the loop in Hz
+#define ATTITUDE_RATE       500     ///< Default rate of the loop in Hz
+
+enum { ATT_ROLL, ATT_PITCH, ATT_YAW, ATT_AXES };   ///< index of the axes in the arrays
+
+/**
+    @brief a sample of the attitude sensor
+*/
+typedef struct
+{
+    long long time;         ///< CLOCK_MONOTONIC of the measurement in ns
+    int angle[ATT_AXES];    ///< attitude in mdeg
+    int rate[ATT_AXES];     ///< angular rate in mdeg/s
+} sensorSample_t;
+
+/**
+    @brief configuration of the loop @sa attitudeDefaults
+*/
+typedef struct
+{
+    int rate;                       ///< rate of the loop in Hz (1..ATTITUDE_MAX_RATE)
+    int maxAngle;                   ///< roll and pitch angle of a full stick in mdeg
+    int maxYawRate;                 ///< yaw rate of a full stick in mdeg/s
+    pidGains_t angle;               ///< angle controller of roll and pitch: mdeg -> mdeg/s
+    pidGains_t rateRollPitch;       ///< rate controller of roll and pitch: mdeg/s -> mixer input
+    pidGains_t rateYaw;             ///< rate controller of yaw: mdeg/s -> mixer input
+} attitudeConfig_t;
+
+/**
+    @brief timing of the loop, all times in ns
+*/
+typedef struct
+{
+    unsigned long ticks;            ///< number of ticks of the loop
+    unsigned long overruns;         ///< ticks which were missed because a tick took too long
+    unsigned long staleSamples;     ///< ticks without a new sensor sample
+    unsigned long samples;          ///< sensor samples which were published
+    unsigned long coalescedSamples; ///< samples which were replaced before the loop fetched them
+    latency_t wakeup;               ///< delay of the wakeup after the start of the tick
+    latency_t loopTime;             ///< time from the wakeup until the duty cycles were submitted
+    latency_t sampleAge;            ///< age of the used sensor sample at the wakeup
+    int error[ATT_AXES];            ///< last error of the angle (roll, pitch) and the rate (yaw)
+} attitudeStats_t;
+
+typedef struct attitude attitude_t;
+
+/*!
+ \brief Default rate and gains
+
+ \param cfg the configuration which is initialized
+*/
+void attitudeDefaults(attitudeConfig_t *cfg);
+
+/*!
+ \brief Set up the loop
+
+ \param c the device handle which gets the duty cycles
+ \param mixer the mixer of the motors (owned by the loop while it runs)
+ \param cfg the rate and the gains
+ \return attitude_t* the loop or NULL on error (errno is set)
+*/
+attitude_t *attitudeOpen(copter_t *c, mixer_t *mixer, const attitudeConfig_t *cfg);
+
+/*!
+ \brief Start the thread of the loop
+
+ \param a the loop
+ \param attr the attributes of the thread (NULL for default attributes), e.g. from realtimeAttr()
+ \return int 0 if successful otherwise -1
+*/
+int attitudeStart(attitude_t *a, const pthread_attr_t *attr);
+
+/*!
+ \brief Get the buffer for the next sensor sample (only one producer thread)
+
+ \param a the loop
+ \return sensorSample_t* the buffer, valid until attitudeSensorPublish()
+*/
+sensorSample_t *attitudeSensorBack(attitude_t *a);
+
+/*!
+ \brief Publish the sample in the buffer of attitudeSensorBack() (never blocks)
+
+ \param a the loop
+*/
+void attitudeSensorPublish(attitude_t *a);
+
+/*!
+ \brief Hand new commands of the pilot over to the loop (never blocks, only one pilot thread)
+
+ \param a the loop
+ \param command throttle, roll and pitch angle, yaw rate
+ \param inputTime time of the input in ns for the latency to the bus @sa copterSubmitInput, 0 == not measured
+*/
+void attitudeCommand(attitude_t *a, const mixerInput_t *command, long long inputTime);
+
+/*!
+ \brief Mailbox with the newest duty cycles of the motors (int[COPTER_MAX_SLAVES][4]) for one reader
+
+ The loop publishes every output there, e.g. for a simulation of the airframe @sa plant.h
+
+ \param a the loop
+ \return mailbox_t* the mailbox
+*/
+mailbox_t *attitudeMotors(attitude_t *a);
+
+/*!
+ \brief Get the timing of the loop (from any thread)
+
+ \param a the loop
+ \param stats the timing
+*/
+void attitudeStats(attitude_t *a, attitudeStats_t *stats);
+
+/*!
+ \brief Stop the loop and free it
+
+ \param a the loop
+*/
+void attitudeClose(attitude_t *a);
+
+#endif // ATTITUDE_H
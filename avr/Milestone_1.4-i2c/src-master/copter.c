@@ -0,0 +1,967 @@
+/**
+    @file src-master/copter.c
+    @brief libcopter: drives the ppm-slaves on one or more buses
+    @author Jan Sommer
+
+    Threads of a device handle:
+        - the callers of copterSubmit(): they serialize among themselves with submitLock
+          and publish the complete set of setpoints in the mailbox
+        - the control thread: the only reader of the mailbox, it sends the newest set
+        - one worker per bus if there are several buses: released together by the
+          control thread for every update
+        - readers of the exported telemetry in other processes: the control thread
+          writes it after every update under a seqlock @sa telemetry.h
+        - the recorder thread: the control thread hands every update over in a
+          lock-free queue and never waits for it @sa recorder.h
+
+    Counters which are written by one of these threads are only read by copterStats(),
+    a slightly outdated value there is harmless.
+*/
+
+#include <unistd.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <time.h>
+#include <poll.h>
+#include <stdatomic.h>
+#include <sys/eventfd.h>
+#include "copter.h"
+#include "mailbox.h"
+#include "slave.h"
+#include "transport.h"
+#include "histogram.h"
+#include "telemetry.h"
+#include "recorder.h"
+#include "realtime.h"
+
+#define RETRY_LIMIT     2           ///< Number of retries of a failed update within a tick
+#define RETRY_BACKOFF   200000L     ///< Wait before the first retry in ns, doubled for every further retry
+#define PENDING_RETRY   4           ///< With rate 0: time in ms after which an undelivered update is sent again
+#define STUCK_TIME      100000000LL ///< A bus which fails for this time in ns is reopened
+
+/**
+    @brief argument of a bus worker
+*/
+typedef struct
+{
+    copter_t *c;    ///< the device handle
+    int b;          ///< the index of the bus
+} workerArg_t;
+
+/**
+    @brief the content of the mailbox of the setpoints
+*/
+typedef struct
+{
+    int value[COPTER_MAX_SLAVES][4];        ///< the duty cycles of all slaves
+    long long input;                        ///< time of the input which caused them in ns, 0 == not measured
+} setpoints_t;
+
+/**
+    @brief state of a device handle
+*/
+struct copter
+{
+    copterConfig_t cfg;                     ///< the configuration
+    transport_t *bus[COPTER_MAX_BUSES];     ///< the buses to the ppm-slaves
+    mailbox_t *setpoints;                   ///< hands the duty cycles over to the control thread
+    pthread_mutex_t submitLock;             ///< serializes the writers of the mailbox
+    int staged[COPTER_MAX_SLAVES][4];       ///< the newest setpoints of all slaves (protected by submitLock)
+    long long lastInput;                    ///< input time of the last measured update (written by the control thread)
+    histogram_t inputLatency;               ///< @sa copterStats_t::inputLatency (written by the control thread)
+    int wakeupFd;                           ///< timerfd (or eventfd with rate 0) which wakes up the control thread
+    pthread_t control;                      ///< the control thread
+    int started;                            ///< 1 if the control thread runs
+    volatile int running;                   ///< the threads run until this is 0
+
+    /**
+        @brief worker threads which drive the buses in parallel (only with more than one bus)
+
+        The control thread releases all workers at once for every update and waits until
+        all buses are updated. The skew is the time between the first and the last bus
+        finishing their transfer, i.e. how far apart the motors on different buses change.
+    */
+    struct
+    {
+        pthread_t thread[COPTER_MAX_BUSES]; ///< worker of each bus
+        workerArg_t arg[COPTER_MAX_BUSES];  ///< argument of each worker
+        int started;                        ///< 1 if the workers run
+        pthread_barrier_t start;            ///< releases the workers for an update
+        pthread_barrier_t written;          ///< the workers wait here for each other before the latch (synchronized mode)
+        pthread_barrier_t done;             ///< the control thread waits here for the workers
+        const int (*value)[4];              ///< duty cycles of the current update
+        int ok[COPTER_MAX_BUSES];           ///< result of each bus in the current update
+        long long finished[COPTER_MAX_BUSES]; ///< time when each bus finished the current update in ns
+        long lastSkew;                      ///< skew of the last update in ns
+        long maxSkew;                       ///< largest skew in ns
+        long long sumSkew;                  ///< sum of the skews for the average
+        unsigned long ticks;                ///< number of updates with all workers
+    } workers;
+
+    /**
+        @brief outages and recoveries of the buses (written by the thread which drives the bus)
+    */
+    struct
+    {
+        long long failingSince[COPTER_MAX_BUSES]; ///< time of the first failed transfer of the current outage in ns, 0 if the bus works
+        long long lastReopen[COPTER_MAX_BUSES];   ///< time of the last reopen of the bus in ns
+        unsigned long outages;              ///< number of outages of all buses
+        int recoveries;                     ///< number of reopened buses
+        long lastRecovery;                  ///< time to recover of the last outage in ns
+        long maxRecovery;                   ///< longest time to recover in ns
+    } health;
+
+    atomic_int failed;                      ///< @sa copterStats_t::failed
+    atomic_int verifyFailures;              ///< @sa copterStats_t::verifyFailures
+    int lastError;                          ///< @sa copterStats_t::lastError
+    int slaveFailures[COPTER_MAX_SLAVES];   ///< @sa copterStats_t::slaveFailures (written by the thread of the bus)
+    int missedTicks;                        ///< @sa copterStats_t::missedTicks (written by the control thread)
+    unsigned long retries;                  ///< @sa copterStats_t::retries (written by the control thread)
+    unsigned long lostUpdates;              ///< @sa copterStats_t::lostUpdates (written by the control thread)
+    int readback[COPTER_MAX_SLAVES][4];     ///< duty cycles mirrored by each slave in the last update (verified mode)
+    int readbackValid[COPTER_MAX_SLAVES];   ///< 1 if the slave acknowledged the last update and was read back
+    unsigned long updates;                  ///< number of updates (written by the control thread)
+    long long deadline;                     ///< the current update should be on the buses before this time in ns
+    telemetry_t *telemetry;                 ///< the exported telemetry, NULL if not exported @sa copterExport
+    recorder_t *recorder;                   ///< the recording of the updates, NULL if not recorded @sa copterRecord
+};
+
+/*!
+ \brief Length of a tick in ns: the period of the control thread, one PPM frame with rate 0
+*/
+static long tickLength(copter_t *c)
+{
+    return 1000000000L / (c->cfg.rate > 0 ? c->cfg.rate : COPTER_RATE);
+}
+
+/*!
+ \brief Open the device of a bus
+*/
+static transport_t *busOpen(copter_t *c, int b)
+{
+    transport_t *t;
+
+    if (!c->cfg.serial)
+        return transportOpen(c->cfg.device[b], c->cfg.baud);
+    if (strcmp(c->cfg.device[b], "emu-uart") == 0)
+        t = serialEmulatorOpen(c->cfg.baud);
+    else
+        t = serialOpen(c->cfg.device[b], c->cfg.baud);
+    if (t != NULL)
+        schedulerInit(&t->scheduler, SCHED_TICK);     // done by transportOpen() otherwise
+    return t;
+}
+
+/*!
+ \brief Write registers of a slave
+*/
+static int busWrite(copter_t *c, int s, const uint8_t *data, int len)
+{
+    return transportWrite(c->bus[c->cfg.slaveBus[s]], c->cfg.slaveAddr[s], data, len);
+}
+
+/*!
+ \brief Switch the slave into synchronized mode
+
+ In synchronized mode the slaves stage all new duty cycles. They are applied by
+ all slaves on the bus at their next frame boundary after the latch command.
+*/
+static int slaveInit(copter_t *c, int s)
+{
+    uint8_t data[2] = {CONTROL_REGISTER, CTRL_SYNC_LATCH};
+
+    if (c->cfg.sync && busWrite(c, s, data, 2) != 2)
+        return -1;
+    return 0;
+}
+
+/*!
+ \brief Reopen a bus which is stuck and initialize its slaves again
+*/
+static void busRecover(copter_t *c, int b)
+{
+    transport_t *fresh;
+    int s;
+
+    c->health.lastReopen[b] = nowNs();
+    fresh = busOpen(c, b);
+    if (fresh == NULL)
+        return;     // try again after STUCK_TIME
+    transportReplace(c->bus[b], fresh);
+    c->health.recoveries++;
+
+    for (s = 0; s < c->cfg.numSlaves; s++)
+        if (c->cfg.slaveBus[s] == b)
+            slaveInit(c, s);    // a failure is handled by the next update
+}
+
+/*!
+ \brief Track the outages of a bus after a transfer and recover it if it is stuck
+
+ A bus is failing if no slave answered. After STUCK_TIME of failing it is reopened
+ (at most once per STUCK_TIME). The time from the first failed transfer to the
+ next successful one is the time to recover.
+
+ \param c the device handle
+ \param b the index of the bus
+ \param failed 1 if no message of the transfer was successful
+*/
+static void busCheck(copter_t *c, int b, int failed)
+{
+    long long now = nowNs();
+    long recovery;
+
+    if (!failed)
+    {
+        if (c->health.failingSince[b] != 0)
+        {
+            recovery = now - c->health.failingSince[b];
+            c->health.lastRecovery = recovery;
+            if (recovery > c->health.maxRecovery)
+                c->health.maxRecovery = recovery;
+            c->health.failingSince[b] = 0;
+        }
+        return;
+    }
+    if (c->health.failingSince[b] == 0)
+    {
+        c->health.failingSince[b] = now;
+        c->health.outages++;
+    }
+    else if (now - c->health.failingSince[b] >= STUCK_TIME && now - c->health.lastReopen[b] >= STUCK_TIME)
+        busRecover(c, b);
+}
+
+/*!
+ \brief Limit a duty cycle to the valid range of the slave
+*/
+static int clampChannel(int value)
+{
+    if (value > MAX_DUTY_CYCLE)
+        return MAX_DUTY_CYCLE;
+    if (value < 0)
+        return 0;
+    return value;
+}
+
+/*!
+ \brief Build the packed frame of a slave: 4 x 12 bit and CRC8
+
+ \param value the duty cycles of the 4 channels
+ \param data the frame beginning with the register (PACKED_LENGTH + 1 bytes)
+ \param mirror the duty cycle registers 0..7 which the slave mirrors after the frame
+ \return int the length of @a data
+*/
+static int packFrame(const int value[4], uint8_t *data, uint8_t mirror[8])
+{
+    int v[4];
+    int i;
+
+    for (i = 0; i < 4; i++)
+    {
+        v[i] = clampChannel(value[i]) >> 1;
+        mirror[2*i]   = HIGH_BYTE(v[i] << 1);
+        mirror[2*i+1] = LOW_BYTE(v[i] << 1);
+    }
+    data[0] = PACKED_REGISTER;
+    data[1] = v[0] >> 4;
+    data[2] = ((v[0] & 0x0f) << 4) | (v[1] >> 8);
+    data[3] = v[1] & 0xff;
+    data[4] = v[2] >> 4;
+    data[5] = ((v[2] & 0x0f) << 4) | (v[3] >> 8);
+    data[6] = v[3] & 0xff;
+    data[7] = 0;
+    for (i = 0; i < PACKED_LENGTH; i++)
+        data[7] = crc8(data[7], data[i]);
+    return PACKED_LENGTH + 1;
+}
+
+/*!
+ \brief Build the frame of a slave which writes the 16 bit duty cycle registers
+
+ \param value the duty cycles of the 4 channels
+ \param data the frame beginning with the register (9 bytes)
+ \param mirror the duty cycle registers 0..7 which the slave mirrors after the frame
+ \return int the length of @a data
+*/
+static int registerFrame(const int value[4], uint8_t *data, uint8_t mirror[8])
+{
+    int i;
+
+    data[0] = STARTREGISTER;
+    for (i=0; i<4;i++)
+    {
+        data[2*i+1]   = HIGH_BYTE(clampChannel(value[i]));
+        data[2*i+2]   = LOW_BYTE(clampChannel(value[i]));
+    }
+    memcpy(mirror, &data[1], 8);
+    return 9;
+}
+
+/*!
+ \brief Writes new duty cycles to all channels of all slaves on one bus at once
+
+ The writes of all slaves, the readbacks in verified mode and (if @a latch) the latch
+ command are submitted as one transfer (one I2C_RDWR ioctl per update).
+ The messages which failed are counted per slave in slaveFailures.
+
+ \param c the device handle
+ \param b the index of the bus
+ \param value the duty cycles of the 4 channels of each slave
+ \param latch 1: append the latch command of the synchronized mode
+ \return int 0 if successful otherwise -1
+*/
+static int setBusChannels(copter_t *c, int b, const int value[][4], int latch)
+{
+    uint8_t frame[COPTER_MAX_SLAVES][9];    // the 16 bit register frame is the longest
+    uint8_t mirror[COPTER_MAX_SLAVES][8];
+    uint8_t readback[COPTER_MAX_SLAVES][8];
+    uint8_t mirrorRegister = STARTREGISTER;
+    uint8_t latchCommand = GENERAL_CALL_LATCH;
+    busMsg_t msgs[3 * COPTER_MAX_SLAVES + 1];
+    int status[3 * COPTER_MAX_SLAVES + 1];
+    int write[COPTER_MAX_SLAVES];
+    int s, i, n = 0, len, failed, result = 0;
+
+    for (s = 0; s < c->cfg.numSlaves; s++)
+    {
+        if (c->cfg.slaveBus[s] != b)
+            continue;
+        if (c->cfg.packed)
+            len = packFrame(value[s], frame[s], mirror[s]);
+        else
+            len = registerFrame(value[s], frame[s], mirror[s]);
+        write[s] = n;
+        msgs[n++] = (busMsg_t){c->cfg.slaveAddr[s], 0, len, frame[s]};
+        if (c->cfg.verify)
+        {
+            // repeated start: set the address of the mirror and read it back
+            msgs[n++] = (busMsg_t){c->cfg.slaveAddr[s], 0, 1, &mirrorRegister};
+            msgs[n++] = (busMsg_t){c->cfg.slaveAddr[s], BUS_READ, 8, readback[s]};
+        }
+    }
+    // the serial transport sends the general call as command frame
+    if (latch)
+        msgs[n++] = (busMsg_t){0, 0, 1, &latchCommand};
+
+    if (n == 0)
+        return 0;
+    busSetClass(BUS_MOTOR, c->deadline);
+    failed = transportBatch(c->bus[b], msgs, n, status);
+    busSetClass(BUS_TELEMETRY, 0);
+    if (failed != 0)
+        result = -1;
+    busCheck(c, b, failed == n);
+    for (s = 0; s < c->cfg.numSlaves; s++)
+    {
+        if (c->cfg.slaveBus[s] != b)
+            continue;
+        c->readbackValid[s] = c->cfg.verify && status[write[s]] == 0 && status[write[s] + 2] == 0;
+        if (status[write[s]] != 0)
+        {
+            c->slaveFailures[s]++;
+            c->failed++;
+            c->lastError = status[write[s]];
+        }
+        else if (c->cfg.verify)
+        {
+            for (i = 0; i < 4; i++)
+                c->readback[s][i] = (readback[s][2*i] << 8) | readback[s][2*i+1];
+            if (memcmp(readback[s], mirror[s], 8) != 0)
+            {
+                c->verifyFailures++;
+                c->slaveFailures[s]++;
+                result = -1;
+            }
+        }
+    }
+    if (latch && status[n - 1] != 0)
+        c->failed++;
+    return result;
+}
+
+/*!
+ \brief Send the latch command of the synchronized mode on one bus (after the writes)
+
+ \param c the device handle
+ \param b the index of the bus
+ \return int 0 if successful otherwise -1
+*/
+static int busLatch(copter_t *c, int b)
+{
+    uint8_t latch = GENERAL_CALL_LATCH;
+    busMsg_t msg = {0, 0, 1, &latch};
+    int status, failed;
+
+    busSetClass(BUS_MOTOR, c->deadline);
+    failed = transportBatch(c->bus[b], &msg, 1, &status);
+    busSetClass(BUS_TELEMETRY, 0);
+    if (failed == 0)
+        return 0;
+    c->failed++;
+    return -1;
+}
+
+/*!
+ \brief Worker thread which drives one bus
+
+ In synchronized mode the workers latch only when all buses are written, so the
+ slaves on all buses apply the update at the same frame boundary.
+
+ \param arg the workerArg_t of the bus
+ \return void* NULL
+*/
+static void *busWorker(void *arg)
+{
+    copter_t *c = ((workerArg_t *)arg)->c;
+    int b = ((workerArg_t *)arg)->b;
+
+    if (c->cfg.realtime)
+        realtimePrefaultStack();
+
+    for (;;)
+    {
+        pthread_barrier_wait(&c->workers.start);
+        if (c->workers.value == NULL)
+            break;      // busWorkersStop()
+        c->workers.ok[b] = setBusChannels(c, b, c->workers.value, 0);
+        if (c->cfg.sync)
+        {
+            pthread_barrier_wait(&c->workers.written);
+            if (busLatch(c, b) != 0)
+                c->workers.ok[b] = -1;
+        }
+        c->workers.finished[b] = nowNs();
+        pthread_barrier_wait(&c->workers.done);
+    }
+    return NULL;
+}
+
+/*!
+ \brief Start a worker thread for each bus (only if there is more than one bus)
+
+ In real-time mode the workers run with SCHED_FIFO on the CPUs below the CPU of
+ the control thread.
+*/
+static int busWorkersStart(copter_t *c)
+{
+    pthread_attr_t attr;
+    long cpus = sysconf(_SC_NPROCESSORS_ONLN);
+    int cpu = c->cfg.cpu >= 0 ? c->cfg.cpu : cpus - 1;
+    int b, result;
+
+    if (c->cfg.numBuses == 1)
+        return 0;
+    if (pthread_barrier_init(&c->workers.start, NULL, c->cfg.numBuses + 1) != 0 ||
+        pthread_barrier_init(&c->workers.written, NULL, c->cfg.numBuses) != 0 ||
+        pthread_barrier_init(&c->workers.done, NULL, c->cfg.numBuses + 1) != 0)
+        return -1;
+    for (b = 0; b < c->cfg.numBuses; b++)
+    {
+        c->workers.arg[b].c = c;
+        c->workers.arg[b].b = b;
+        if (c->cfg.realtime && realtimeAttr(&attr, ((cpu - 1 - b) % cpus + cpus) % cpus, RT_PRIORITY) != 0)
+            return -1;
+        result = threadCreate(&c->workers.thread[b], c->cfg.realtime ? &attr : NULL, busWorker, &c->workers.arg[b]);
+        if (c->cfg.realtime)
+            pthread_attr_destroy(&attr);
+        if (result != 0)
+            return -1;
+    }
+    c->workers.started = 1;
+    return 0;
+}
+
+/*!
+ \brief Stop the worker threads
+*/
+static void busWorkersStop(copter_t *c)
+{
+    int b;
+
+    if (!c->workers.started)
+        return;
+    c->workers.value = NULL;
+    pthread_barrier_wait(&c->workers.start);
+    for (b = 0; b < c->cfg.numBuses; b++)
+        pthread_join(c->workers.thread[b], NULL);
+    pthread_barrier_destroy(&c->workers.start);
+    pthread_barrier_destroy(&c->workers.written);
+    pthread_barrier_destroy(&c->workers.done);
+}
+
+/*!
+ \brief Writes new duty cycles to all channels of all slaves at once
+
+ With several buses the workers update all buses in parallel and the skew
+ between the buses is measured.
+*/
+static int setAllChannels(copter_t *c, const int value[][4])
+{
+    long long first, last;
+    long skew;
+    int b, result = 0;
+
+    if (c->cfg.numBuses == 1)
+        return setBusChannels(c, 0, value, c->cfg.sync);
+
+    c->workers.value = value;
+    pthread_barrier_wait(&c->workers.start);
+    pthread_barrier_wait(&c->workers.done);
+
+    first = last = c->workers.finished[0];
+    for (b = 0; b < c->cfg.numBuses; b++)
+    {
+        if (c->workers.finished[b] < first)
+            first = c->workers.finished[b];
+        if (c->workers.finished[b] > last)
+            last = c->workers.finished[b];
+        if (c->workers.ok[b] != 0)
+            result = -1;
+    }
+    skew = last - first;
+    c->workers.lastSkew = skew;
+    if (skew > c->workers.maxSkew)
+        c->workers.maxSkew = skew;
+    c->workers.sumSkew += skew;
+    c->workers.ticks++;
+    return result;
+}
+
+/*!
+ \brief Hand an update over to the recorder (if it is recorded)
+
+ Only a copy into the queue of the recorder thread, a full queue drops the update.
+*/
+static void recordUpdate(copter_t *c, long long time, const int value[][4], int delivered)
+{
+    recordEntry_t e;
+
+    e.time  = time;
+    e.flags = (delivered ? RECORD_DELIVERED : 0) | (c->cfg.verify ? RECORD_READBACK : 0);
+    memcpy(e.value, value, c->cfg.numSlaves * sizeof(e.value[0]));
+    memcpy(e.readback, c->readback, c->cfg.numSlaves * sizeof(e.readback[0]));
+    recorderPush(c->recorder, &e);
+}
+
+/*!
+ \brief Publish an update: the telemetry in the shared memory and the recording (if enabled)
+
+ Only a copy into the segment between the two increments of the seqlock. The
+ latencies are summarized only every TELEMETRY_LATENCY_TICKS updates.
+
+ \param c the device handle
+ \param value the duty cycles which were sent
+ \param delivered 1 if the update was delivered
+*/
+static void publishUpdate(copter_t *c, const int value[][4], int delivered)
+{
+    telemetryData_t *t;
+    long long time;
+    int b;
+
+    c->updates++;
+    if (c->telemetry == NULL && c->recorder == NULL)
+        return;
+    time = nowNs();
+    if (c->recorder != NULL)
+        recordUpdate(c, time, value, delivered);
+    if (c->telemetry == NULL)
+        return;
+    t = telemetryBegin(c->telemetry);
+    t->updates        = c->updates;
+    t->time           = time;
+    t->delivered      = delivered;
+    t->numSlaves      = c->cfg.numSlaves;
+    t->numBuses       = c->cfg.numBuses;
+    memcpy(t->setpoint, value, c->cfg.numSlaves * sizeof(t->setpoint[0]));
+    memcpy(t->readback, c->readback, c->cfg.numSlaves * sizeof(t->readback[0]));
+    t->verified       = c->cfg.verify;
+    t->failed         = c->failed;
+    t->verifyFailures = c->verifyFailures;
+    memcpy(t->slaveFailures, c->slaveFailures, sizeof(t->slaveFailures));
+    t->missedTicks    = c->missedTicks;
+    t->retries        = c->retries;
+    t->lostUpdates    = c->lostUpdates;
+    t->recoveries     = c->health.recoveries;
+    for (b = 0; b < c->cfg.numBuses && c->updates % TELEMETRY_LATENCY_TICKS == 1; b++)
+    {
+        histogramLatency(&c->bus[b]->writeLatency, &t->writeLatency[b]);
+        histogramLatency(&c->bus[b]->readLatency, &t->readLatency[b]);
+    }
+    telemetryEnd(c->telemetry);
+}
+
+/*!
+ \brief Send the newest duty cycles, retry with backoff if the update failed
+
+ Before every retry the mailbox is checked again, so a retry never sends
+ values which were already superseded. An update which still failed after
+ RETRY_LIMIT retries is counted as lost.
+*/
+static int sendNewest(copter_t *c)
+{
+    struct timespec backoff = {0, RETRY_BACKOFF};
+    const setpoints_t *set = mailboxFront(c->setpoints);
+    int retry, result;
+
+    c->deadline = nowNs() + tickLength(c);      // for the retries too
+    result = setAllChannels(c, set->value);
+    for (retry = 0; result != 0 && retry < RETRY_LIMIT && c->running; retry++)
+    {
+        nanosleep(&backoff, NULL);
+        backoff.tv_nsec *= 2;
+        mailboxFetch(c->setpoints);
+        set = mailboxFront(c->setpoints);
+        c->retries++;
+        result = setAllChannels(c, set->value);
+    }
+    if (result != 0)
+        c->lostUpdates++;
+    else if (set->input != 0 && set->input != c->lastInput)
+    {
+        // only the first delivery counts, the control thread sends the same set again every tick
+        histogramRecord(&c->inputLatency, nowNs() - set->input);
+        c->lastInput = set->input;
+    }
+    publishUpdate(c, set->value, result == 0);
+    return result;
+}
+
+/*!
+ \brief Thread which sends the newest duty cycles to the slaves
+
+ The thread is woken up by wakeupFd, so the updates on the bus are
+ independent of the callers of copterSubmit().
+ Ticks which were missed because the bus was too slow are counted in missedTicks.
+ With rate 0 an update which was not delivered is sent again after PENDING_RETRY
+ even if there is no new value.
+
+ \param arg the device handle
+ \return void* NULL
+*/
+static void *controlThread(void *arg)
+{
+    copter_t *c = arg;
+    struct pollfd pfd = {c->wakeupFd, POLLIN, 0};
+    uint64_t expirations;
+    int pending = 0;
+
+    if (c->cfg.realtime)
+        realtimePrefaultStack();
+
+    while (c->running)
+    {
+        if (!pending || c->cfg.rate > 0 || poll(&pfd, 1, PENDING_RETRY) != 0)
+        {
+            if (read(c->wakeupFd, &expirations, sizeof(expirations)) != sizeof(expirations))
+                continue;
+            if (c->cfg.rate > 0)
+                c->missedTicks += expirations - 1;
+
+            if (mailboxFetch(c->setpoints) == 0 && c->cfg.rate == 0 && !pending)
+                continue;   // nothing new to send
+        }
+        pending = sendNewest(c) != 0;
+    }
+    return NULL;
+}
+
+void copterDefaults(copterConfig_t *cfg)
+{
+    memset(cfg, 0, sizeof(copterConfig_t));
+    cfg->device[0] = "/dev/i2c-0";      // i2c-0 for raspberryPi
+    cfg->numBuses = 1;
+    cfg->baud = COPTER_BAUD;
+    cfg->slaveAddr[0] = PPM_SLAVE_ADDR;
+    cfg->numSlaves = 1;
+    cfg->rate = COPTER_RATE;
+    cfg->cpu = -1;
+}
+
+copter_t *copterOpen(const copterConfig_t *cfg)
+{
+    copter_t *c;
+    int b, s;
+
+    if (cfg->numBuses < 1 || cfg->numBuses > COPTER_MAX_BUSES ||
+        cfg->numSlaves < 1 || cfg->numSlaves > COPTER_MAX_SLAVES || cfg->rate < 0 || cfg->rate > 1000)
+    {
+        errno = EINVAL;
+        return NULL;
+    }
+    for (s = 0; s < cfg->numSlaves; s++)
+    {
+        if (cfg->slaveBus[s] < 0 || cfg->slaveBus[s] >= cfg->numBuses)
+        {
+            errno = EINVAL;
+            return NULL;
+        }
+    }
+
+    c = calloc(1, sizeof(copter_t));
+    if (c == NULL)
+        return NULL;
+    c->cfg = *cfg;
+    c->wakeupFd = -1;
+    c->running = 1;
+    c->setpoints = mailboxCreate(sizeof(setpoints_t));
+    if (c->setpoints == NULL)
+    {
+        free(c);
+        return NULL;
+    }
+    pthread_mutex_init(&c->submitLock, NULL);
+
+    for (b = 0; b < cfg->numBuses; b++)
+    {
+        c->bus[b] = busOpen(c, b);
+        if (c->bus[b] == NULL)
+        {
+            copterClose(c);
+            return NULL;
+        }
+        schedulerSetTick(&c->bus[b]->scheduler, tickLength(c));
+    }
+    for (s = 0; s < cfg->numSlaves; s++)
+    {
+        if (slaveInit(c, s) != 0)
+        {
+            copterClose(c);
+            errno = EIO;
+            return NULL;
+        }
+    }
+    return c;
+}
+
+int copterStart(copter_t *c, const pthread_attr_t *attr)
+{
+    if (c->cfg.rate == 0)
+        c->wakeupFd = eventfd(0, EFD_CLOEXEC);
+    else
+        c->wakeupFd = periodicTimer(1000000000L / c->cfg.rate);
+    if (c->wakeupFd == -1 || (!c->workers.started && busWorkersStart(c) != 0))
+        return -1;
+    if (threadCreate(&c->control, attr, controlThread, c) != 0)
+        return -1;
+    c->started = 1;
+    return 0;
+}
+
+int copterSubmit(copter_t *c, int first, int count, const int value[][4])
+{
+    return copterSubmitInput(c, first, count, value, 0);
+}
+
+int copterSubmitInput(copter_t *c, int first, int count, const int value[][4], long long inputTime)
+{
+    setpoints_t *set;
+    uint64_t one = 1;
+
+    if (first < 0 || count < 0 || first + count > c->cfg.numSlaves)
+    {
+        errno = EINVAL;
+        return -1;
+    }
+    pthread_mutex_lock(&c->submitLock);
+    memcpy(c->staged[first], value, count * sizeof(c->staged[0]));
+    set = mailboxBack(c->setpoints);
+    memcpy(set->value, c->staged, sizeof(c->staged));
+    set->input = inputTime;
+    mailboxPublish(c->setpoints);
+    pthread_mutex_unlock(&c->submitLock);
+
+    if (c->cfg.rate == 0 && c->started && write(c->wakeupFd, &one, sizeof(one)) != sizeof(one))
+    {
+        c->failed++;
+        return -1;
+    }
+    return 0;
+}
+
+int copterSend(copter_t *c, const int value[][4])
+{
+    int result;
+
+    if (c->started)
+    {
+        errno = EBUSY;
+        return -1;
+    }
+    if (c->cfg.numBuses > 1 && !c->workers.started && busWorkersStart(c) != 0)
+        return -1;
+    c->deadline = nowNs() + tickLength(c);
+    result = setAllChannels(c, value);
+    publishUpdate(c, value, result == 0);
+    return result;
+}
+
+int copterExport(copter_t *c, const char *name)
+{
+    if (c->started || c->telemetry != NULL)
+    {
+        errno = EBUSY;
+        return -1;
+    }
+    c->telemetry = telemetryCreate(name);
+    return c->telemetry == NULL ? -1 : 0;
+}
+
+int copterRecord(copter_t *c, const char *path, int sizeMB)
+{
+    if (c->started || c->recorder != NULL)
+    {
+        errno = EBUSY;
+        return -1;
+    }
+    c->recorder = recorderOpen(path, sizeMB, c->cfg.numSlaves);
+    return c->recorder == NULL ? -1 : 0;
+}
+
+int copterRead(copter_t *c, int slave, uint8_t reg, uint8_t *data, int n)
+{
+    if (slave < 0 || slave >= c->cfg.numSlaves)
+    {
+        errno = EINVAL;
+        return -1;
+    }
+    return transportRead(c->bus[c->cfg.slaveBus[slave]], c->cfg.slaveAddr[slave], reg, data, n) == n ? 0 : -1;
+}
+
+int copterBusRead(copter_t *c, int b, int addr, uint8_t reg, uint8_t *data, int n)
+{
+    if (b < 0 || b >= c->cfg.numBuses)
+    {
+        errno = EINVAL;
+        return -1;
+    }
+    return transportRead(c->bus[b], addr, reg, data, n) == n ? 0 : -1;
+}
+
+int copterBusWrite(copter_t *c, int b, int addr, const uint8_t *data, int len)
+{
+    if (b < 0 || b >= c->cfg.numBuses)
+    {
+        errno = EINVAL;
+        return -1;
+    }
+    return transportWrite(c->bus[b], addr, data, len) == len ? 0 : -1;
+}
+
+int copterReadback(copter_t *c, int value[][4])
+{
+    int s, valid = 0;
+
+    if (!c->cfg.verify || c->started)
+    {
+        errno = c->started ? EBUSY : EINVAL;
+        return -1;
+    }
+    memcpy(value, c->readback, c->cfg.numSlaves * sizeof(c->readback[0]));
+    for (s = 0; s < c->cfg.numSlaves; s++)
+        if (c->readbackValid[s])
+            valid |= 1 << s;
+    return valid;
+}
+
+void copterStats(copter_t *c, copterStats_t *stats)
+{
+    histogram_t sum[2];     // 8 KB on the stack of the caller
+    int b;
+
+    memset(sum, 0, sizeof(sum));
+    for (b = 0; b < c->cfg.numBuses; b++)
+    {
+        histogramMerge(&sum[0], &c->bus[b]->writeLatency);
+        histogramMerge(&sum[1], &c->bus[b]->readLatency);
+    }
+    histogramLatency(&sum[0], &stats->writeLatency);
+    histogramLatency(&sum[1], &stats->readLatency);
+    histogramLatency(&c->inputLatency, &stats->inputLatency);
+
+    stats->failed         = c->failed;
+    stats->lastError      = c->lastError;
+    stats->verifyFailures = c->verifyFailures;
+    memcpy(stats->slaveFailures, c->slaveFailures, sizeof(stats->slaveFailures));
+    stats->missedTicks    = c->missedTicks;
+    stats->submitted      = c->setpoints->published;
+    stats->coalesced      = c->setpoints->coalesced;
+    stats->retries        = c->retries;
+    stats->lostUpdates    = c->lostUpdates;
+    stats->outages        = c->health.outages;
+    stats->recoveries     = c->health.recoveries;
+    stats->lastRecovery   = c->health.lastRecovery;
+    stats->maxRecovery    = c->health.maxRecovery;
+    stats->parallelTicks  = c->workers.ticks;
+    stats->lastSkew       = c->workers.lastSkew;
+    stats->maxSkew        = c->workers.maxSkew;
+    stats->avgSkew        = c->workers.ticks > 0 ? c->workers.sumSkew / c->workers.ticks : 0;
+    stats->recorded       = c->recorder != NULL ? c->recorder->records : 0;
+    stats->recordDropped  = c->recorder != NULL ? c->recorder->dropped : 0;
+}
+
+void copterBusLatency(copter_t *c, int b, latency_t *write, latency_t *read)
+{
+    histogramLatency(&c->bus[b]->writeLatency, write);
+    histogramLatency(&c->bus[b]->readLatency, read);
+}
+
+int copterBusMethod(copter_t *c, int method)
+{
+    int b;
+
+    if (c->started)
+    {
+        errno = EBUSY;
+        return -1;
+    }
+    for (b = 0; b < c->cfg.numBuses; b++)
+    {
+        if (transportSetMethod(c->bus[b], method) != 0)
+        {
+            while (b-- > 0)
+                transportSetMethod(c->bus[b], TRANSPORT_AUTO);
+            errno = EOPNOTSUPP;
+            return -1;
+        }
+    }
+    return 0;
+}
+
+transport_t *copterBus(copter_t *c, int b)
+{
+    return c->bus[b];
+}
+
+void copterBusSchedule(copter_t *c, int b, busScheduleStats_t *stats)
+{
+    schedulerStats(&c->bus[b]->scheduler, stats);
+}
+
+void copterClose(copter_t *c)
+{
+    uint64_t one = 1;
+    int b;
+
+    c->running = 0;
+    if (c->started)
+    {
+        if (c->cfg.rate == 0 && write(c->wakeupFd, &one, sizeof(one)) != sizeof(one))
+            c->failed++;    // the control thread wakes up with the next submit
+        pthread_join(c->control, NULL);
+    }
+    busWorkersStop(c);
+    if (c->wakeupFd != -1)
+        close(c->wakeupFd);
+    for (b = 0; b < c->cfg.numBuses; b++)
+        transportClose(c->bus[b]);
+    if (c->telemetry != NULL)
+        telemetryClose(c->telemetry);
+    if (c->recorder != NULL)
+        recorderClose(c->recorder);     // after the control thread: writes the queued updates
+    pthread_mutex_destroy(&c->submitLock);
+    mailboxFree(c->setpoints);
+    free(c);
+}
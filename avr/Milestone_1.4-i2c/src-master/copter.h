@@ -0,0 +1,293 @@
+/**
+    @file src-master/copter.h
+    @brief libcopter: drives the ppm-slaves on one or more buses
+    @author Jan Sommer
+
+    All state lives in the device handle returned by copterOpen(), several handles
+    can be used in one process. The duty cycles are sent by a control thread with a
+    fixed rate (or as soon as a new value was submitted with rate 0):
+        - copterSubmit() never waits for the bus. The new setpoints are handed over to
+          the control thread in a lock-free mailbox, the control thread always sends the
+          newest complete set of values (superseded sets are coalesced). Several threads
+          may submit, they only serialize among themselves, never with the control thread.
+        - the writes of all slaves on a bus are sent in one transfer, several buses are
+          driven in parallel by worker threads @sa transportBatch
+        - failed updates are retried with the newest values, stuck buses are reopened
+        - copterStats() can be called from any thread at any time, other processes can
+          sample the telemetry in shared memory @sa copterExport
+        - every update can be recorded in a ring file for a later replay @sa copterRecord
+        - other devices on the buses (e.g. an IMU) share them with the slaves: the motor
+          writes get the bus first and must finish within their tick @sa scheduler.h
+
+    Typical use:
+    @code
+    copterConfig_t cfg;
+    copterDefaults(&cfg);
+    cfg.device[0] = "/dev/i2c-1";
+    copter_t *c = copterOpen(&cfg);
+    copterStart(c, NULL);
+    copterSubmit(c, 0, 1, value);
+    ...
+    copterClose(c);
+    @endcode
+*/
+
+#ifndef COPTER_H
+#define COPTER_H
+
+#include <stdint.h>
+#include <pthread.h>
+#include "realtime.h"
+#include "scheduler.h"
+#include "transport.h"
+
+#define COPTER_MAX_SLAVES   8       ///< Maximum number of ppm-slaves on all buses
+#define COPTER_MAX_BUSES    4       ///< Maximum number of buses
+#define COPTER_RATE         250     ///< Default rate of the control thread in Hz (one update per PPM frame)
+#define COPTER_BAUD         500000  ///< Default baud rate of serial ports @sa USART_BAUD
+
+/**
+    @brief configuration of a device handle
+*/
+typedef struct
+{
+    const char *device[COPTER_MAX_BUSES];   ///< the buses @sa transportOpen
+    int numBuses;                           ///< number of buses
+    int serial;                             ///< 1 if all devices are serial ports (whatever their name is)
+    int baud;                               ///< baud rate of serial ports
+    int slaveAddr[COPTER_MAX_SLAVES];       ///< 7 bit addresses of the ppm-slaves
+    int slaveBus[COPTER_MAX_SLAVES];        ///< index of the bus of each ppm-slave
+    int numSlaves;                          ///< number of ppm-slaves
+    int sync;                               ///< 1: synchronized mode (latch command on every bus after all buses are written)
+    int packed;                             ///< 1: packed frames with CRC8
+    int verify;                             ///< 1: verify every write by reading back the mirror
+    int rate;                               ///< rate of the control thread in Hz, 0 sends only new values
+    int realtime;                           ///< 1: the bus workers run with SCHED_FIFO
+    int cpu;                                ///< CPU of the control thread in real-time mode (-1 == last CPU)
+} copterConfig_t;
+
+/**
+    @brief counters and latencies of a device handle, all times in ns
+*/
+typedef struct
+{
+    int failed;                             ///< failed writes
+    int lastError;                          ///< errno of the last failed write
+    int verifyFailures;                     ///< writes which the slave did not accept as sent
+    int slaveFailures[COPTER_MAX_SLAVES];   ///< failed or not verified writes per slave
+    int missedTicks;                        ///< ticks of the control thread which were missed
+    unsigned long submitted;                ///< number of submitted sets of setpoints
+    unsigned long coalesced;                ///< submitted sets which were replaced before being sent
+    unsigned long retries;                  ///< retries of failed updates
+    unsigned long lostUpdates;              ///< updates which failed after all retries
+    unsigned long outages;                  ///< periods in which no slave on a bus answered
+    int recoveries;                         ///< number of reopened buses
+    long lastRecovery;                      ///< time to recover of the last outage
+    long maxRecovery;                       ///< longest time to recover
+    unsigned long parallelTicks;            ///< updates which were sent on several buses in parallel
+    long lastSkew;                          ///< skew between the buses of the last update
+    long maxSkew;                           ///< largest skew between the buses
+    long avgSkew;                           ///< average skew between the buses
+    unsigned long recorded;                 ///< updates written to the recording so far @sa copterRecord
+    unsigned long recordDropped;            ///< updates not recorded because the recorder fell behind
+    latency_t writeLatency;                 ///< transfers which only write (all buses)
+    latency_t readLatency;                  ///< transfers which read (all buses)
+    latency_t inputLatency;                 ///< from the input to the bus @sa copterSubmitInput
+} copterStats_t;
+
+typedef struct copter copter_t;
+
+/*!
+ \brief Fill a configuration with the defaults (one slave PPM_SLAVE_ADDR on /dev/i2c-0)
+
+ \param cfg the configuration
+*/
+void copterDefaults(copterConfig_t *cfg);
+
+/*!
+ \brief Open the buses and initialize the slaves
+
+ \param cfg the configuration (copied)
+ \return copter_t* the device handle or NULL on error (errno is set)
+*/
+copter_t *copterOpen(const copterConfig_t *cfg);
+
+/*!
+ \brief Start the control thread (and the bus workers with several buses)
+
+ \param c the device handle
+ \param attr the attributes of the control thread (NULL for default attributes)
+ \return int 0 if successful otherwise -1
+*/
+int copterStart(copter_t *c, const pthread_attr_t *attr);
+
+/*!
+ \brief Hand new setpoints over to the control thread without waiting for the bus
+
+ \param c the device handle
+ \param first the index of the first slave
+ \param count the number of slaves
+ \param value the duty cycles of the 4 channels of each slave (0..MAX_DUTY_CYCLE)
+ \return int 0 if successful otherwise -1
+*/
+int copterSubmit(copter_t *c, int first, int count, const int value[][4]);
+
+/*!
+ \brief Hand new setpoints over like copterSubmit() and measure the latency from the input to the bus
+
+ The time from @a inputTime until the end of the first transfer which delivered these
+ setpoints is recorded in copterStats_t::inputLatency. Setpoints which were superseded
+ before the control thread sent them are coalesced and not measured.
+
+ \param c the device handle
+ \param first the index of the first slave
+ \param count the number of slaves
+ \param value the duty cycles of the 4 channels of each slave (0..MAX_DUTY_CYCLE)
+ \param inputTime CLOCK_MONOTONIC in ns of the input which caused the setpoints (e.g. the time of an input event)
+ \return int 0 if successful otherwise -1
+*/
+int copterSubmitInput(copter_t *c, int first, int count, const int value[][4], long long inputTime);
+
+/*!
+ \brief Send duty cycles to all slaves and wait for the bus (without the control thread)
+
+ Must not be used while the control thread runs.
+
+ \param c the device handle
+ \param value the duty cycles of the 4 channels of each slave
+ \return int 0 if the update was delivered otherwise -1
+*/
+int copterSend(copter_t *c, const int value[][4]);
+
+/*!
+ \brief Export the telemetry of every update in the shared memory segment @a name @sa telemetry.h
+
+ Must be called before copterStart(). The segment is removed by copterClose().
+
+ \param c the device handle
+ \param name the name of the segment (without '/')
+ \return int 0 if successful otherwise -1
+*/
+int copterExport(copter_t *c, const char *name);
+
+/*!
+ \brief Record every update in the memory-mapped ring file @a path @sa recorder.h
+
+ Must be called before copterStart(). The newest @a sizeMB MB of records are kept,
+ copterClose() writes the remaining queued updates and closes the file.
+
+ \param c the device handle
+ \param path the file (created or truncated)
+ \param sizeMB the size of the file in MB (1..256)
+ \return int 0 if successful otherwise -1
+*/
+int copterRecord(copter_t *c, const char *path, int sizeMB);
+
+/*!
+ \brief Read registers of a slave (from its txbuffer)
+
+ \param c the device handle
+ \param slave the index of the slave
+ \param reg the first register
+ \param data buffer for the values of the registers
+ \param n the number of registers to read
+ \return int 0 if successful otherwise -1
+*/
+int copterRead(copter_t *c, int slave, uint8_t reg, uint8_t *data, int n);
+
+/*!
+ \brief Read registers of another device on a bus (e.g. an IMU)
+
+ The transfer has the class and the deadline of the calling thread @sa busSetClass
+
+ \param c the device handle
+ \param b the index of the bus
+ \param addr the address of the device
+ \param reg the first register
+ \param data buffer for the values of the registers
+ \param n the number of registers to read
+ \return int 0 if successful otherwise -1
+*/
+int copterBusRead(copter_t *c, int b, int addr, uint8_t reg, uint8_t *data, int n);
+
+/*!
+ \brief Write registers of another device on a bus
+
+ \param c the device handle
+ \param b the index of the bus
+ \param addr the address of the device
+ \param data the first register followed by the values
+ \param len the length of @a data
+ \return int 0 if successful otherwise -1
+*/
+int copterBusWrite(copter_t *c, int b, int addr, const uint8_t *data, int len);
+
+/*!
+ \brief Get the duty cycles which the slaves mirrored in the last update of copterSend() (verified mode)
+
+ \param c the device handle
+ \param value the mirrored duty cycles of the 4 channels of each slave
+ \return int bit mask of the slaves which acknowledged the update and were read back,
+             -1 on error (errno is EINVAL without verified mode, EBUSY after copterStart())
+*/
+int copterReadback(copter_t *c, int value[][4]);
+
+/*!
+ \brief Get the counters and latencies
+
+ \param c the device handle
+ \param stats the current values
+*/
+void copterStats(copter_t *c, copterStats_t *stats);
+
+/*!
+ \brief Get the latency of the transfers on one bus
+
+ \param c the device handle
+ \param b the index of the bus
+ \param write the latency of the transfers which only write
+ \param read the latency of the transfers which read
+*/
+void copterBusLatency(copter_t *c, int b, latency_t *write, latency_t *read);
+
+/*!
+ \brief Select how the transfers are handed to all buses (e.g. to compare the kernel paths of i2c-dev)
+
+ Only before copterStart(). Nothing is changed if a bus does not support the method.
+
+ \param c the device handle
+ \param method the transportMethod_t @sa transportSetMethod
+ \return int 0 if successful otherwise -1 (errno is EOPNOTSUPP or EBUSY)
+*/
+int copterBusMethod(copter_t *c, int method);
+
+/*!
+ \brief The transport of one bus, e.g. for emulatorStall()
+
+ The transport stays the same when the bus is reopened @sa transportReplace
+
+ \param c the device handle
+ \param b the index of the bus
+ \return transport_t* the transport
+*/
+transport_t *copterBus(copter_t *c, int b);
+
+/*!
+ \brief Get the counters of the scheduler of one bus (deadlines, waits, utilization per tick)
+
+ A tick is one period of the control thread (one PPM frame with rate 0).
+
+ \param c the device handle
+ \param b the index of the bus
+ \param stats the current values
+*/
+void copterBusSchedule(copter_t *c, int b, busScheduleStats_t *stats);
+
+/*!
+ \brief Stop the threads, close the buses and free the handle
+
+ \param c the device handle
+*/
+void copterClose(copter_t *c);
+
+#endif // COPTER_H
@@ -0,0 +1,92 @@
+/**
+    @file src-master/eventloop.c
+    @brief epoll based event loop of the master
+    @author Jan Sommer
+*/
+
+#include <unistd.h>
+#include <errno.h>
+#include <sys/epoll.h>
+#include "eventloop.h"
+
+int eventLoopInit(eventLoop_t *loop)
+{
+    int i;
+
+    for (i = 0; i < EVENTLOOP_MAX; i++)
+        loop->source[i].fd = -1;
+    loop->running = 0;
+    loop->epollFd = epoll_create1(EPOLL_CLOEXEC);
+    return loop->epollFd == -1 ? -1 : 0;
+}
+
+int eventLoopAdd(eventLoop_t *loop, int fd, eventHandler_t handler, void *arg)
+{
+    struct epoll_event ev;
+    int i;
+
+    for (i = 0; i < EVENTLOOP_MAX; i++)
+        if (loop->source[i].fd == -1)
+            break;
+    if (i == EVENTLOOP_MAX)
+        return -1;
+
+    ev.events = EPOLLIN;
+    ev.data.ptr = &loop->source[i];
+    if (epoll_ctl(loop->epollFd, EPOLL_CTL_ADD, fd, &ev) != 0)
+        return -1;
+    loop->source[i].fd = fd;
+    loop->source[i].handler = handler;
+    loop->source[i].arg = arg;
+    return 0;
+}
+
+void eventLoopRemove(eventLoop_t *loop, int fd)
+{
+    int i;
+
+    for (i = 0; i < EVENTLOOP_MAX; i++)
+    {
+        if (loop->source[i].fd == fd)
+        {
+            epoll_ctl(loop->epollFd, EPOLL_CTL_DEL, fd, NULL);
+            loop->source[i].fd = -1;
+        }
+    }
+}
+
+int eventLoopRun(eventLoop_t *loop)
+{
+    struct epoll_event ev[EVENTLOOP_MAX];
+    eventSource_t *source;
+    int i, n;
+
+    loop->running = 1;
+    while (loop->running)
+    {
+        n = epoll_wait(loop->epollFd, ev, EVENTLOOP_MAX, -1);
+        if (n < 0)
+        {
+            if (errno == EINTR)
+                continue;
+            return -1;
+        }
+        for (i = 0; i < n && loop->running; i++)
+        {
+            source = ev[i].data.ptr;
+            if (source->fd != -1)   // may have been removed by a previous handler
+                source->handler(source->fd, source->arg);
+        }
+    }
+    return 0;
+}
+
+void eventLoopStop(eventLoop_t *loop)
+{
+    loop->running = 0;
+}
+
+void eventLoopClose(eventLoop_t *loop)
+{
+    close(loop->epollFd);
+}
@@ -0,0 +1,93 @@
+/**
+    @file src-master/eventloop.h
+    @brief epoll based event loop of the master
+    @author Jan Sommer
+
+    All file descriptors of the UI thread (stdin, timers, signals, sockets) are
+    registered with a handler. eventLoopRun() waits for all of them at once and
+    calls the handler of every descriptor which became readable.
+*/
+
+#ifndef EVENTLOOP_H
+#define EVENTLOOP_H
+
+#define EVENTLOOP_MAX   16      ///< Maximum number of file descriptors in one event loop
+
+/*!
+ \brief Handler which is called when a file descriptor is readable
+
+ \param fd the readable file descriptor
+ \param arg the argument given to eventLoopAdd()
+*/
+typedef void (*eventHandler_t)(int fd, void *arg);
+
+/**
+    @brief registered file descriptor
+*/
+typedef struct
+{
+    int fd;                     ///< file descriptor, -1 if the entry is unused
+    eventHandler_t handler;     ///< handler for the file descriptor
+    void *arg;                  ///< argument for the handler
+} eventSource_t;
+
+/**
+    @brief epoll instance and its registered file descriptors
+*/
+typedef struct
+{
+    int epollFd;                            ///< the epoll instance
+    volatile int running;                   ///< eventLoopRun() returns when this is 0
+    eventSource_t source[EVENTLOOP_MAX];    ///< the registered file descriptors
+} eventLoop_t;
+
+/*!
+ \brief Create the epoll instance
+
+ \param loop the event loop
+ \return int 0 if successful otherwise -1
+*/
+int eventLoopInit(eventLoop_t *loop);
+
+/*!
+ \brief Register a file descriptor
+
+ \param loop the event loop
+ \param fd the file descriptor
+ \param handler called whenever @a fd is readable
+ \param arg argument for the handler
+ \return int 0 if successful otherwise -1
+*/
+int eventLoopAdd(eventLoop_t *loop, int fd, eventHandler_t handler, void *arg);
+
+/*!
+ \brief Remove a file descriptor (the descriptor is not closed)
+
+ \param loop the event loop
+ \param fd the file descriptor
+*/
+void eventLoopRemove(eventLoop_t *loop, int fd);
+
+/*!
+ \brief Dispatch events until eventLoopStop() is called
+
+ \param loop the event loop
+ \return int 0 if stopped by eventLoopStop() otherwise -1
+*/
+int eventLoopRun(eventLoop_t *loop);
+
+/*!
+ \brief Let eventLoopRun() return after the current handler
+
+ \param loop the event loop
+*/
+void eventLoopStop(eventLoop_t *loop);
+
+/*!
+ \brief Close the epoll instance
+
+ \param loop the event loop
+*/
+void eventLoopClose(eventLoop_t *loop);
+
+#endif // EVENTLOOP_H
@@ -0,0 +1,279 @@
+/**
+    @file src-master/gamepad.c
+    @brief reads the sticks of a gamepad or joystick through evdev (/dev/input/event*)
+    @author Jan Sommer
+*/
+
+#define _GNU_SOURCE     // pipe2()
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <errno.h>
+#include <time.h>
+#include <pthread.h>
+#include <sys/ioctl.h>
+#include <sys/stat.h>
+#include <linux/input.h>
+#include "gamepad.h"
+#include "realtime.h"
+
+#define GAMEPAD_AXES    4           ///< throttle, roll, pitch, yaw
+#define REPLAY_SLICE    100000000L  ///< Longest sleep of the replay in ns (it notices gamepadClose() within this time)
+
+static const int axisCode[GAMEPAD_AXES] = {ABS_Y, ABS_RX, ABS_RY, ABS_X};   ///< evdev axis of throttle, roll, pitch, yaw
+
+/**
+    @brief state of a gamepad
+*/
+struct gamepad
+{
+    int fd;                                 ///< the device or the read end of the pipe of the replay
+    int replayFd;                           ///< the recording, -1 for a device
+    int pipeFd;                             ///< write end of the pipe of the replay
+    pthread_t replay;                       ///< thread which replays the recording
+    volatile int running;                   ///< the replay runs until this is 0
+    struct input_absinfo range[GAMEPAD_AXES]; ///< limits and dead zone of each axis
+    int value[GAMEPAD_AXES];                ///< raw values of the axes of the current report
+    int reported[GAMEPAD_AXES];             ///< raw values of the axes at the last SYN_REPORT
+    int dropping;                           ///< 1 after SYN_DROPPED until the next SYN_REPORT
+    gamepadStats_t stats;                   ///< @sa gamepadStats
+};
+
+/*!
+ \brief Time of an event in ns
+*/
+static long long eventTime(const struct input_event *ev)
+{
+    return ev->input_event_sec * 1000000000LL + ev->input_event_usec * 1000LL;
+}
+
+/*!
+ \brief Read the limits and the current values of the axes from the device
+*/
+static void gamepadSync(gamepad_t *g)
+{
+    int i;
+
+    for (i = 0; i < GAMEPAD_AXES; i++)
+        if (ioctl(g->fd, EVIOCGABS(axisCode[i]), &g->range[i]) == 0)
+            g->value[i] = g->range[i].value;
+}
+
+/*!
+ \brief Scale the reported raw value of an axis to the range of the mixer
+
+ The throttle goes from 0 (stick down) to MIXER_ONE, the other axes from -MIXER_ONE to
+ MIXER_ONE with 0 in the dead zone around the center.
+*/
+static int gamepadScale(const gamepad_t *g, int axis)
+{
+    const struct input_absinfo *r = &g->range[axis];
+    int half = (r->maximum - r->minimum) / 2;
+    int v = g->reported[axis] - (r->minimum + r->maximum) / 2;
+
+    if (half <= r->flat)
+        return 0;       // the device has no such axis
+    if (axis == 0)
+        v = (long long)(half - v) * MIXER_ONE / (2 * half);
+    else if (v > r->flat || v < -r->flat)
+        v = (long long)(v > 0 ? v - r->flat : v + r->flat) * MIXER_ONE / (half - r->flat);
+    else
+        v = 0;
+    if (axis == 2)
+        v = -v;         // stick forward (negative values) is positive pitch
+    if (v > MIXER_ONE)
+        return MIXER_ONE;
+    if (v < (axis == 0 ? 0 : -MIXER_ONE))
+        return axis == 0 ? 0 : -MIXER_ONE;
+    return v;
+}
+
+/*!
+ \brief Thread which writes the events of the recording into the pipe at their recorded times
+
+ The events are stamped with the time when they are written like the kernel stamps the
+ events of a device. The end of the recording closes the pipe.
+
+ \param arg the gamepad
+ \return void* NULL
+*/
+static void *gamepadReplay(void *arg)
+{
+    gamepad_t *g = arg;
+    struct input_event ev;
+    struct timespec slice;
+    long long first = -1, start = nowNs(), due, now;
+
+    while (g->running && read(g->replayFd, &ev, sizeof(ev)) == sizeof(ev))
+    {
+        if (first < 0)
+            first = eventTime(&ev);
+        due = start + eventTime(&ev) - first;
+        while (g->running && (now = nowNs()) < due)
+        {
+            slice.tv_sec = 0;
+            slice.tv_nsec = due - now < REPLAY_SLICE ? due - now : REPLAY_SLICE;
+            nanosleep(&slice, NULL);
+        }
+        now = nowNs();
+        ev.input_event_sec = now / 1000000000LL;
+        ev.input_event_usec = now % 1000000000LL / 1000;
+        if (write(g->pipeFd, &ev, sizeof(ev)) != sizeof(ev))
+            break;      // gamepadClose() closed the read end
+    }
+    close(g->pipeFd);
+    return NULL;
+}
+
+/*!
+ \brief Start the replay of the recording g->replayFd
+*/
+static int gamepadReplayStart(gamepad_t *g)
+{
+    int fds[2], i;
+
+    if (pipe2(fds, O_CLOEXEC) != 0)
+        return -1;
+    if (fcntl(fds[0], F_SETFL, O_NONBLOCK) != 0)
+    {
+        close(fds[0]);
+        close(fds[1]);
+        return -1;
+    }
+    g->fd = fds[0];
+    g->pipeFd = fds[1];
+    for (i = 0; i < GAMEPAD_AXES; i++)
+    {
+        g->range[i].minimum = -32768;
+        g->range[i].maximum = 32767;
+    }
+    g->value[0] = 32767;    // throttle down until the first event of the axis
+    g->running = 1;
+    if (threadCreate(&g->replay, NULL, gamepadReplay, g) != 0)
+    {
+        g->running = 0;
+        close(g->pipeFd);
+        return -1;
+    }
+    return 0;
+}
+
+gamepad_t *gamepadOpen(const char *path)
+{
+    int clock = CLOCK_MONOTONIC;
+    struct stat st;
+    gamepad_t *g;
+    int fd;
+
+    fd = open(path, O_RDONLY | O_NONBLOCK | O_CLOEXEC);
+    if (fd == -1)
+        return NULL;
+    g = calloc(1, sizeof(gamepad_t));
+    if (g == NULL)
+    {
+        close(fd);
+        return NULL;
+    }
+    g->replayFd = -1;
+    if (fstat(fd, &st) == 0 && S_ISREG(st.st_mode))
+    {
+        g->replayFd = fd;
+        if (fcntl(fd, F_SETFL, 0) != 0 || gamepadReplayStart(g) != 0)
+        {
+            gamepadClose(g);
+            return NULL;
+        }
+        return g;
+    }
+
+    // a device: the timestamps of the events are compared with CLOCK_MONOTONIC
+    g->fd = fd;
+    if (ioctl(fd, EVIOCSCLOCKID, &clock) != 0)
+    {
+        gamepadClose(g);
+        return NULL;
+    }
+    gamepadSync(g);
+    return g;
+}
+
+int gamepadFd(gamepad_t *g)
+{
+    return g->fd;
+}
+
+int gamepadRead(gamepad_t *g, mixerInput_t *stick, long long *time)
+{
+    struct input_event ev[64];
+    ssize_t n;
+    int i, k, report = 0;
+
+    for (;;)
+    {
+        n = read(g->fd, ev, sizeof(ev));
+        if (n == -1 && (errno == EAGAIN || errno == EINTR))
+            break;
+        if (n <= 0)
+        {
+            if (report)
+                break;              // the error is reported by the next call
+            if (n == 0)
+                errno = ENODEV;     // the replay ended
+            return -1;
+        }
+        for (i = 0; i < n / (ssize_t)sizeof(ev[0]); i++)
+        {
+            g->stats.events++;
+            if (ev[i].type == EV_ABS && !g->dropping)
+            {
+                for (k = 0; k < GAMEPAD_AXES; k++)
+                    if (ev[i].code == axisCode[k])
+                        g->value[k] = ev[i].value;
+            }
+            else if (ev[i].type == EV_SYN && ev[i].code == SYN_DROPPED)
+            {
+                g->dropping = 1;
+                g->stats.dropped++;
+            }
+            else if (ev[i].type == EV_SYN && ev[i].code == SYN_REPORT)
+            {
+                if (g->dropping && g->replayFd == -1)
+                    gamepadSync(g);     // the events since the overflow are incomplete
+                g->dropping = 0;
+                memcpy(g->reported, g->value, sizeof(g->reported));    // later events belong to the next report
+                g->stats.reports++;
+                *time = eventTime(&ev[i]);
+                report = 1;
+            }
+        }
+    }
+    if (report)
+    {
+        stick->throttle = gamepadScale(g, 0);
+        stick->roll     = gamepadScale(g, 1);
+        stick->pitch    = gamepadScale(g, 2);
+        stick->yaw      = gamepadScale(g, 3);
+    }
+    return report;
+}
+
+void gamepadStats(gamepad_t *g, gamepadStats_t *stats)
+{
+    *stats = g->stats;
+}
+
+void gamepadClose(gamepad_t *g)
+{
+    if (g->running)
+    {
+        g->running = 0;
+        close(g->fd);       // a blocked write of the replay fails
+        pthread_join(g->replay, NULL);
+    }
+    else if (g->fd > 0)
+        close(g->fd);
+    if (g->replayFd != -1)
+        close(g->replayFd);
+    free(g);
+}
@@ -0,0 +1,80 @@
+/**
+    @file src-master/gamepad.h
+    @brief reads the sticks of a gamepad or joystick through evdev (/dev/input/event*)
+    @author Jan Sommer
+
+    The device is read without blocking: the descriptor is registered in the event loop of
+    the caller @sa eventloop.h and gamepadRead() drains all pending events. The axes are
+    only collected until the next SYN_REPORT, so a caller always gets the latest complete
+    state of all axes and never acts on half of a report. After SYN_DROPPED (the kernel
+    buffer overflowed) the state is read again from the device.
+
+    Sticks (mode 2): left stick up/down is the throttle, left stick left/right the yaw,
+    the right stick roll and pitch (forward is positive pitch). The axes are scaled with
+    the limits and the dead zone (flat) which the device reports.
+
+    A regular file is replayed as a stand-in device: it contains struct input_event records
+    as they are read from a device (e.g. "cat /dev/input/event0 > sticks.ev"). A thread
+    writes them into a pipe at their recorded times, so the replay is read exactly like a
+    device. The axes of a replay have the range -32768..32767 without a dead zone.
+*/
+
+#ifndef GAMEPAD_H
+#define GAMEPAD_H
+
+#include "mixer.h"
+
+typedef struct gamepad gamepad_t;
+
+/**
+    @brief counters of the events
+*/
+typedef struct
+{
+    unsigned long events;       ///< events read
+    unsigned long reports;      ///< complete reports (SYN_REPORT)
+    unsigned long dropped;      ///< overflows of the kernel buffer (SYN_DROPPED)
+} gamepadStats_t;
+
+/*!
+ \brief Open a device or start the replay of a recorded event stream
+
+ \param path the device (/dev/input/eventN) or the recording
+ \return gamepad_t* the gamepad or NULL on error (errno is set)
+*/
+gamepad_t *gamepadOpen(const char *path);
+
+/*!
+ \brief The descriptor to wait for (readable when events are pending)
+
+ \param g the gamepad
+ \return int the file descriptor
+*/
+int gamepadFd(gamepad_t *g);
+
+/*!
+ \brief Read all pending events without blocking
+
+ \param g the gamepad
+ \param stick the latest complete state of the sticks (only changed if 1 is returned)
+ \param time CLOCK_MONOTONIC in ns of the last report (the timestamp of the kernel)
+ \return int 1 if a new report arrived, 0 if not, -1 if the device is gone or the replay ended
+*/
+int gamepadRead(gamepad_t *g, mixerInput_t *stick, long long *time);
+
+/*!
+ \brief Get the counters
+
+ \param g the gamepad
+ \param stats the current values
+*/
+void gamepadStats(gamepad_t *g, gamepadStats_t *stats);
+
+/*!
+ \brief Close the device (stops a replay) and free the gamepad
+
+ \param g the gamepad
+*/
+void gamepadClose(gamepad_t *g);
+
+#endif // GAMEPAD_H
@@ -0,0 +1,98 @@
+/**
+    @file src-master/histogram.c
+    @brief allocation-free log-bucketed latency histogram
+    @author Jan Sommer
+
+    The first 2*HISTOGRAM_SUB values have a bucket of their own. Above, the bucket
+    is given by the position of the most significant bit and the next
+    HISTOGRAM_SUB_BITS bits of the value.
+*/
+
+#include "histogram.h"
+
+/*!
+ \brief Index of the bucket of a value
+*/
+static int bucketIndex(unsigned long v)
+{
+    int shift;
+
+    if (v < 2 * HISTOGRAM_SUB)
+        return v;
+    shift = (63 - __builtin_clzl(v)) - HISTOGRAM_SUB_BITS;
+    return (shift + 1) * HISTOGRAM_SUB + (int)((v >> shift) - HISTOGRAM_SUB);
+}
+
+/*!
+ \brief Largest value of a bucket
+*/
+static long bucketUpper(int index)
+{
+    int shift;
+
+    if (index < 2 * HISTOGRAM_SUB)
+        return index;
+    shift = index / HISTOGRAM_SUB - 1;
+    return ((long)(HISTOGRAM_SUB + index % HISTOGRAM_SUB + 1) << shift) - 1;
+}
+
+void histogramRecord(histogram_t *h, long ns)
+{
+    long max = atomic_load_explicit(&h->max, memory_order_relaxed);
+
+    if (ns < 0)
+        ns = 0;
+    atomic_fetch_add_explicit(&h->count[bucketIndex(ns)], 1, memory_order_relaxed);
+    atomic_fetch_add_explicit(&h->samples, 1, memory_order_relaxed);
+    while (ns > max &&
+           !atomic_compare_exchange_weak_explicit(&h->max, &max, ns, memory_order_relaxed, memory_order_relaxed))
+        ;
+}
+
+void histogramMerge(histogram_t *dst, histogram_t *src)
+{
+    long max = atomic_load_explicit(&src->max, memory_order_relaxed);
+    int i;
+
+    for (i = 0; i < HISTOGRAM_BUCKETS; i++)
+        atomic_fetch_add_explicit(&dst->count[i], atomic_load_explicit(&src->count[i], memory_order_relaxed),
+                                  memory_order_relaxed);
+    atomic_fetch_add_explicit(&dst->samples, atomic_load_explicit(&src->samples, memory_order_relaxed),
+                              memory_order_relaxed);
+    if (max > atomic_load_explicit(&dst->max, memory_order_relaxed))
+        atomic_store_explicit(&dst->max, max, memory_order_relaxed);
+}
+
+long histogramPercentile(histogram_t *h, double q)
+{
+    unsigned long total = 0, rank, sum = 0;
+    long max = atomic_load_explicit(&h->max, memory_order_relaxed);
+    int i;
+
+    // sum the buckets instead of using samples, a concurrent recorder may be in between
+    for (i = 0; i < HISTOGRAM_BUCKETS; i++)
+        total += atomic_load_explicit(&h->count[i], memory_order_relaxed);
+    if (total == 0)
+        return 0;
+    rank = q * total;
+    if (rank >= total)
+        rank = total - 1;
+
+    for (i = 0; i < HISTOGRAM_BUCKETS; i++)
+    {
+        sum += atomic_load_explicit(&h->count[i], memory_order_relaxed);
+        if (sum > rank)
+            break;
+    }
+    return bucketUpper(i) < max ? bucketUpper(i) : max;
+}
+
+void histogramLatency(histogram_t *h, latency_t *result)
+{
+    result->p50      = histogramPercentile(h, 0.5);
+    result->p99      = histogramPercentile(h, 0.99);
+    result->p999     = histogramPercentile(h, 0.999);
+    result->max      = atomic_load_explicit(&h->max, memory_order_relaxed);
+    result->samples  = atomic_load_explicit(&h->samples, memory_order_relaxed);
+    result->overruns = 0;
+}
@@ -0,0 +1,65 @@
+/**
+    @file src-master/histogram.h
+    @brief allocation-free log-bucketed latency histogram
+    @author Jan Sommer
+
+    The range of every power of two is divided into HISTOGRAM_SUB buckets, so every
+    value is recorded with a relative error below 1/HISTOGRAM_SUB (12.5 %). The counters
+    are atomic: several threads may record into one histogram while another thread
+    evaluates it. Recording never allocates, locks or blocks.
+*/
+
+#ifndef HISTOGRAM_H
+#define HISTOGRAM_H
+
+#include <stdatomic.h>
+#include "realtime.h"
+
+#define HISTOGRAM_SUB_BITS  3                               ///< log2 of the buckets per power of two
+#define HISTOGRAM_SUB       (1 << HISTOGRAM_SUB_BITS)       ///< buckets per power of two
+#define HISTOGRAM_BUCKETS   (64 * HISTOGRAM_SUB)            ///< buckets for all values of a long
+
+/**
+    @brief histogram of latencies in ns
+*/
+typedef struct
+{
+    atomic_ulong count[HISTOGRAM_BUCKETS];  ///< number of values in each bucket
+    atomic_ulong samples;                   ///< number of recorded values
+    atomic_long max;                        ///< largest recorded value
+} histogram_t;
+
+/*!
+ \brief Record a value
+
+ \param h the histogram
+ \param ns the latency in ns
+*/
+void histogramRecord(histogram_t *h, long ns);
+
+/*!
+ \brief Add all values of a histogram to another one
+
+ \param dst the histogram which gets the values
+ \param src the recorded values
+*/
+void histogramMerge(histogram_t *dst, histogram_t *src);
+
+/*!
+ \brief Get a percentile of the recorded values
+
+ \param h the histogram
+ \param q the percentile (0..1), e.g. 0.999
+ \return long the upper bound of the bucket which contains the percentile (at most the maximum)
+*/
+long histogramPercentile(histogram_t *h, double q);
+
+/*!
+ \brief Summarize the recorded values (p50, p99, p99.9, max and the number of samples)
+
+ \param h the histogram
+ \param result the summary (overruns is 0)
+*/
+void histogramLatency(histogram_t *h, latency_t *result);
+
+#endif // HISTOGRAM_H
@@ -0,0 +1,147 @@
+/**
+    @file src-master/imu.c
+    @brief reads an MPU-6050 compatible IMU on a bus of the slaves
+    @author Jan Sommer
+*/
+
+#include <stdlib.h>
+#include <unistd.h>
+#include <errno.h>
+#include "imu.h"
+#include "mailbox.h"
+#include "realtime.h"
+
+/**
+    @brief state of a reader
+*/
+struct imu
+{
+    copter_t *copter;                       ///< owns the bus
+    int bus;                                ///< index of the bus
+    long period;                            ///< time between two reads in ns
+    mailbox_t *samples;                     ///< imuSample_t of every read
+    pthread_t thread;                       ///< the reader thread
+    volatile int running;                   ///< the thread runs until this is 0
+    int timerFd;                            ///< periodic timer of the reads
+    unsigned long failed;                   ///< @sa imuStats_t::failed
+    unsigned long overruns;                 ///< @sa imuStats_t::overruns
+};
+
+/*!
+ \brief Convert the 16 bit big endian value at @a data
+*/
+static int imuValue(const uint8_t *data)
+{
+    return (int16_t)((data[0] << 8) | data[1]);
+}
+
+/*!
+ \brief Thread of the reader: one burst read per expiration of the timer
+
+ The deadline of a read is the time when the next sample is due.
+
+ \param arg the reader
+ \return void* NULL
+*/
+static void *imuThread(void *arg)
+{
+    imu_t *i = arg;
+    uint8_t data[IMU_DATA_LENGTH];
+    imuSample_t *s;
+    uint64_t expirations;
+    long long now;
+    int axis;
+
+    while (i->running)
+    {
+        if (read(i->timerFd, &expirations, sizeof(expirations)) != sizeof(expirations))
+            continue;
+        i->overruns += expirations - 1;
+        now = nowNs();
+        busSetClass(BUS_IMU, now + i->period);
+        if (copterBusRead(i->copter, i->bus, IMU_ADDR, IMU_DATA, data, IMU_DATA_LENGTH) != 0)
+        {
+            i->failed++;
+            continue;
+        }
+
+        s = mailboxBack(i->samples);
+        s->time = nowNs();
+        for (axis = 0; axis < 3; axis++)
+        {
+            s->accel[axis] = imuValue(&data[2 * axis]) * 1000 / IMU_ACCEL_LSB;
+            s->rate[axis] = imuValue(&data[8 + 2 * axis]) * 1000 / IMU_GYRO_LSB;
+        }
+        s->temperature = imuValue(&data[6]) * 100 / 340 + 3653;    // from the register map of the MPU-6050
+        mailboxPublish(i->samples);
+    }
+    return NULL;
+}
+
+imu_t *imuOpen(copter_t *c, int bus, int rate)
+{
+    uint8_t wake[2] = {IMU_PWR_MGMT_1, 0};
+    uint8_t id;
+    imu_t *i;
+
+    if (rate < 1 || rate > IMU_MAX_RATE)
+    {
+        errno = EINVAL;
+        return NULL;
+    }
+    if (copterBusRead(c, bus, IMU_ADDR, IMU_WHO_AM_I, &id, 1) != 0)
+        return NULL;
+    if (id != IMU_ID)
+    {
+        errno = ENODEV;
+        return NULL;
+    }
+    if (copterBusWrite(c, bus, IMU_ADDR, wake, 2) != 0)
+        return NULL;
+
+    i = calloc(1, sizeof(imu_t));
+    if (i == NULL)
+        return NULL;
+    i->copter = c;
+    i->bus = bus;
+    i->period = 1000000000L / rate;
+    i->samples = mailboxCreate(sizeof(imuSample_t));
+    if (i->samples == NULL)
+    {
+        free(i);
+        return NULL;
+    }
+    i->timerFd = periodicTimer(i->period);
+    i->running = 1;
+    if (i->timerFd == -1 || threadCreate(&i->thread, NULL, imuThread, i) != 0)
+    {
+        if (i->timerFd != -1)
+            close(i->timerFd);
+        mailboxFree(i->samples);
+        free(i);
+        return NULL;
+    }
+    return i;
+}
+
+void imuSample(imu_t *i, imuSample_t *sample)
+{
+    mailboxFetch(i->samples);
+    *sample = *(const imuSample_t *)mailboxFront(i->samples);
+}
+
+void imuStats(imu_t *i, imuStats_t *stats)
+{
+    stats->samples  = i->samples->published;
+    stats->failed   = i->failed;
+    stats->overruns = i->overruns;
+}
+
+void imuClose(imu_t *i)
+{
+    i->running = 0;
+    pthread_join(i->thread, NULL);     // wakes up with the next read
+    close(i->timerFd);
+    mailboxFree(i->samples);
+    free(i);
+}
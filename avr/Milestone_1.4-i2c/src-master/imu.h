@@ -0,0 +1,88 @@
+/**
+    @file src-master/imu.h
+    @brief reads an MPU-6050 compatible IMU on a bus of the slaves
+    @author Jan Sommer
+
+    A thread reads the accelerometer, the temperature and the gyroscope in one burst of
+    IMU_DATA_LENGTH bytes with IMU_RATE Hz. The reads have the class BUS_IMU: they get the
+    bus after the motor writes and before the telemetry, and every read should be finished
+    before the next sample is due @sa scheduler.h
+    The newest sample is kept in a mailbox, a reader always gets the newest one.
+
+    The emulator (-d emu) has such an IMU on IMU_ADDR which reports a synthetic motion.
+*/
+
+#ifndef IMU_H
+#define IMU_H
+
+#include "copter.h"
+
+#define IMU_ADDR            0x68    ///< 7 bit address of the IMU (AD0 low)
+#define IMU_WHO_AM_I        0x75    ///< Register: identity of the device
+#define IMU_ID              0x68    ///< Value of IMU_WHO_AM_I
+#define IMU_PWR_MGMT_1      0x6B    ///< Register: power management
+#define IMU_SLEEP           0x40    ///< Bit of IMU_PWR_MGMT_1: sleep mode (set after reset)
+#define IMU_DATA            0x3B    ///< Register: first byte of the measurements (ACCEL_XOUT_H)
+#define IMU_DATA_LENGTH     14      ///< accelerometer, temperature and gyroscope, 16 bit big endian each
+#define IMU_ACCEL_LSB       16384   ///< LSB per g (range +-2 g)
+#define IMU_GYRO_LSB        131     ///< LSB per deg/s (range +-250 deg/s)
+#define IMU_RATE            1000    ///< Default rate of the reads in Hz
+#define IMU_MAX_RATE        8000    ///< Highest rate in Hz (gyroscope output rate)
+
+typedef struct imu imu_t;
+
+/**
+    @brief one sample of the IMU
+*/
+typedef struct
+{
+    long long time;         ///< time of the read in ns (CLOCK_MONOTONIC), 0 == no sample yet
+    int accel[3];           ///< acceleration x, y, z in mg
+    int rate[3];            ///< angular rate x, y, z in mdeg/s
+    int temperature;        ///< temperature in 1/100 deg C
+} imuSample_t;
+
+/**
+    @brief counters of the reads
+*/
+typedef struct
+{
+    unsigned long samples;  ///< successful reads
+    unsigned long failed;   ///< failed reads
+    unsigned long overruns; ///< samples which were not read because a read took too long
+} imuStats_t;
+
+/*!
+ \brief Wake up the IMU and start reading it
+
+ \param c the device handle
+ \param bus the index of the bus of the IMU
+ \param rate the rate of the reads in Hz (1..IMU_MAX_RATE)
+ \return imu_t* the reader or NULL on error (errno is set, ENODEV if there is no IMU)
+*/
+imu_t *imuOpen(copter_t *c, int bus, int rate);
+
+/*!
+ \brief Get the newest sample (only from one thread)
+
+ \param i the reader
+ \param sample the newest sample
+*/
+void imuSample(imu_t *i, imuSample_t *sample);
+
+/*!
+ \brief Get the counters (from any thread)
+
+ \param i the reader
+ \param stats the current values
+*/
+void imuStats(imu_t *i, imuStats_t *stats);
+
+/*!
+ \brief Stop reading and free the reader
+
+ \param i the reader
+*/
+void imuClose(imu_t *i);
+
+#endif // IMU_H
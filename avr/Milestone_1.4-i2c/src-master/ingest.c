@@ -0,0 +1,138 @@
+/**
+    @file src-master/ingest.c
+    @brief shared memory through which other processes hand setpoints over to the master
+    @author Jan Sommer
+
+    Layout of the segment: the header, then the mailbox of each source. Every part
+    starts at a cache line, so the clients of different sources never share a line.
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <errno.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include "ingest.h"
+
+#define INGEST_LINE     64      ///< Size of a cache line, every part of the segment starts at a line
+
+/*!
+ \brief Round up to the next cache line
+*/
+static size_t lineUp(size_t bytes)
+{
+    return (bytes + INGEST_LINE - 1) & ~(size_t)(INGEST_LINE - 1);
+}
+
+/*!
+ \brief Map the segment with the file descriptor @a fd
+*/
+static ingest_t *ingestMap(const char *name, int fd, size_t bytes)
+{
+    ingest_t *in = calloc(1, sizeof(ingest_t));
+
+    if (in == NULL)
+        return NULL;
+    in->shm = mmap(NULL, bytes, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    if (in->shm == MAP_FAILED)
+    {
+        free(in);
+        return NULL;
+    }
+    in->bytes = bytes;
+    snprintf(in->name, sizeof(in->name), "/%s", name);
+    return in;
+}
+
+ingest_t *ingestCreate(const char *name, int numSlaves)
+{
+    size_t mailbox = lineUp(mailboxBytes(sizeof(ingestSetpoints_t)));
+    size_t bytes = lineUp(sizeof(ingestHeader_t)) + INGEST_SOURCES * mailbox;
+    char path[64];
+    ingest_t *in;
+    int fd, i;
+
+    snprintf(path, sizeof(path), "/%s", name);
+    shm_unlink(path);   // a segment left over by a crashed server
+    fd = shm_open(path, O_RDWR | O_CREAT | O_EXCL | O_CLOEXEC, 0660);
+    if (fd == -1)
+        return NULL;
+    if (ftruncate(fd, bytes) != 0)
+    {
+        close(fd);
+        shm_unlink(path);
+        return NULL;
+    }
+    in = ingestMap(name, fd, bytes);
+    close(fd);
+    if (in == NULL)
+    {
+        shm_unlink(path);
+        return NULL;
+    }
+    in->owner = 1;
+
+    in->shm->numSlaves = numSlaves;
+    in->shm->mailboxBytes = mailbox;
+    for (i = 0; i < INGEST_SOURCES; i++)
+        mailboxInitAt(ingestMailbox(in, i), sizeof(ingestSetpoints_t));
+    atomic_store_explicit(&in->shm->magic, INGEST_MAGIC, memory_order_release);
+    return in;
+}
+
+ingest_t *ingestOpen(const char *name)
+{
+    char path[64];
+    struct stat st;
+    ingest_t *in;
+    int fd;
+
+    snprintf(path, sizeof(path), "/%s", name);
+    fd = shm_open(path, O_RDWR | O_CLOEXEC, 0);
+    if (fd == -1)
+        return NULL;
+    if (fstat(fd, &st) != 0 || st.st_size < (off_t)sizeof(ingestHeader_t))
+    {
+        close(fd);
+        errno = EAGAIN;     // the server did not finish the segment yet
+        return NULL;
+    }
+    in = ingestMap(name, fd, st.st_size);
+    close(fd);
+    if (in == NULL)
+        return NULL;
+    if (atomic_load_explicit(&in->shm->magic, memory_order_acquire) != INGEST_MAGIC ||
+        lineUp(sizeof(ingestHeader_t)) + INGEST_SOURCES * in->shm->mailboxBytes > in->bytes)
+    {
+        ingestClose(in);
+        errno = EAGAIN;
+        return NULL;
+    }
+    return in;
+}
+
+mailbox_t *ingestMailbox(ingest_t *in, int source)
+{
+    return (mailbox_t *)((char *)in->shm + lineUp(sizeof(ingestHeader_t)) + source * in->shm->mailboxBytes);
+}
+
+ingestSetpoints_t *ingestBack(ingest_t *in, int source)
+{
+    return mailboxBack(ingestMailbox(in, source));
+}
+
+void ingestPublish(ingest_t *in, int source)
+{
+    mailboxPublish(ingestMailbox(in, source));
+}
+
+void ingestClose(ingest_t *in)
+{
+    if (in->owner)
+        shm_unlink(in->name);
+    munmap(in->shm, in->bytes);
+    free(in);
+}
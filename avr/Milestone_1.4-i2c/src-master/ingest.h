@@ -0,0 +1,134 @@
+/**
+    @file src-master/ingest.h
+    @brief shared memory through which other processes hand setpoints over to the master
+    @author Jan Sommer
+
+    In server mode (-D) the master owns the buses and creates a shared memory segment
+    (/dev/shm/<name>) with one mailbox per source. A co-located client (e.g. the flight
+    controller) writes its setpoints directly into the back buffer of its mailbox and
+    publishes them with one atomic exchange: no copy between the processes and no
+    system call on the hot path. The server polls the mailboxes @sa server.h
+
+    The sources have fixed priorities, an active source overrides all sources with a
+    lower priority. Only one process may write the mailbox of a source.
+
+    A client must publish at least every SERVER_SOURCE_TIMEOUT ms, also when its
+    setpoints do not change: a silent mailbox counts as a crashed client and its source
+    is released (the motors get the safe setpoints if no other source is active).
+
+    Typical use by a client:
+    @code
+    ingest_t *in = ingestOpen(INGEST_NAME);
+    ingestSetpoints_t *sp;
+    for (;;)    // e.g. in the control loop of the client, well within SERVER_SOURCE_TIMEOUT
+    {
+        sp = ingestBack(in, INGEST_PILOT);
+        sp->active = 1;
+        sp->value[0][0] = 4096;
+        ingestPublish(in, INGEST_PILOT);
+        usleep(10000);
+    }
+    @endcode
+*/
+
+#ifndef INGEST_H
+#define INGEST_H
+
+#include <stddef.h>
+#include "mailbox.h"
+#include "copter.h"
+
+#define INGEST_NAME     "copter"    ///< Default name of the segment and the socket
+#define INGEST_MAGIC    0x43505431  ///< Marks an initialized segment ("CPT1")
+
+/**
+    @brief sources of setpoints in ascending priority
+*/
+enum
+{
+    INGEST_PILOT,       ///< the pilot (flight controller or a tool)
+    INGEST_FAILSAFE,    ///< the failsafe, overrides the pilot while it is active
+    INGEST_SOURCES      ///< number of sources
+};
+
+/**
+    @brief setpoints of one source
+*/
+typedef struct
+{
+    int active;                             ///< 1: the setpoints are valid and override lower priorities, 0: released
+    int value[COPTER_MAX_SLAVES][4];        ///< duty cycles of the 4 channels of each slave
+} ingestSetpoints_t;
+
+/**
+    @brief header of the shared memory segment, followed by the mailbox of each source
+*/
+typedef struct
+{
+    atomic_uint magic;      ///< INGEST_MAGIC when the segment is initialized (written last)
+    int numSlaves;          ///< number of slaves of the server
+    size_t mailboxBytes;    ///< size of one mailbox @sa mailboxBytes
+} ingestHeader_t;
+
+/**
+    @brief a mapping of the segment
+*/
+typedef struct
+{
+    ingestHeader_t *shm;    ///< the mapped segment
+    size_t bytes;           ///< size of the segment
+    char name[64];          ///< name of the segment
+    int owner;              ///< 1 in the server (removes the segment on close)
+} ingest_t;
+
+/*!
+ \brief Create the segment (server side)
+
+ \param name the name of the segment (without '/')
+ \param numSlaves the number of slaves of the server
+ \return ingest_t* the segment or NULL on error (errno is set)
+*/
+ingest_t *ingestCreate(const char *name, int numSlaves);
+
+/*!
+ \brief Map the segment of a running server (client side)
+
+ \param name the name of the segment (without '/')
+ \return ingest_t* the segment or NULL on error (errno is set)
+*/
+ingest_t *ingestOpen(const char *name);
+
+/*!
+ \brief Get the mailbox of a source
+
+ \param in the segment
+ \param source the source (INGEST_PILOT...)
+ \return mailbox_t* the mailbox in the segment
+*/
+mailbox_t *ingestMailbox(ingest_t *in, int source);
+
+/*!
+ \brief Get the buffer where a client prepares its next setpoints
+
+ \param in the segment
+ \param source the source of the client
+ \return ingestSetpoints_t* the back buffer (valid until ingestPublish())
+*/
+ingestSetpoints_t *ingestBack(ingest_t *in, int source);
+
+/*!
+ \brief Publish the back buffer to the server
+
+ \param in the segment
+ \param source the source of the client
+*/
+void ingestPublish(ingest_t *in, int source);
+
+/*!
+ \brief Unmap the segment (and remove it in the server)
+
+ \param in the segment
+*/
+void ingestClose(ingest_t *in);
+
+#endif // INGEST_H
@@ -0,0 +1,80 @@
+/**
+    @file src-master/mailbox.c
+    @brief latest-value-wins mailbox for the handoff between two threads
+    @author Jan Sommer
+
+    The index of the buffer in the middle is exchanged atomically between the writer
+    and the reader. MAILBOX_FRESH marks that the middle buffer holds a value the
+    reader has not fetched yet.
+*/
+
+#include <stdlib.h>
+#include <string.h>
+#include "mailbox.h"
+
+#define MAILBOX_FRESH 4     ///< flag in mailbox_t::middle: the middle buffer contains a new value
+#define MAILBOX_ALIGN 8     ///< alignment of the buffers @sa mailbox_t::slot
+
+size_t mailboxBytes(size_t size)
+{
+    return sizeof(mailbox_t) + 3 * ((size + MAILBOX_ALIGN - 1) & ~(size_t)(MAILBOX_ALIGN - 1));
+}
+
+mailbox_t *mailboxInitAt(void *mem, size_t size)
+{
+    mailbox_t *mb = mem;
+
+    memset(mem, 0, mailboxBytes(size));
+    mb->size  = (size + MAILBOX_ALIGN - 1) & ~(size_t)(MAILBOX_ALIGN - 1);
+    mb->back  = 0;
+    atomic_init(&mb->middle, 1);
+    mb->front = 2;
+    return mb;
+}
+
+mailbox_t *mailboxCreate(size_t size)
+{
+    void *mem = malloc(mailboxBytes(size));
+
+    if (mem == NULL)
+        return NULL;
+    return mailboxInitAt(mem, size);
+}
+
+void mailboxFree(mailbox_t *mb)
+{
+    free(mb);
+}
+
+void *mailboxBack(mailbox_t *mb)
+{
+    return mb->slot + mb->back * mb->size;
+}
+
+void mailboxPublish(mailbox_t *mb)
+{
+    unsigned old = atomic_exchange_explicit(&mb->middle, mb->back | MAILBOX_FRESH,
+                                            memory_order_acq_rel);
+    // Start the next value with a copy of the newest one, so the writer can change single elements
+    memcpy(mb->slot + (old & 3) * mb->size, mailboxBack(mb), mb->size);
+    mb->back = old & 3;
+    mb->published++;
+    if (old & MAILBOX_FRESH)
+        mb->coalesced++;
+}
+
+int mailboxFetch(mailbox_t *mb)
+{
+    unsigned old;
+
+    if (!(atomic_load_explicit(&mb->middle, memory_order_relaxed) & MAILBOX_FRESH))
+        return 0;
+    old = atomic_exchange_explicit(&mb->middle, mb->front, memory_order_acq_rel);
+    mb->front = old & 3;
+    return 1;
+}
+
+void *mailboxFront(mailbox_t *mb)
+{
+    return mb->slot + mb->front * mb->size;
+}
@@ -0,0 +1,101 @@
+/**
+    @file src-master/mailbox.h
+    @brief latest-value-wins mailbox for the handoff between two threads
+    @author Jan Sommer
+
+    The mailbox is a triple buffer: the writer fills its back buffer and publishes it,
+    the reader always gets the newest published buffer. Neither side ever blocks or
+    waits for the other. Values which are published but never fetched by the reader
+    (because a newer value was published before) are counted as coalesced.
+
+    Exactly one thread may write and one thread may read a mailbox.
+
+    The mailbox and its buffers are one block of memory without pointers, so it can be
+    placed in shared memory @sa mailboxInitAt. Then the writer and the reader may be
+    threads of different processes, the handoff is still only one atomic exchange.
+*/
+
+#ifndef MAILBOX_H
+#define MAILBOX_H
+
+#include <stddef.h>
+#include <stdatomic.h>
+
+/**
+    @brief triple buffer with the bookkeeping of the writer and the reader, followed by the 3 buffers
+*/
+typedef struct
+{
+    size_t size;                ///< size of one buffer (rounded up to the alignment of the buffers)
+    atomic_uint middle;         ///< index of the buffer in the middle | MAILBOX_FRESH
+    unsigned back;              ///< index of the buffer of the writer
+    unsigned front;             ///< index of the buffer of the reader
+    unsigned long published;    ///< number of published values (written by the writer)
+    unsigned long coalesced;    ///< number of values which were replaced before being fetched (written by the writer)
+    _Alignas(8) unsigned char slot[];   ///< the 3 buffers (aligned like malloc on all targets)
+} mailbox_t;
+
+/*!
+ \brief Size of the memory of a mailbox including its buffers
+
+ \param size the size of one value
+ \return size_t the number of bytes for mailboxInitAt()
+*/
+size_t mailboxBytes(size_t size);
+
+/*!
+ \brief Initialize a mailbox in the given memory (e.g. shared memory)
+
+ \param mem at least mailboxBytes(@a size) bytes
+ \param size the size of one value
+ \return mailbox_t* the mailbox (at @a mem)
+*/
+mailbox_t *mailboxInitAt(void *mem, size_t size);
+
+/*!
+ \brief Allocate and initialize a mailbox
+
+ \param size the size of one value
+ \return mailbox_t* the mailbox or NULL on error
+*/
+mailbox_t *mailboxCreate(size_t size);
+
+/*!
+ \brief Free a mailbox which was allocated by mailboxCreate()
+
+ \param mb the mailbox
+*/
+void mailboxFree(mailbox_t *mb);
+
+/*!
+ \brief Get the buffer where the writer prepares the next value
+
+ \param mb the mailbox
+ \return void* the back buffer (valid until mailboxPublish())
+*/
+void *mailboxBack(mailbox_t *mb);
+
+/*!
+ \brief Publish the back buffer as the newest value (writer side)
+
+ \param mb the mailbox
+*/
+void mailboxPublish(mailbox_t *mb);
+
+/*!
+ \brief Fetch the newest value if one was published since the last call (reader side)
+
+ \param mb the mailbox
+ \return int 1 if mailboxFront() changed to a newer value otherwise 0
+*/
+int mailboxFetch(mailbox_t *mb);
+
+/*!
+ \brief Get the value which was fetched last (reader side)
+
+ \param mb the mailbox
+ \return void* the front buffer (valid until the next mailboxFetch())
+*/
+void *mailboxFront(mailbox_t *mb);
+
+#endif // MAILBOX_H
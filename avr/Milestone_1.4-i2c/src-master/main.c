@@ -8,165 +8,1184 @@
     Provides a primitive ncurses-UI to send new duty cycle value via I2C to the slave.
     Each channel is represented with a labeled horizontal bar which length corresponds to
     the value set to the duty cycle.
+
+    The buses and slaves are driven by libcopter @sa copter.h, the master is only its UI.
+    The control thread of the library sends the newest complete set of values with a fixed
+    rate, so the timing on the bus does not depend on the user input or the terminal.
+    With rate 0 it sends a new set as soon as there is one; superseded sets are dropped.
+
+    The bus is a transport @sa transport.h: I2C, a serial port (slave compiled with
+    TRANSPORT = uart @sa usartSlave.h) or an emulator of the slave firmware
+    @sa slaveEmulator.c
+    The writes to all slaves of one tick are submitted as one transfer @sa transportBatch
+
+    The UI thread runs an epoll event loop over stdin, a screen timer (at most UI_RATE) and
+    a signalfd; SIGINT, SIGTERM, SIGHUP and SIGQUIT stop the program cleanly @sa eventloop.h
+
+    Other modes and features:
+        -B          throughput benchmark, --methods compares the kernel paths of i2c-dev,
+                    --stress finds the rate where the slaves fall behind @sa copterReadback
+        --realtime  locked memory and a SCHED_FIFO control thread @sa realtime.h
+        -D          server for setpoints from other processes @sa server.h
+        -T, -M      telemetry in shared memory and its monitor @sa telemetry.h
+        -S          setpoint vectors from a file or stdin @sa stream.h
+        -L, -P      recording in a ring file and its replay @sa recorder.h
+        -m, -A      mixer and closed attitude loop @sa mixer.h @sa attitude.h @sa plant.h
+        --imu, --poll  IMU reads and register polls on the scheduled bus @sa scheduler.h
+        -g          gamepad sticks through evdev @sa gamepad.h
+
+    Usage: master [-d device] [-a address] [-s] [-p] [-v] [-r rate] [-u serialport] [-b baud]
+                  [-R [-c cpu]] [-B count [--methods] [--stress[=rate]]] [-D[name]] [-T[name]]
+                  [-M[name]] [-S file [--binary] [--timed]] [-L file[:MB]] [-P file [--timed]]
+                  [-m geometry[:idle] [-A[rate]]] [--imu[=rate]] [--poll[=rate]] [-g device]
+        -d  the bus: I2C-device (default /dev/i2c-0), serial port or "emu[:clock[:loop]]" for
+            the emulator (bus clock in Hz, time of the main loop of a slave per register in us)
+        -a  7 bit address of the slave (default PPM_SLAVE_ADDR) or a comma separated list
+            of the addresses of several slaves (e.g. 0x1a,0x1b,0x1c,0x1d)
+        -s  synchronized mode: the slave only stages new duty cycles which are applied
+            after the general call latch command was sent
+        -p  packed mode: send all channels in a packed frame with CRC8
+        -v  verified writes: the duty cycles are read back from the slave after a repeated
+            start in the same transfer and compared with the sent values
+        -r  rate of the updates on the bus in Hz (1..1000, default COPTER_RATE),
+            0 sends only (the newest) changed values
+        -u  use the serial port (e.g. /dev/ttyAMA0, "emu-uart" for the emulator) instead of I2C
+        -b  baud rate of the serial port: 250000, 500000 or 1000000 (default COPTER_BAUD)
+        -R, --realtime  real-time mode
+        -c, --cpu       CPU of the control thread in real-time mode (default: the last CPU),
+                        the attitude loop runs on the CPU before it
+        -B  benchmark: send count updates as fast as possible and report the throughput
+            --methods        compare write(), SMBus blocks and I2C_RDWR
+            --stress[=rate]  count randomized updates per step, read back, with a doubling
+                             rate from rate updates/s on (default STRESS_RATE)
+        -D, --daemon[=name]  server mode: take the setpoints from /dev/shm/<name> and
+                             /tmp/<name>.sock (default INGEST_NAME) instead of the UI
+        -T, --telemetry[=name]  export the telemetry in /dev/shm/<name> (default TELEMETRY_NAME)
+        -M, --monitor[=name]    print the exported telemetry of a running master once per second
+        -S, --stream=file  send the setpoint vectors of the file ("-" for stdin)
+            --binary       the stream consists of binary records instead of text lines
+            --timed        send every vector at its time instead of as fast as possible
+        -L, --record=file[:MB]  record every update in a ring file (default RECORD_SIZE_MB MB)
+        -P, --replay=file  send the setpoints of a recording (--timed: at their original times)
+        -m, --mixer=geometry[:idle]  "quad-x", "quad-+" or "hex" (default idle MIXER_IDLE)
+        -A, --attitude[=rate]  closed attitude loop with rate Hz (default ATTITUDE_RATE)
+            --imu[=rate]   read the IMU on the first bus (default IMU_RATE Hz)
+            --poll[=rate]  poll the registers of all slaves (default POLL_RATE Hz)
+        -g, --gamepad=device  gamepad (/dev/input/eventN) or a recorded event stream
 */
 
 #include <unistd.h>
 #include <stdlib.h>
 #include <stdio.h>
-#include <fcntl.h>
-#include <sys/ioctl.h>
-#include <linux/i2c-dev.h>
 #include <stdint.h>
 #include <ncurses.h>
+#include <getopt.h>
+#include <pthread.h>
+#include <string.h>
+#include <time.h>
+#include <errno.h>
+#include <sys/signalfd.h>
+#include <sys/resource.h>
+#include <signal.h>
+#include "copter.h"
+#include "realtime.h"
+#include "eventloop.h"
+#include "slave.h"
+#include "slaveEmulator.h"
+#include "server.h"
+#include "ingest.h"
+#include "telemetry.h"
+#include "stream.h"
+#include "recorder.h"
+#include "mixer.h"
+#include "attitude.h"
+#include "plant.h"
+#include "imu.h"
+#include "gamepad.h"
 
-#define I2CPORT "/dev/i2c-0"        ///< name of the I2C-device (i2c-0 for raspberryPi)
-#define PPM_SLAVE_ADDR  0b0011010   ///< Address of the I2C-slave @sa SLAVE_ADDR_ATTINY
-/**
-    The first "register" of the I2C-slave.
-    As it is only a buffer array the address space starts with 0.
-*/
-#define STARTREGISTER 0
 // #define FALSE 1
 // #define TRUE 0
 #define LENGTH 62   ///< Maximum length of the bar presented in the UI
+#define UI_RATE         30          ///< Maximum rate of the screen updates in Hz
+#define SELFTEST_TIME   2           ///< Duration of the latency self-test in real-time mode in s
+#define OPT_BINARY      256         ///< getopt value of --binary
+#define OPT_TIMED       257         ///< getopt value of --timed
+#define OPT_IMU         258         ///< getopt value of --imu
+#define OPT_POLL        259         ///< getopt value of --poll
+#define OPT_METHODS     260         ///< getopt value of --methods
+#define OPT_STRESS      261         ///< getopt value of --stress
+#define STRESS_RATE     250         ///< Default first offered rate of the stress mode in updates/s
+#define STRESS_MAX_RATE 1000000     ///< Highest offered rate of the stress mode in updates/s
+#define STRESS_KEEP_UP  0.9         ///< A step is saturated if less than this part of the offered rate is achieved
+#define STRESS_HISTORY  8           ///< A readback of one of the last values sent to a channel is a lost update
+#define POLL_RATE       100         ///< Default rate of the polls of the slave registers in Hz
+#define MIXER_IDLE      410         ///< Default duty cycle of an idling motor (5 %)
+#define STALL_TIME      300         ///< Duration of a stall of an emulated bus in ms (long enough for the library to reopen the bus)
 
-int channel[4] = {0,0,0,0}; /*!< Array which holds the current value of each channel */
-char row[LENGTH+1]; /*!< String which contains length '#'s which represent a full bar*/
-int ppmSlave; /*!< device descriptor of the PWM-slave */
-
-#define uniq(LOW,HEIGHT)	((HEIGHT << 8)|LOW)			  // Create 16 bit number from two bytes
-#define LOW_BYTE(x)        	(x & 0xff)					    // Get low byte from 16 bit number
-#define HIGH_BYTE(x)       	((x >> 8) & 0xff)			  // Get high byte from 16 bit number
-
-int channel[4] = {0,0,0,0};  /*!< Array containing the duty cycles of each channel*/
+int channel[COPTER_MAX_SLAVES][4];  /*!< Array containing the duty cycles of each channel of each slave (owned by the UI)*/
+int selected = 0;            /*!< index of the slave whose channels are shown and changed in the UI*/
 char row[LENGTH+1];          /*!< Array containing LENGTH '#' which represents the maximum length of the bar chart*/
-int ppmSlave;                /*!< file descriptor for the ppm-slave*/
-int failCounter = 0;         /*!< counts the number of failed writes to the I2C-bus */
-int err;
+copterConfig_t cfg;          /*!< the buses, slaves and modes given on the command line*/
+copter_t *copter;            /*!< the device handle of libcopter*/
+eventLoop_t ui;              /*!< event loop of the UI thread*/
+long benchmarkCount = 0;     /*!< number of updates sent in benchmark mode (0 == UI)*/
+int benchmarkMethods = FALSE; /*!< TRUE if the benchmark compares the methods of the transport*/
+long stressRate = 0;         /*!< first offered rate of the stress mode in updates/s (0 == no stress mode)*/
+const char *serverName = NULL; /*!< name of the shared memory and the socket in server mode (NULL == UI)*/
+const char *telemetryName = NULL; /*!< name of the exported telemetry (NULL == not exported)*/
+const char *monitorName = NULL; /*!< name of the telemetry which is printed in monitor mode (NULL == no monitor)*/
+const char *streamFile = NULL; /*!< file of the setpoint vectors in streaming mode (NULL == no streaming)*/
+int streamBinary = FALSE;    /*!< TRUE if the stream consists of binary records*/
+int streamTimed = FALSE;     /*!< TRUE if every vector is sent at its time*/
+const char *recordFile = NULL; /*!< ring file of the recording (NULL == not recorded)*/
+int recordSize = RECORD_SIZE_MB; /*!< size of the ring file in MB*/
+const char *replayFile = NULL; /*!< recording which is replayed (NULL == no replay)*/
+const char *mixerName = NULL; /*!< geometry of the mixer (NULL == the keys change the channels)*/
+mixer_t mixer;               /*!< the mixer of the motors @sa mixerName*/
+mixerInput_t stick;          /*!< throttle, roll, pitch and yaw changed by the keys in mixer mode*/
+attitudeConfig_t attitudeCfg; /*!< rate and gains of the attitude loop*/
+int attitudeRate = 0;        /*!< rate of the attitude loop in Hz (0 == the keys control the mixer directly)*/
+attitude_t *attitude = NULL; /*!< the attitude loop @sa attitudeRate*/
+plant_t *plant = NULL;       /*!< the simulated airframe which is the sensor of the attitude loop*/
+int imuRate = 0;             /*!< rate of the reads of the IMU in Hz (0 == no IMU)*/
+imu_t *imu = NULL;           /*!< the reader of the IMU @sa imuRate*/
+int pollRate = 0;            /*!< rate of the polls of the slave registers in Hz (0 == no polls)*/
+pthread_t pollThread;        /*!< thread which polls the slave registers @sa pollRate*/
+volatile int polling = FALSE; /*!< the poll thread runs until this is FALSE*/
+unsigned long polls = 0;     /*!< number of polls of a slave*/
+unsigned long pollFailures = 0; /*!< number of failed polls*/
+const char *gamepadPath = NULL; /*!< the gamepad or the recorded event stream (NULL == only the keys)*/
+gamepad_t *gamepad = NULL;   /*!< the gamepad @sa gamepadPath*/
 
 /**
-    @brief Initialize the I2C-device and device descirptor for the slave
+    @brief values which are currently shown on the screen (for the incremental update)
 */
-int I2Cinit()
+struct
 {
-      ppmSlave = open(I2CPORT, O_RDWR | O_NOCTTY | O_NDELAY);
-      if (ppmSlave == -1)
-      {
-            printf("open_port: Unable to open i2c-bus. Maybe root permissions necessary?\n");
-            return FALSE; //0 == error
-      }
-      
-      if (ioctl(ppmSlave, I2C_SLAVE, PPM_SLAVE_ADDR) < 0)
-      {
-            printf("Failed to acquire bus access and/or talk to slave.\n");
-            return FALSE; // 0 == error
-      }
-        
-      return TRUE;     
+    int bar[4];                 ///< length of the bars
+    int value[4];               ///< duty cycles
+    int failed;                 ///< @sa copterStats_t::failed
+    int lastError;              ///< @sa copterStats_t::lastError
+    int missedTicks;            ///< @sa copterStats_t::missedTicks
+    int verifyFailures;         ///< @sa copterStats_t::verifyFailures
+    int selected;               ///< @sa selected
+    int slaveFailures;          ///< failures of the selected slave @sa copterStats_t::slaveFailures
+    long maxSkew;               ///< @sa copterStats_t::maxSkew
+    latency_t latency[2];       ///< latency of the writes and reads on all buses
+    unsigned long retries;      ///< @sa copterStats_t::retries
+    unsigned long lostUpdates;  ///< @sa copterStats_t::lostUpdates
+    int recoveries;             ///< @sa copterStats_t::recoveries
+    long lastRecovery;          ///< @sa copterStats_t::lastRecovery
+    unsigned long coalesced;    ///< @sa copterStats_t::coalesced
+    mixerInput_t stick;         ///< @sa stick
+    int error[ATT_AXES];        ///< @sa attitudeStats_t::error
+    unsigned long overruns;     ///< @sa attitudeStats_t::overruns
+    int utilization;            ///< utilization of the first bus in per mille
+} shown;
+int increment = 1;           /*!< value added to a channel by the next key press*/
+
+/*!
+ \brief Mix the stick and hand the duty cycles of all motors over to the control thread
+        (or command the attitude loop, which mixes and submits)
+
+ \param inputTime time of the input event in ns for the latency to the bus, 0 == not measured
+*/
+void submitStick(long long inputTime)
+{
+    if (attitude != NULL)
+    {
+        attitudeCommand(attitude, &stick, inputTime);
+        return;
+    }
+    mixerRun(&mixer, &stick, channel);
+    copterSubmitInput(copter, 0, (mixer.numMotors + 3) / 4, (const int (*)[4])channel, inputTime);
 }
 
 /*!
- \brief Set a new duty cycle for a certain channel @a ch of the slave
+ \brief Change throttle, roll, pitch or yaw, mix them and hand the duty cycles of all motors over to the control thread
+
+ \param ch 0: throttle, 1: roll, 2: pitch, 3: yaw, -1 changes all at once
+ \param inc the value which is added
+*/
+void changeStick(int ch, int inc)
+{
+    int *axis[4] = {&stick.throttle, &stick.roll, &stick.pitch, &stick.yaw};
+    int i;
 
- \param ch the channel which is to be updated
+    for (i = 0; i < 4; i++)
+    {
+        if (ch == i || ch == -1)
+        {
+            *axis[i] += inc;
+            if (*axis[i] > MIXER_ONE)
+                *axis[i] = MIXER_ONE;
+            if (*axis[i] < (i == 0 ? 0 : -MIXER_ONE))
+                *axis[i] = i == 0 ? 0 : -MIXER_ONE;
+        }
+    }
+    submitStick(0);
+}
+
+/*!
+ \brief Change the duty cycle of a channel of the selected slave and hand the new values over to the control thread
+
+ \param ch the channel which is to be updated, -1 changes all channels at once
+ \param inc the value which is added to the duty cycle
+*/
+void changeChannel(int ch, int inc)
+{
+    int i;
+
+    if (mixerName != NULL)
+    {
+        changeStick(ch, inc);
+        return;
+    }
+
+    for (i = 0; i < 4; i++)
+    {
+        if (ch == i || ch == -1)
+        {
+            channel[selected][i] += inc;
+            if (channel[selected][i] > MAX_DUTY_CYCLE)
+                channel[selected][i] = MAX_DUTY_CYCLE;
+            if (channel[selected][i] < 0)
+                channel[selected][i] = 0;
+        }
+    }
+    copterSubmit(copter, selected, 1, &channel[selected]);  // a failure is counted by the library
+}
+
+/*!
+ \brief Lock the memory and measure the wakeup latency of a real-time thread
+
+ \param attr the attributes for the real-time control thread
  \return int TRUE if successful otherwise FALSE
 */
-int setSingleChannel(int ch)
+int realtimeInit(pthread_attr_t *attr)
 {
-    uint8_t data[3];
-    if (channel[ch] > 8191)
-        channel[ch] = 8191;
-    if (channel[ch] < 0)
-        channel[ch] = 0;
-    
-    data[0] = STARTREGISTER + 2*ch;
-    data[1] = HIGH_BYTE(channel[ch]);
-    data[2] = LOW_BYTE(channel[ch]);
-    if (write(ppmSlave, data, 3) != 3)
-     {
-       endwin();
-       printf("Failed write duty cycle\n");
-       failCounter++;
-//       exit (1);
-     }
-//     else
-//        printf("Sending new duty cycle succeeded\n");
-     
-      return TRUE;
+    int rate = cfg.rate > 0 ? cfg.rate : COPTER_RATE;
+    latency_t lat;
+
+    if (realtimeLockMemory() != 0)
+    {
+        printf("Failed to lock the memory. Maybe root permissions necessary?\n");
+        return FALSE;
+    }
+    if (realtimeAttr(attr, cfg.cpu, RT_PRIORITY) != 0)
+    {
+        printf("Invalid CPU %d for the control thread\n", cfg.cpu);
+        return FALSE;
+    }
+
+    printf("Measuring the wakeup latency for %d s at %d Hz...\n", SELFTEST_TIME, rate);
+    if (realtimeSelfTest(attr, rate, SELFTEST_TIME * rate, &lat) != 0)
+    {
+        printf("Latency self-test failed. Maybe root permissions necessary for SCHED_FIFO?\n");
+        return FALSE;
+    }
+    printf("Wakeup latency (%d samples): p50 %ld us, p99 %ld us, p99.9 %ld us, max %ld us, overruns %d\n",
+           lat.samples, lat.p50 / 1000, lat.p99 / 1000, lat.p999 / 1000, lat.max / 1000, lat.overruns);
+    if (lat.max > 1000000000L / rate)
+        printf("Warning: the maximum latency exceeds the period of the control thread\n");
+    return TRUE;
+}
+
+/*!
+ \brief CPU of the attitude loop in real-time mode: the CPU before the one of the control thread
+
+ On a single CPU both threads share it, the lower priority keeps the control thread first.
+*/
+int attitudeCpu(void)
+{
+    int cpus = sysconf(_SC_NPROCESSORS_ONLN);
+    int cpu = cfg.cpu >= 0 ? cfg.cpu : cpus - 1;
+
+    return cpu > 0 ? cpu - 1 : cpus > 1 ? 1 : 0;
+}
+
+/*!
+ \brief Print the skew between the buses
+*/
+void printSkew(const copterStats_t *stats)
+{
+    if (stats->parallelTicks > 0)
+        printf("Skew between the buses: average %.1f us, max %.1f us\n",
+               stats->avgSkew / 1e3, stats->maxSkew / 1e3);
+}
+
+/*!
+ \brief Send benchmarkCount updates as fast as possible
+
+ The duty cycles change with every update, so every write is different.
+*/
+void benchmarkSend()
+{
+    int value[COPTER_MAX_SLAVES][4];
+    long n;
+    int i, k;
+
+    for (n = 0; n < benchmarkCount; n++)
+    {
+        for (k = 0; k < cfg.numSlaves; k++)
+            for (i = 0; i < 4; i++)
+                value[k][i] = (n + i * 2048 + k * 512) & MAX_DUTY_CYCLE;
+        copterSend(copter, (const int (*)[4])value);
+    }
 }
 
 /*!
- \brief Writes new duty cycles to all channels of the slave at once (only on write command)
+ \brief Send benchmarkCount updates as fast as possible and report the throughput
+
+ \return int TRUE if all updates were sent otherwise FALSE
+*/
+int benchmark()
+{
+    struct timespec start, end;
+    copterStats_t stats;
+    int k;
+    double s;
+
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    benchmarkSend();
+    clock_gettime(CLOCK_MONOTONIC, &end);
+    copterStats(copter, &stats);
+
+    s = (end.tv_sec - start.tv_sec) + (end.tv_nsec - start.tv_nsec) / 1e9;
+    printf("%s: %ld updates of %d slaves on %d buses in %.3f s: %.0f updates/s, %.1f us/update, %d failed",
+           cfg.device[0], benchmarkCount, cfg.numSlaves, cfg.numBuses, s, benchmarkCount / s,
+           s * 1e6 / benchmarkCount, stats.failed);
+    if (cfg.verify)
+        printf(" (%d not verified)", stats.verifyFailures);
+    printf("\n");
+    for (k = 0; k < cfg.numSlaves && stats.failed + stats.verifyFailures > 0; k++)
+        printf("  slave %d:0x%02x: %d failed\n", cfg.slaveBus[k], cfg.slaveAddr[k], stats.slaveFailures[k]);
+    printSkew(&stats);
+    return stats.failed == 0 ? TRUE : FALSE;
+}
+
+/*!
+ \brief Send the benchmark updates once with each method of the transport and compare them
+
+ The CPU time of the process in the kernel is the cost of the system calls, the rest of
+ the wall time is spent waiting for the bus (the adapter or the emulated bus clock).
+
+ \return int TRUE if all updates of all supported methods were sent otherwise FALSE
+*/
+int benchmarkMethod()
+{
+    static const char *methodName[TRANSPORT_METHODS] = {"auto", "write", "smbus", "rdwr"};
+    static const int method[] = {TRANSPORT_WRITE, TRANSPORT_SMBUS, TRANSPORT_RDWR};
+    struct rusage before, after;
+    struct timespec start, end;
+    copterStats_t stats;
+    double wall, sys, user;
+    int i, failed = 0, result = TRUE;
+
+    for (i = 0; i < 3; i++)
+    {
+        if (copterBusMethod(copter, method[i]) != 0)
+        {
+            printf("%-5s: not supported by %s\n", methodName[method[i]], cfg.device[0]);
+            continue;
+        }
+        getrusage(RUSAGE_SELF, &before);
+        clock_gettime(CLOCK_MONOTONIC, &start);
+        benchmarkSend();
+        clock_gettime(CLOCK_MONOTONIC, &end);
+        getrusage(RUSAGE_SELF, &after);
+        copterStats(copter, &stats);
+
+        wall = (end.tv_sec - start.tv_sec) * 1e6 + (end.tv_nsec - start.tv_nsec) / 1e3;
+        sys  = (after.ru_stime.tv_sec - before.ru_stime.tv_sec) * 1e6 + (after.ru_stime.tv_usec - before.ru_stime.tv_usec);
+        user = (after.ru_utime.tv_sec - before.ru_utime.tv_sec) * 1e6 + (after.ru_utime.tv_usec - before.ru_utime.tv_usec);
+        printf("%-5s: %.0f updates/s, %.1f us/update: kernel %.1f us, user %.1f us, waiting for the bus %.1f us, %d failed\n",
+               methodName[method[i]], benchmarkCount * 1e6 / wall, wall / benchmarkCount, sys / benchmarkCount,
+               user / benchmarkCount, (wall - sys - user) / benchmarkCount, stats.failed - failed);
+        if (stats.failed != failed)
+            result = FALSE;
+        failed = stats.failed;
+    }
+    copterBusMethod(copter, TRANSPORT_AUTO);
+    return result;
+}
+
+/**
+    @brief result of one step of the stress mode, counted per update of a slave
+*/
+typedef struct
+{
+    long offered;           ///< offered rate in updates/s, 0 == back to back
+    double seconds;         ///< duration of the step
+    long nacks;             ///< the write or the readback was not acknowledged
+    long lost;              ///< the slave still mirrored older values (it did not process the update in time)
+    long mismatched;        ///< the slave mirrored values which were never sent
+} stressStep_t;
+
+/*!
+ \brief Send benchmarkCount randomized updates with the offered rate and check every readback
+
+ The duty cycles are even, so the packed frames mirror exactly the sent values, and
+ every channel gets a new value with every update. A channel whose mirror did not change
+ or shows one of the last values is lost, any other value is a mismatch.
+
+ \param step the offered rate (in) and the counters
+ \param sent the last STRESS_HISTORY values of every channel, newest first
+ \param mirrored the last readback of every channel
+*/
+void stressStep(stressStep_t *step, int sent[][4][STRESS_HISTORY], int mirrored[][4])
+{
+    struct timespec start, next, end;
+    int value[COPTER_MAX_SLAVES][4], readback[COPTER_MAX_SLAVES][4];
+    long period = step->offered > 0 ? 1000000000L / step->offered : 0;
+    long n;
+    int i, j, k, valid, stale, wrong;
+
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    next = start;
+    for (n = 0; n < benchmarkCount; n++)
+    {
+        if (period > 0)
+        {
+            clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &next, NULL);
+            next.tv_nsec += period;
+            if (next.tv_nsec >= 1000000000L)
+            {
+                next.tv_sec++;
+                next.tv_nsec -= 1000000000L;
+            }
+        }
+        for (k = 0; k < cfg.numSlaves; k++)
+            for (i = 0; i < 4; i++)
+                do
+                    value[k][i] = random() % (MAX_DUTY_CYCLE / 2 + 1) * 2;
+                while (value[k][i] == sent[k][i][0]);
+        copterSend(copter, (const int (*)[4])value);
+        valid = copterReadback(copter, readback);
+
+        for (k = 0; k < cfg.numSlaves; k++)
+        {
+            for (i = 0; i < 4; i++)
+            {
+                memmove(&sent[k][i][1], &sent[k][i][0], (STRESS_HISTORY - 1) * sizeof(int));
+                sent[k][i][0] = value[k][i];
+            }
+            if (!(valid & (1 << k)))
+            {
+                step->nacks++;
+                continue;
+            }
+            stale = wrong = 0;
+            for (i = 0; i < 4; i++)
+            {
+                if (readback[k][i] == value[k][i])
+                    continue;
+                for (j = 1; j < STRESS_HISTORY && readback[k][i] != sent[k][i][j]; j++)
+                    ;
+                if (j < STRESS_HISTORY || readback[k][i] == mirrored[k][i])
+                    stale = 1;
+                else
+                    wrong = 1;
+            }
+            memcpy(mirrored[k], readback[k], sizeof(mirrored[k]));
+            if (wrong)
+                step->mismatched++;
+            else if (stale)
+                step->lost++;
+        }
+    }
+    clock_gettime(CLOCK_MONOTONIC, &end);
+    step->seconds = (end.tv_sec - start.tv_sec) + (end.tv_nsec - start.tv_nsec) / 1e9;
+}
+
+/*!
+ \brief Stress the slaves with increasing rates and find the knee where they fall behind
+
+ The offered rate doubles from stressRate on until the bus does not achieve it any more,
+ then one step is sent back to back. The knee is the highest offered rate which the
+ slaves absorbed completely.
+
+ \return int FALSE if the slaves fell behind already at the first rate (or the bus limit below it) otherwise TRUE
+*/
+int stress()
+{
+    static int sent[COPTER_MAX_SLAVES][4][STRESS_HISTORY];
+    int mirrored[COPTER_MAX_SLAVES][4];
+    stressStep_t step;
+    long rate = stressRate, knee = 0, behind = 0, bad;
+    double achieved, updates = (double)benchmarkCount * cfg.numSlaves;
+
+    srandom(time(NULL));
+    memset(mirrored, 0, sizeof(mirrored));
+    copterSend(copter, (const int (*)[4])mirrored);     // a known start: all channels 0
+    copterReadback(copter, mirrored);
+    printf("Stress %s: %ld randomized updates of %d slaves per step, every update is read back\n",
+           cfg.device[0], benchmarkCount, cfg.numSlaves);
+    printf("  offered/s  achieved/s   NACK %%   lost %%  mismatched %%\n");
+    for (;;)
+    {
+        memset(&step, 0, sizeof(step));
+        step.offered = rate;
+        stressStep(&step, sent, mirrored);
+        achieved = benchmarkCount / step.seconds;
+        bad = step.nacks + step.lost + step.mismatched;
+        if (rate > 0)
+            printf("  %9ld", rate);
+        else
+            printf("  %9s", "max");
+        printf("  %10.0f  %7.3f  %7.3f  %12.3f\n", achieved, step.nacks * 100 / updates,
+               step.lost * 100 / updates, step.mismatched * 100 / updates);
+        if (bad == 0 && rate > 0 && achieved >= STRESS_KEEP_UP * rate)
+            knee = rate;
+        if (bad > 0 && behind == 0)
+            behind = rate > 0 ? rate : (long)achieved;
+        if (rate == 0)
+            break;
+        rate = achieved < STRESS_KEEP_UP * rate || rate * 2 > STRESS_MAX_RATE ? 0 : rate * 2;
+    }
+
+    if (knee == 0 && behind != 0)
+        printf("The slaves fall behind already at %ld updates/s (start lower with --stress=<rate>)\n", behind);
+    else if (knee == 0)
+        printf("The bus does not reach %ld updates/s (%.0f updates/s back to back), the slaves absorbed all updates\n",
+               stressRate, achieved);
+    else if (behind == 0)
+        printf("Knee: all updates absorbed up to the limit of the bus (%.0f updates/s back to back)\n", achieved);
+    else
+        printf("Knee: all updates absorbed up to %ld updates/s, the slaves fall behind from %ld updates/s\n", knee, behind);
+    return knee > 0 || behind == 0 ? TRUE : FALSE;
+}
+
+/*!
+ \brief Measure the time of the mixer for benchmarkCount ticks with changing inputs
+*/
+void benchmarkMixer()
+{
+    struct timespec start, end;
+    int value[COPTER_MAX_SLAVES][4];
+    mixerInput_t in;
+    long n, sum = 0;
+    double s;
+
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    for (n = 0; n < benchmarkCount; n++)
+    {
+        in.throttle = n & (MIXER_ONE - 1);
+        in.roll     = ((n * 7) & (2 * MIXER_ONE - 1)) - MIXER_ONE;
+        in.pitch    = ((n * 13) & (2 * MIXER_ONE - 1)) - MIXER_ONE;
+        in.yaw      = ((n * 3) & (2 * MIXER_ONE - 1)) - MIXER_ONE;
+        mixerRun(&mixer, &in, value);
+        sum += value[0][0];     // the result is used
+    }
+    clock_gettime(CLOCK_MONOTONIC, &end);
+
+    s = (end.tv_sec - start.tv_sec) + (end.tv_nsec - start.tv_nsec) / 1e9;
+    printf("Mixer %s: %ld ticks in %.3f s: %.1f ns/tick, %lu desaturated (%ld)\n",
+           mixerName, benchmarkCount, s, s * 1e9 / benchmarkCount, mixer.desaturated, sum / benchmarkCount);
+}
+
+/*!
+ \brief Send the setpoint vectors of streamFile (or the recording replayFile) and report
+        the achieved updates per second
+
+ \return int TRUE if the stream was read and all vectors were delivered otherwise FALSE
+*/
+int stream()
+{
+    streamStats_t result;
+    const char *name = replayFile != NULL ? replayFile : streamFile;
+    recording_t rec;
+    FILE *in = stdin;
+    double s;
+    int ok;
+
+    if (replayFile != NULL)
+    {
+        if (recordingOpen(replayFile, &rec) != 0)
+        {
+            printf("Opening the recording %s failed: %s\n", replayFile, strerror(errno));
+            return FALSE;
+        }
+        if (rec.numSlaves != cfg.numSlaves)
+        {
+            printf("The recording %s contains %d slaves, but %d are given\n", replayFile, rec.numSlaves, cfg.numSlaves);
+            recordingClose(&rec);
+            return FALSE;
+        }
+        ok = streamRun(copter, cfg.numSlaves, recordingStream, &rec, streamTimed == TRUE, &result) == 0;
+        recordingClose(&rec);
+    }
+    else
+    {
+        if (strcmp(streamFile, "-") != 0)
+            in = fopen(streamFile, streamBinary == TRUE ? "rb" : "r");
+        if (in == NULL)
+        {
+            printf("Opening the stream %s failed: %s\n", streamFile, strerror(errno));
+            return FALSE;
+        }
+        ok = streamRun(copter, cfg.numSlaves, streamBinary == TRUE ? streamReadBinary : streamReadText, in,
+                       streamTimed == TRUE, &result) == 0;
+        if (in != stdin)
+            fclose(in);
+    }
+
+    s = result.elapsed / 1e9;
+    printf("%s: %lu vectors of %d slaves in %.3f s: %.0f updates/s, %lu failed, %lu invalid\n",
+           name, result.vectors, cfg.numSlaves, s, s > 0 ? (result.vectors - 1) / s : 0.0,
+           result.failed, result.invalid);
+    if (streamTimed == TRUE && result.vectors > 0)
+        printf("Delay after the time of the vectors: average %.1f us, max %.1f us\n",
+               result.sumLate / 1e3 / result.vectors, result.maxLate / 1e3);
+    return ok && result.failed == 0 ? TRUE : FALSE;
+}
+
+/*!
+ \brief Print the retries, lost updates and recoveries of the buses
+*/
+void printHealth(const copterStats_t *stats)
+{
+    if (stats->retries == 0 && stats->outages == 0)
+        return;
+    printf("Retries: %lu, lost updates: %lu, outages: %lu, bus recoveries: %d, time to recover: last %.1f ms, max %.1f ms\n",
+           stats->retries, stats->lostUpdates, stats->outages, stats->recoveries,
+           stats->lastRecovery / 1e6, stats->maxRecovery / 1e6);
+}
+
+/*!
+ \brief Print the latency histograms of all buses
+*/
+void printLatency()
+{
+    latency_t lat[2];
+    int b, i;
+
+    for (b = 0; b < cfg.numBuses; b++)
+    {
+        copterBusLatency(copter, b, &lat[0], &lat[1]);
+        for (i = 0; i < 2; i++)
+        {
+            if (lat[i].samples == 0)
+                continue;
+            printf("Bus %s %-5s latency (%d transfers): p50 %.1f us, p99 %.1f us, p99.9 %.1f us, max %.1f us\n",
+                   cfg.device[b], i == 0 ? "write" : "read", lat[i].samples, lat[i].p50 / 1e3, lat[i].p99 / 1e3,
+                   lat[i].p999 / 1e3, lat[i].max / 1e3);
+        }
+    }
+}
+
+/*!
+ \brief Print the telemetry exported by another master once per second until it is killed
+
+ \return int FALSE if the telemetry could not be opened
+*/
+int monitor()
+{
+    struct timespec second = {1, 0};
+    telemetryData_t data;
+    unsigned long last = 0;
+    telemetry_t *t;
+    int s, i;
+
+    t = telemetryOpen(monitorName);
+    if (t == NULL)
+    {
+        printf("Opening the telemetry %s failed: %s\n", monitorName, strerror(errno));
+        return FALSE;
+    }
+    for (;;)
+    {
+        telemetryRead(t, &data);
+        printf("%lu updates/s, failed %d, not verified %d, missed ticks %d, retries %lu, lost %lu, recoveries %d, "
+               "write p99 %.1f us, read p99 %.1f us, reader retries %lu\n",
+               data.updates - last, data.failed, data.verifyFailures, data.missedTicks, data.retries,
+               data.lostUpdates, data.recoveries, data.writeLatency[0].p99 / 1e3, data.readLatency[0].p99 / 1e3,
+               t->retries);
+        for (s = 0; s < data.numSlaves && s < COPTER_MAX_SLAVES; s++)
+        {
+            printf("  slave %d:%s", s, data.delivered ? "" : " (not delivered)");
+            for (i = 0; i < 4; i++)
+                printf(" %4d", data.setpoint[s][i]);
+            if (data.verified)
+            {
+                printf("  readback");
+                for (i = 0; i < 4; i++)
+                    printf(" %4d", data.readback[s][i]);
+            }
+            printf("\n");
+        }
+        fflush(stdout);
+        last = data.updates;
+        nanosleep(&second, NULL);
+    }
+    return TRUE;
+}
+
+/*!
+ \brief Print the content of the ring file recordFile (after copterClose() wrote it completely)
+*/
+void printRecording()
+{
+    recording_t rec;
+    recordEntry_t entry;
+    unsigned long records = 0, lost = 0, mismatches = 0;
+
+    if (recordFile == NULL)
+        return;
+    if (recordingOpen(recordFile, &rec) != 0)
+    {
+        printf("Reading the recording %s failed: %s\n", recordFile, strerror(errno));
+        return;
+    }
+    entry.time = 0;
+    while (recordingNext(&rec, &entry) == 1)
+    {
+        records++;
+        if (!(entry.flags & RECORD_DELIVERED))
+            lost++;
+        if ((entry.flags & RECORD_READBACK) &&
+            memcmp(entry.readback, entry.value, rec.numSlaves * sizeof(entry.value[0])) != 0)
+            mismatches++;
+    }
+    printf("Recording %s: %lu updates in %d blocks over %.3f s, %.1f bytes/update, %lu not delivered, %lu readback mismatches\n",
+           recordFile, records, rec.numBlocks, entry.time / 1e9, records > 0 ? (double)rec.used / records : 0.0,
+           lost, mismatches);
+    recordingClose(&rec);
+}
+
+/*!
+ \brief Print the timing of the attitude loop
+*/
+void printAttitude()
+{
+    attitudeStats_t stats;
+
+    attitudeStats(attitude, &stats);
+    printf("Attitude loop %d Hz: %lu ticks, %lu overruns, %lu ticks without a new sample (%lu samples, %lu coalesced)\n",
+           attitudeRate, stats.ticks, stats.overruns, stats.staleSamples, stats.samples, stats.coalescedSamples);
+    printf("  wakeup delay: p50 %.1f us, p99 %.1f us, max %.1f us\n",
+           stats.wakeup.p50 / 1e3, stats.wakeup.p99 / 1e3, stats.wakeup.max / 1e3);
+    printf("  loop time:    p50 %.1f us, p99 %.1f us, max %.1f us\n",
+           stats.loopTime.p50 / 1e3, stats.loopTime.p99 / 1e3, stats.loopTime.max / 1e3);
+    printf("  sample age:   p50 %.1f us, p99 %.1f us, max %.1f us\n",
+           stats.sampleAge.p50 / 1e3, stats.sampleAge.p99 / 1e3, stats.sampleAge.max / 1e3);
+}
+
+/*!
+ \brief Thread which polls the duty cycles of all slaves with pollRate like a telemetry reader
+
+ \param arg unused
+ \return void* NULL
+*/
+void *pollSlaves(void *arg)
+{
+    int timerFd = periodicTimer(1000000000L / pollRate);
+    uint64_t expirations;
+    uint8_t data[8];
+    int s;
+
+    while (polling == TRUE && timerFd != -1)
+    {
+        if (read(timerFd, &expirations, sizeof(expirations)) != sizeof(expirations))
+            continue;
+        for (s = 0; s < cfg.numSlaves; s++, polls++)
+            if (copterRead(copter, s, STARTREGISTER, data, 8) != 0)
+                pollFailures++;
+    }
+    if (timerFd != -1)
+        close(timerFd);
+    return NULL;
+}
+
+/*!
+ \brief Start the reader of the IMU and the poll thread (if they were requested)
 
  \return int TRUE if successful otherwise FALSE
 */
-int setAllChannels()
+int devicesStart()
 {
-    uint8_t data[9];
-    int i;
-    data[0] = STARTREGISTER;
-    for (i=0; i<4;i++)
-    {
-        if (channel[i] > 8191)
-            channel[i] = 8191;
-        if (channel[i] < 0)
-            channel[i] = 0;
-        data[2*i+1]   = HIGH_BYTE(channel[i]);
-        data[2*i+2]   = LOW_BYTE(channel[i]);
-    }
-    err = write(ppmSlave, data, 9);
-    if (err != 9)
-     {
-       endwin();
-       printf("Failed write duty cycles\n");
-       failCounter++;
-//       exit (1);
-     }
-//      else
-//        printf("Sending new duty cycles succeeded\n");
-      return TRUE;
+    if (imuRate > 0 && (imu = imuOpen(copter, 0, imuRate)) == NULL)
+    {
+        printf("Failed to start the IMU on %s: %s\n", cfg.device[0], strerror(errno));
+        return FALSE;
+    }
+    if (pollRate > 0)
+    {
+        polling = TRUE;
+        if (threadCreate(&pollThread, NULL, pollSlaves, NULL) != 0)
+        {
+            polling = FALSE;
+            printf("Failed to start the poll thread\n");
+            return FALSE;
+        }
+    }
+    return TRUE;
 }
 
 /*!
- \brief  Update the ncurses ui-screen
+ \brief Stop the reader of the IMU and the poll thread and print their counters
+*/
+void devicesStop()
+{
+    imuStats_t stats;
+
+    if (imu != NULL)
+    {
+        imuStats(imu, &stats);
+        printf("IMU %d Hz: %lu samples, %lu failed, %lu overruns\n", imuRate, stats.samples, stats.failed, stats.overruns);
+        imuClose(imu);
+        imu = NULL;
+    }
+    if (polling == TRUE)
+    {
+        polling = FALSE;
+        pthread_join(pollThread, NULL);
+        printf("Polls of the slaves %d Hz: %lu polls, %lu failed\n", pollRate, polls, pollFailures);
+    }
+}
 
+/*!
+ \brief Print the transfers, missed deadlines and waits of each class and the utilization of all buses
 */
-void printScreen()
+void printSchedule()
 {
-   erase();
+    static const char *className[BUS_CLASSES] = {"motor", "imu", "telemetry"};
+    busScheduleStats_t sched;
+    int b, i;
+
+    for (b = 0; b < cfg.numBuses; b++)
+    {
+        copterBusSchedule(copter, b, &sched);
+        printf("Bus %s utilization: average %.1f %%, max %.1f %% of a %.1f ms tick, %lu of %lu ticks above %d %%\n",
+               cfg.device[b], sched.utilization / 10.0, sched.maxUtilization / 10.0, sched.tick / 1e6,
+               sched.busyTicks, sched.ticks, SCHED_BUSY_LIMIT / 10);
+        for (i = 0; i < BUS_CLASSES; i++)
+        {
+            if (sched.transfers[i] == 0)
+                continue;
+            printf("  %-9s %lu transfers, %lu missed deadlines, %lu waited for the bus (average %.1f us, max %.1f us)\n",
+                   className[i], sched.transfers[i], sched.missed[i], sched.waited[i],
+                   sched.waited[i] > 0 ? sched.sumWait[i] / 1e3 / sched.waited[i] : 0.0, sched.maxWait[i] / 1e3);
+        }
+    }
+}
 
-   mvprintw(0, 2, "missed writes: %d \t %d", failCounter, err);
+/*!
+ \brief Print the rejected packed frames, the skew, the latencies and the health of the buses
+*/
+void printSummary()
+{
+    copterStats_t stats;
+    uint8_t rejected;
+    int i;
+
+    for (i = 0; i < cfg.numSlaves && cfg.packed; i++)
+        if (copterRead(copter, i, REJECTED_REGISTER, &rejected, 1) == 0)
+            printf("Packed frames rejected by the slave 0x%02x: %d\n", cfg.slaveAddr[i], rejected);
+    copterStats(copter, &stats);
+    printSkew(&stats);
+    printLatency();
+    printSchedule();
+    printHealth(&stats);
+    if (stats.inputLatency.samples > 0)
+        printf("Input to bus latency (%d inputs): p50 %.1f us, p99 %.1f us, p99.9 %.1f us, max %.1f us\n",
+               stats.inputLatency.samples, stats.inputLatency.p50 / 1e3, stats.inputLatency.p99 / 1e3,
+               stats.inputLatency.p999 / 1e3, stats.inputLatency.max / 1e3);
+    if (stats.recordDropped > 0)
+        printf("Updates dropped by the recorder: %lu\n", stats.recordDropped);
+}
+
+/*!
+ \brief  Draw the parts of the ncurses ui-screen which never change
+*/
+void screenInit()
+{
+   int i;
+
+   erase();
    mvprintw(2, 2, "Channel 1:");
    mvprintw(6, 2, "Channel 2:");
    mvprintw(10, 2, "Channel 3:");
    mvprintw(14, 2, "Channel 4:");
-   
-   //calculate the length of each bar an draw it next to the labels
-   attron(COLOR_PAIR(1) | A_INVIS);
-   mvprintw(4, 5, "%s", &row[LENGTH - LENGTH*channel[0]/8191]);
-   mvprintw(8, 5, "%s", &row[LENGTH - LENGTH*channel[1]/8191]);
-   mvprintw(12, 5, "%s", &row[LENGTH - LENGTH*channel[2]/8191]);
-   mvprintw(16, 5, "%s", &row[LENGTH - LENGTH*channel[3]/8191]);
-   attroff(COLOR_PAIR(1) | A_INVIS);
-   
-   mvprintw(4, 63, ":%4d", channel[0]);
-   mvprintw(8, 63, ":%4d", channel[1]);
-   mvprintw(12, 63, ":%4d", channel[2]);
-   mvprintw(16, 63, ":%4d", channel[3]);
-   
+
    //Print the information how to use the program
    mvprintw(18, 2, "+/-: Switch to increase or decrease mode");
-   mvprintw(19, 2, "1-4:Change value of channel");
-   mvprintw(20, 2, "a:Change all channels");
+   if (attitude != NULL)
+   {
+       mvprintw(19, 2, "1-4:Thr,roll,pitch,yaw rate");
+       mvprintw(20, 2, "a:Change all of them");
+   }
+   else if (mixerName != NULL)
+   {
+       mvprintw(19, 2, "1-4:Throttle,roll,pitch,yaw");
+       mvprintw(20, 2, "a:Change all of them");
+   }
+   else
+   {
+       mvprintw(19, 2, "1-4:Change value of channel");
+       mvprintw(20, 2, "a:Change all channels");
+   }
    mvprintw(21, 2, "q: Quit");
-   
+   if (cfg.numSlaves > 1)
+       mvprintw(21, 30, "n: Next slave");
+   if (strncmp(cfg.device[0], "emu", 3) == 0)
+       mvprintw(19, 30, "e: Stall the bus");
+
+   //Everything else is drawn by the next printScreen()
+   for (i = 0; i < 4; i++)
+   {
+       shown.bar[i] = 0;
+       shown.value[i] = -1;
+   }
+   shown.failed = -1;
+   shown.selected = -1;
+   shown.maxSkew = -1;
+   shown.retries = -1;
+   shown.stick.throttle = -1;
+   shown.overruns = -1;
+   shown.utilization = -1;
+   memset(shown.latency, 0xff, sizeof(shown.latency));
    refresh();
 }
-      
+
+/*!
+ \brief  Update the ncurses ui-screen
+
+ Only the bars and numbers which changed since the last call are drawn.
+ Called with at most UI_RATE by the screen timer.
+*/
+void printScreen()
+{
+   int i, y, len;
+   int changed = FALSE;
+   copterStats_t stats;
+   attitudeStats_t att;
+   latency_t *lat = &stats.writeLatency;
+
+   copterStats(copter, &stats);
+
+   if (shown.failed != stats.failed || shown.lastError != stats.lastError ||
+       shown.missedTicks != stats.missedTicks || shown.coalesced != stats.coalesced ||
+       shown.verifyFailures != stats.verifyFailures)
+   {
+       shown.verifyFailures = stats.verifyFailures;
+       shown.failed = stats.failed;
+       shown.lastError = stats.lastError;
+       shown.missedTicks = stats.missedTicks;
+       shown.coalesced = stats.coalesced;
+       move(0, 0);
+       clrtoeol();
+       mvprintw(0, 2, "missed writes: %d \t %d \t missed ticks: %d \t coalesced: %lu",
+                shown.failed, shown.lastError, shown.missedTicks, shown.coalesced);
+       if (cfg.verify)
+           mvprintw(1, 2, "verify failures: %d", shown.verifyFailures);
+       changed = TRUE;
+   }
+
+   if (shown.selected != selected || shown.slaveFailures != stats.slaveFailures[selected])
+   {
+       shown.selected = selected;
+       shown.slaveFailures = stats.slaveFailures[selected];
+       mvprintw(1, 30, "slave %d:0x%02x (%d/%d), failures: %d ", cfg.slaveBus[selected],
+                cfg.slaveAddr[selected], selected + 1, cfg.numSlaves, shown.slaveFailures);
+       changed = TRUE;
+   }
+
+   if (cfg.numBuses > 1 && shown.maxSkew != stats.maxSkew / 1000)
+   {
+       shown.maxSkew = stats.maxSkew / 1000;
+       mvprintw(1, 64, "max skew: %ld us ", shown.maxSkew);
+       changed = TRUE;
+   }
+
+   if (shown.retries != stats.retries || shown.lostUpdates != stats.lostUpdates ||
+       shown.recoveries != stats.recoveries || shown.lastRecovery != stats.lastRecovery)
+   {
+       shown.retries = stats.retries;
+       shown.lostUpdates = stats.lostUpdates;
+       shown.recoveries = stats.recoveries;
+       shown.lastRecovery = stats.lastRecovery;
+       mvprintw(18, 50, "retries: %lu lost: %lu ", shown.retries, shown.lostUpdates);
+       mvprintw(19, 50, "bus recoveries: %d ", shown.recoveries);
+       mvprintw(20, 50, "recovered in %.1f ms (max %.1f) ", shown.lastRecovery / 1e6, stats.maxRecovery / 1e6);
+       changed = TRUE;
+   }
+
+   if (attitude != NULL)
+   {
+       attitudeStats(attitude, &att);
+       if (memcmp(&stick, &shown.stick, sizeof(stick)) != 0 || shown.overruns != att.overruns ||
+           memcmp(att.error, shown.error, sizeof(att.error)) != 0)
+       {
+           shown.stick = stick;
+           shown.overruns = att.overruns;
+           memcpy(shown.error, att.error, sizeof(att.error));
+           move(17, 0);
+           clrtoeol();
+           mvprintw(17, 2, "thr %4d  roll %+5.1f  pitch %+5.1f  yaw %+6.1f/s  error %+5.1f %+5.1f %+6.1f  overruns %lu",
+                    stick.throttle, stick.roll * (attitudeCfg.maxAngle / 1e3) / MIXER_ONE,
+                    stick.pitch * (attitudeCfg.maxAngle / 1e3) / MIXER_ONE, stick.yaw * (attitudeCfg.maxYawRate / 1e3) / MIXER_ONE,
+                    att.error[ATT_ROLL] / 1e3, att.error[ATT_PITCH] / 1e3, att.error[ATT_YAW] / 1e3, att.overruns);
+           changed = TRUE;
+       }
+   }
+   else if (mixerName != NULL && memcmp(&stick, &shown.stick, sizeof(stick)) != 0)
+   {
+       shown.stick = stick;
+       mvprintw(17, 2, "%s: throttle %5d  roll %5d  pitch %5d  yaw %5d  desaturated %lu ", mixerName,
+                stick.throttle, stick.roll, stick.pitch, stick.yaw, mixer.desaturated);
+       changed = TRUE;
+   }
+
+   for (i = 0; i < 2; i++)
+   {
+       if (memcmp(&lat[i], &shown.latency[i], sizeof(latency_t)) != 0)
+       {
+           shown.latency[i] = lat[i];
+           move(22 + i, 0);
+           clrtoeol();
+           mvprintw(22 + i, 2, "bus %-5s p50 %7.1f  p99 %7.1f  p99.9 %7.1f  max %8.1f us  (%d)",
+                    i == 0 ? "write" : "read", lat[i].p50 / 1e3, lat[i].p99 / 1e3,
+                    lat[i].p999 / 1e3, lat[i].max / 1e3, lat[i].samples);
+           changed = TRUE;
+       }
+   }
+
+   if (imu != NULL || pollRate > 0)
+   {
+       busScheduleStats_t sched;
+
+       copterBusSchedule(copter, 0, &sched);
+       if (shown.utilization != sched.utilization)
+       {
+           shown.utilization = sched.utilization;
+           mvprintw(21, 50, "bus %.1f %% (max %.1f %%) ", sched.utilization / 10.0, sched.maxUtilization / 10.0);
+           changed = TRUE;
+       }
+   }
+
+   for (i = 0; i < 4; i++)
+   {
+       y = 4 + 4*i;
+       //calculate the length of the bar, draw the new one and clear the rest of the old one
+       len = LENGTH*channel[selected][i]/MAX_DUTY_CYCLE;
+       if (len != shown.bar[i])
+       {
+           attron(COLOR_PAIR(1) | A_INVIS);
+           mvprintw(y, 5, "%s", &row[LENGTH - len]);
+           attroff(COLOR_PAIR(1) | A_INVIS);
+           if (len < shown.bar[i])
+               mvhline(y, 5 + len, ' ', shown.bar[i] - len);
+           shown.bar[i] = len;
+           shown.value[i] = -1;   // a long bar covers the number
+       }
+       if (channel[selected][i] != shown.value[i])
+       {
+           shown.value[i] = channel[selected][i];
+           mvprintw(y, 63, ":%4d", shown.value[i]);
+           changed = TRUE;
+       }
+   }
+
+   if (changed == TRUE)
+       refresh();
+}
+
+/*!
+ \brief Handler for stdin: process all pending key presses
+
+ \param fd stdin
+ \param arg unused
+*/
+void onKey(int fd, void *arg)
+{
+    int ch;
+
+    while ((ch = getch()) != ERR)
+    {
+        switch(ch)
+        {
+        case '+': increment = 32; break;
+        case '-': increment = -32; break;
+        case '1': changeChannel(0, increment); break;
+        case '2': changeChannel(1, increment); break;
+        case '3': changeChannel(2, increment); break;
+        case '4': changeChannel(3, increment); break;
+        case 'a': changeChannel(-1, increment); break;
+        case 'n': selected = (selected + 1) % cfg.numSlaves; break;
+        case 'e': emulatorStall(copterBus(copter, cfg.slaveBus[selected]), STALL_TIME); break;    // no effect without the emulator
+        case 'q': eventLoopStop(&ui); break;
+        }
+    }
+    // the screen is updated by the screen timer
+}
+
+/*!
+ \brief Handler for the gamepad: submit the newest report of the sticks
+
+ Without a mixer the sticks set the 4 channels of the selected slave (the throttle from
+ 0, the other axes around the middle of the duty cycle).
+
+ \param fd the gamepad
+ \param arg unused
+*/
+void onGamepad(int fd, void *arg)
+{
+    int *axis[4] = {&stick.throttle, &stick.roll, &stick.pitch, &stick.yaw};
+    long long time;
+    int i, result;
+
+    result = gamepadRead(gamepad, &stick, &time);
+    if (result == -1)
+    {
+        eventLoopRemove(&ui, fd);   // unplugged or the replay ended, the keys still work
+        return;
+    }
+    if (result == 0)
+        return;
+    if (mixerName != NULL)
+    {
+        submitStick(time);
+        return;
+    }
+    for (i = 0; i < 4; i++)
+        channel[selected][i] = i == 0 ? stick.throttle * MAX_DUTY_CYCLE / MIXER_ONE :
+                                        (*axis[i] + MIXER_ONE) * MAX_DUTY_CYCLE / (2 * MIXER_ONE);
+    copterSubmitInput(copter, selected, 1, &channel[selected], time);
+}
+
+/*!
+ \brief Handler for the screen timer: draw everything which changed since the last tick
+
+ \param fd the timerfd
+ \param arg unused
+*/
+void onScreenTimer(int fd, void *arg)
+{
+    uint64_t expirations;
+
+    if (read(fd, &expirations, sizeof(expirations)) == sizeof(expirations))
+        printScreen();
+}
+
+/*!
+ \brief Handler for the signalfd: stop the program
+
+ \param fd the signalfd
+ \param arg unused
+*/
+void onSignal(int fd, void *arg)
+{
+    struct signalfd_siginfo info;
+
+    if (read(fd, &info, sizeof(info)) == sizeof(info))
+        eventLoopStop(&ui);
+}
+
 /*!
  \brief  main program of the master
 
- Sets up the I2C device and ncurses ui.
+ Sets up the bus and ncurses ui.
  Reacts on the user input.
 
  \param argc
@@ -177,19 +1196,265 @@ int main(int argc, char *argv[])
 {
    int ch = 0;
    int i;
+   int signalFd, screenFd;
+   char *arg, *end;
+   sigset_t signals;
+   pthread_attr_t controlAttr, attitudeAttr;
+   int safe[COPTER_MAX_SLAVES][4];   // setpoints of the server when no source is active
+   copterStats_t stats;
+   gamepadStats_t pad;
+   static const struct option longOptions[] =
+   {
+       {"realtime", no_argument,       NULL, 'R'},
+       {"cpu",      required_argument, NULL, 'c'},
+       {"daemon",   optional_argument, NULL, 'D'},
+       {"telemetry", optional_argument, NULL, 'T'},
+       {"monitor",  optional_argument, NULL, 'M'},
+       {"stream",   required_argument, NULL, 'S'},
+       {"binary",   no_argument,       NULL, OPT_BINARY},
+       {"timed",    no_argument,       NULL, OPT_TIMED},
+       {"record",   required_argument, NULL, 'L'},
+       {"replay",   required_argument, NULL, 'P'},
+       {"mixer",    required_argument, NULL, 'm'},
+       {"attitude", optional_argument, NULL, 'A'},
+       {"imu",      optional_argument, NULL, OPT_IMU},
+       {"poll",     optional_argument, NULL, OPT_POLL},
+       {"gamepad",  required_argument, NULL, 'g'},
+       {"methods",  no_argument,       NULL, OPT_METHODS},
+       {"stress",   optional_argument, NULL, OPT_STRESS},
+       {NULL, 0, NULL, 0}
+   };
+
+   copterDefaults(&cfg);
+   while ((ch = getopt_long(argc, argv, "d:a:spvr:u:b:Rc:B:D::T::M::S:L:P:m:A::g:", longOptions, NULL)) != -1)
+   {
+       switch (ch)
+       {
+       case 'a':
+           for (cfg.numSlaves = 0, arg = strtok(optarg, ","); arg != NULL && cfg.numSlaves < COPTER_MAX_SLAVES;
+                arg = strtok(NULL, ","), cfg.numSlaves++)
+           {
+               // "<bus>:<address>" selects the bus of the slave
+               cfg.slaveAddr[cfg.numSlaves] = strtol(arg, &end, 0);
+               cfg.slaveBus[cfg.numSlaves] = 0;
+               if (*end == ':')
+               {
+                   cfg.slaveBus[cfg.numSlaves] = cfg.slaveAddr[cfg.numSlaves];
+                   cfg.slaveAddr[cfg.numSlaves] = strtol(end + 1, NULL, 0);
+               }
+           }
+           break;
+       case 's': cfg.sync = 1; break;
+       case 'p': cfg.packed = 1; break;
+       case 'v': cfg.verify = 1; break;
+       case 'r': cfg.rate = atoi(optarg); break;
+       case 'd':
+           for (cfg.numBuses = 0, arg = strtok(optarg, ","); arg != NULL && cfg.numBuses < COPTER_MAX_BUSES;
+                arg = strtok(NULL, ","))
+               cfg.device[cfg.numBuses++] = arg;
+           break;
+       case 'u': cfg.device[0] = optarg; cfg.numBuses = 1; cfg.serial = 1; break;
+       case 'b': cfg.baud = atoi(optarg); break;
+       case 'R': cfg.realtime = 1; break;
+       case 'c': cfg.cpu = atoi(optarg); break;
+       case 'B': benchmarkCount = atol(optarg); break;
+       case 'D': serverName = optarg != NULL ? optarg : INGEST_NAME; break;
+       case 'T': telemetryName = optarg != NULL ? optarg : TELEMETRY_NAME; break;
+       case 'M': monitorName = optarg != NULL ? optarg : TELEMETRY_NAME; break;
+       case 'S': streamFile = optarg; break;
+       case OPT_BINARY: streamBinary = TRUE; break;
+       case OPT_TIMED: streamTimed = TRUE; break;
+       case 'L':
+           // "<file>:<MB>" sets the size of the ring file
+           recordFile = optarg;
+           if ((arg = strrchr(optarg, ':')) != NULL)
+           {
+               *arg = '\0';
+               recordSize = atoi(arg + 1);
+           }
+           break;
+       case 'P': replayFile = optarg; break;
+       case 'A': attitudeRate = optarg != NULL ? atoi(optarg) : ATTITUDE_RATE; break;
+       case OPT_IMU: imuRate = optarg != NULL ? atoi(optarg) : IMU_RATE; break;
+       case OPT_POLL: pollRate = optarg != NULL ? atoi(optarg) : POLL_RATE; break;
+       case 'g': gamepadPath = optarg; break;
+       case OPT_METHODS: benchmarkMethods = TRUE; break;
+       case OPT_STRESS:
+           stressRate = optarg != NULL ? atol(optarg) : STRESS_RATE;
+           cfg.verify = 1;      // every update is read back
+           break;
+       case 'm':
+           // "<geometry>:<idle>" sets the duty cycle of an idling motor
+           mixerName = strtok(optarg, ":");
+           arg = strtok(NULL, ":");
+           if (mixerInit(&mixer, mixerGeometry(mixerName), arg != NULL ? atoi(arg) : MIXER_IDLE) != 0)
+           {
+               printf("Unknown mixer %s or idle duty cycle out of range\n", mixerName);
+               exit(1);
+           }
+           break;
+       default:
+           printf("Usage: %s [-d device] [-a address] [-s] [-p] [-v] [-r rate] [-u serialport] [-b baud]\n"
+                  "         [-R [-c cpu]] [-B count [--methods] [--stress[=rate]]] [-D[name]] [-T[name]]\n"
+                  "         [-M[name]] [-S file [--binary] [--timed]] [-L file[:MB]] [-P file [--timed]]\n"
+                  "         [-m geometry[:idle] [-A[rate]]] [--imu[=rate]] [--poll[=rate]] [-g device]\n", argv[0]);
+           exit(1);
+       }
+   }
+   if (cfg.numSlaves == 0 || cfg.numBuses == 0)
+   {
+       printf("No slave address or bus given\n");
+       exit(1);
+   }
+   for (i = 0; i < cfg.numSlaves; i++)
+   {
+       if (cfg.slaveBus[i] < 0 || cfg.slaveBus[i] >= cfg.numBuses)
+       {
+           printf("The slave 0x%02x is on bus %d, but only %d buses are given\n", cfg.slaveAddr[i], cfg.slaveBus[i], cfg.numBuses);
+           exit(1);
+       }
+   }
+   if (cfg.rate < 0 || cfg.rate > 1000)
+   {
+       printf("The rate must be between 1 and 1000 Hz (or 0)\n");
+       exit(1);
+   }
+
+   if (mixerName != NULL && mixer.numMotors > 4 * cfg.numSlaves)
+   {
+       printf("The mixer %s needs %d motors, but only %d slaves are given\n", mixerName, mixer.numMotors, cfg.numSlaves);
+       exit(1);
+   }
+
+   if (attitudeRate != 0 && (mixerName == NULL || attitudeRate < 1 || attitudeRate > ATTITUDE_MAX_RATE))
+   {
+       printf("The attitude loop needs a mixer (-m) and a rate between 1 and %d Hz\n", ATTITUDE_MAX_RATE);
+       exit(1);
+   }
+
+   if (imuRate < 0 || imuRate > IMU_MAX_RATE || pollRate < 0 || pollRate > 1000)
+   {
+       printf("The IMU needs a rate between 1 and %d Hz, the polls between 1 and 1000 Hz\n", IMU_MAX_RATE);
+       exit(1);
+   }
+
+   if (stressRate != 0 && (benchmarkCount <= 0 || stressRate < 1 || stressRate > STRESS_MAX_RATE))
+   {
+       printf("The stress mode needs the number of updates per step (-B count) and a rate between 1 and %d updates/s\n", STRESS_MAX_RATE);
+       exit(1);
+   }
+
+   if (monitorName != NULL)
+       return monitor() == TRUE ? 0 : 1;
+
+   //Initialize the buses and the slaves
+   copter = copterOpen(&cfg);
+   if (copter == NULL)
+   {
+       printf("Initializing the buses %s... failed: %s\n", cfg.device[0], strerror(errno));
+       exit (1);
+   }
+   if (telemetryName != NULL && copterExport(copter, telemetryName) != 0)
+   {
+       printf("Exporting the telemetry in %s failed: %s\n", telemetryName, strerror(errno));
+       copterClose(copter);
+       exit (1);
+   }
+   if (recordFile != NULL && copterRecord(copter, recordFile, recordSize) != 0)
+   {
+       printf("Recording in %s failed: %s\n", recordFile, strerror(errno));
+       copterClose(copter);
+       exit (1);
+   }
+   if ((imuRate > 0 || pollRate > 0) && devicesStart() != TRUE)
+   {
+       devicesStop();
+       copterClose(copter);
+       exit (1);
+   }
+   if (benchmarkCount > 0)
+   {
+       if (mixerName != NULL)
+           benchmarkMixer();
+       if (stressRate > 0)
+           ch = stress();
+       else
+           ch = benchmarkMethods == TRUE ? benchmarkMethod() : benchmark();
+       devicesStop();
+       printLatency();
+       printSchedule();
+       copterStats(copter, &stats);
+       printHealth(&stats);
+       copterClose(copter);
+       printRecording();
+       return ch == TRUE ? 0 : 1;
+   }
+   if (streamFile != NULL || replayFile != NULL)
+   {
+       ch = stream();
+       devicesStop();
+       printSummary();
+       copterClose(copter);
+       printRecording();
+       return ch == TRUE ? 0 : 1;
+   }
+   if (serverName != NULL)
+   {
+       if (cfg.realtime && realtimeInit(&controlAttr) != TRUE)
+           exit (1);
+       memset(safe, 0, sizeof(safe));     // the motors stop when all sources are released
+       for (i = 0; mixerName != NULL && i < mixer.numMotors; i++)
+           safe[i / 4][i % 4] = mixer.idle;
+       copterSend(copter, (const int (*)[4])channel);
+       if (copterStart(copter, cfg.realtime ? &controlAttr : NULL) != 0 ||
+           serverRun(copter, serverName, cfg.numSlaves, (const int (*)[4])safe) != 0)
+       {
+           printf("Failed to run the server %s: %s\n", serverName, strerror(errno));
+           devicesStop();
+           copterClose(copter);
+           exit(1);
+       }
+       devicesStop();
+       printSummary();
+       copterClose(copter);
+       printRecording();
+       return 0;
+   }
+
+   //Signals are only received via the signalfd (the mask is inherited by all threads)
+   sigemptyset(&signals);
+   sigaddset(&signals, SIGINT);
+   sigaddset(&signals, SIGTERM);
+   sigaddset(&signals, SIGHUP);
+   sigaddset(&signals, SIGQUIT);
+   pthread_sigmask(SIG_BLOCK, &signals, NULL);
+   signalFd = signalfd(-1, &signals, SFD_CLOEXEC);
+   screenFd = periodicTimer(1000000000L / UI_RATE);
+   if (signalFd == -1 || screenFd == -1 || eventLoopInit(&ui) != 0 ||
+       eventLoopAdd(&ui, STDIN_FILENO, onKey, NULL) != 0 ||
+       eventLoopAdd(&ui, signalFd, onSignal, NULL) != 0 ||
+       eventLoopAdd(&ui, screenFd, onScreenTimer, NULL) != 0)
+   {
+       printf("Failed to initialize the event loop\n");
+       exit(1);
+   }
+   if (gamepadPath != NULL &&
+       ((gamepad = gamepadOpen(gamepadPath)) == NULL || eventLoopAdd(&ui, gamepadFd(gamepad), onGamepad, NULL) != 0))
+   {
+       printf("Failed to open the gamepad %s: %s\n", gamepadPath, strerror(errno));
+       exit(1);
+   }
 
    //initialize an array of '#' which determines the maximum length of a bar
    for (i = 0; i<LENGTH+1; i++)
 	 row[i] = '#';
    row[0] = 'a';
    row[LENGTH] = '\0';
-   
-   //Initialize I2C-device
-   if (I2Cinit() != TRUE)
-   {
-       printf("Initializing I2C interface failed\n");
+
+
+   //Everything is allocated, harden the process before the motors are armed
+   if (cfg.realtime && realtimeInit(&controlAttr) != TRUE)
        exit (1);
-   }
 
    //Initialize ncurses
    initscr();
@@ -202,38 +1467,62 @@ int main(int argc, char *argv[])
    init_pair(1, COLOR_BLUE, COLOR_BLUE);
    cbreak();
    noecho();
+   nodelay(stdscr, TRUE);   // getch() is only called when stdin is readable
     
-   //Initialize the duty cycles of the slave
-   setAllChannels();
+   //Initialize the duty cycles of the slave and start the control thread
+   copterSend(copter, (const int (*)[4])channel);
+   if (copterStart(copter, cfg.realtime ? &controlAttr : NULL) != 0)
+   {
+       endwin();
+       printf("Failed to start the control thread\n");
+       exit(1);
+   }
+   if (attitudeRate > 0)
+   {
+       attitudeDefaults(&attitudeCfg);
+       attitudeCfg.rate = attitudeRate;
+       attitude = attitudeOpen(copter, &mixer, &attitudeCfg);
+       if (cfg.realtime && realtimeAttr(&attitudeAttr, attitudeCpu(), RT_ATTITUDE_PRIORITY) != 0)
+       {
+           endwin();
+           printf("Invalid CPU %d for the attitude loop\n", attitudeCpu());
+           exit(1);
+       }
+       if (attitude == NULL || attitudeStart(attitude, cfg.realtime ? &attitudeAttr : NULL) != 0 ||
+           (plant = plantOpen(attitude, &mixer)) == NULL)
+       {
+           endwin();
+           printf("Failed to start the attitude loop: %s\n", strerror(errno));
+           exit(1);
+       }
+   }
+   screenInit();
    printScreen();
 
-   int inc = 1;
-
-   //Wait for user input
-   while(ch != 'q')
-   {
-	 ch = getch();
-	 switch(ch)
-	 {
-         case '+':inc = 32; break;
-         case '-':inc = -32; break;
-		 case '1': channel[0]+=inc; 
-                   setSingleChannel(0); break;
-		 case '2': channel[1]+=inc;
-                   setSingleChannel(1); break;
-		 case '3': channel[2]+=inc;
-                   setSingleChannel(2); break;
-		 case '4': channel[3]+=inc;
-                   setSingleChannel(3); break;
-		 case 'a': channel[0]+=inc; 
-				   channel[1]+=inc; 
-				   channel[2]+=inc; 
-				   channel[3]+=inc; 
-                   setAllChannels();    break;
-     }
-     printScreen();
-   }
+   //React on user input, screen updates and signals until 'q' or a signal stops the loop
+   eventLoopRun(&ui);
+
    endwin();  //Stop ncurses
+   eventLoopClose(&ui);
+   close(screenFd);
+   close(signalFd);
+   if (gamepad != NULL)
+   {
+       gamepadStats(gamepad, &pad);
+       printf("Gamepad %s: %lu events, %lu reports, %lu overflows\n", gamepadPath, pad.events, pad.reports, pad.dropped);
+       gamepadClose(gamepad);
+   }
+
+   if (attitude != NULL)
+   {
+       plantClose(plant);
+       printAttitude();
+       attitudeClose(attitude);
+   }
+   devicesStop();
+   printSummary();
+   copterClose(copter);
+   printRecording();
    
    return 0;
 }
@@ -0,0 +1,113 @@
+/**
+    @file src-master/mixer.c
+    @brief fixed-point motor mixer: throttle, roll, pitch and yaw to the duty cycles of the motors
+    @author Jan Sommer
+*/
+
+#include <string.h>
+#include <errno.h>
+#include "mixer.h"
+#include "slave.h"
+
+#define Q(x)    ((int)((x) * MIXER_ONE + ((x) < 0 ? -0.5 : 0.5)))   ///< fixed point of a constant
+
+/**
+    @brief roll, pitch and yaw factors of the motors of a geometry
+*/
+static const struct
+{
+    const char *name;
+    int numMotors;
+    int factor[MIXER_MAX_MOTORS][3];
+} geometries[MIXER_GEOMETRIES] =
+{
+    [MIXER_QUAD_X] = {"quad-x", 4, {
+        {Q(-1.0), Q( 1.0), Q( 1.0)},    // front right
+        {Q(-1.0), Q(-1.0), Q(-1.0)},    // rear right
+        {Q( 1.0), Q(-1.0), Q( 1.0)},    // rear left
+        {Q( 1.0), Q( 1.0), Q(-1.0)}}},  // front left
+    [MIXER_QUAD_PLUS] = {"quad-+", 4, {
+        {Q( 0.0), Q( 1.0), Q( 1.0)},    // front
+        {Q(-1.0), Q( 0.0), Q(-1.0)},    // right
+        {Q( 0.0), Q(-1.0), Q( 1.0)},    // rear
+        {Q( 1.0), Q( 0.0), Q(-1.0)}}},  // left
+    [MIXER_HEX_X] = {"hex", 6, {
+        {Q(-0.5), Q( 0.866), Q( 1.0)},  // front right
+        {Q(-1.0), Q( 0.0),   Q(-1.0)},  // right
+        {Q(-0.5), Q(-0.866), Q( 1.0)},  // rear right
+        {Q( 0.5), Q(-0.866), Q(-1.0)},  // rear left
+        {Q( 1.0), Q( 0.0),   Q( 1.0)},  // left
+        {Q( 0.5), Q( 0.866), Q(-1.0)}}} // front left
+};
+
+/*!
+ \brief Limit a value to the range lo..hi
+*/
+static inline int clamp(int v, int lo, int hi)
+{
+    return v < lo ? lo : v > hi ? hi : v;
+}
+
+int mixerGeometry(const char *name)
+{
+    int g;
+
+    for (g = 0; g < MIXER_GEOMETRIES; g++)
+        if (strcmp(name, geometries[g].name) == 0)
+            return g;
+    return -1;
+}
+
+int mixerInit(mixer_t *m, mixerGeometry_t geometry, int idle)
+{
+    if (geometry < 0 || geometry >= MIXER_GEOMETRIES || idle < 0 || idle > MAX_DUTY_CYCLE)
+    {
+        errno = EINVAL;
+        return -1;
+    }
+    memset(m, 0, sizeof(mixer_t));
+    m->numMotors = geometries[geometry].numMotors;
+    memcpy(m->factor, geometries[geometry].factor, sizeof(m->factor));
+    m->idle = idle;
+    m->span = MAX_DUTY_CYCLE - idle;
+    return 0;
+}
+
+void mixerRun(mixer_t *m, const mixerInput_t *in, int value[][4])
+{
+    int mix[MIXER_MAX_MOTORS];
+    int roll = clamp(in->roll, -MIXER_ONE, MIXER_ONE);
+    int pitch = clamp(in->pitch, -MIXER_ONE, MIXER_ONE);
+    int yaw = clamp(in->yaw, -MIXER_ONE, MIXER_ONE);
+    int throttle = clamp(in->throttle, 0, MIXER_ONE);
+    int i, lo = 0, hi = 0, scale, shifted, saturated;
+
+    // differential thrust of every motor, Q12 * Q12 products fit easily into an int
+    for (i = 0; i < m->numMotors; i++)
+    {
+        mix[i] = (roll * m->factor[i][0] + pitch * m->factor[i][1] + yaw * m->factor[i][2]) >> MIXER_SHIFT;
+        if (i == 0 || mix[i] < lo)
+            lo = mix[i];
+        if (i == 0 || mix[i] > hi)
+            hi = mix[i];
+    }
+
+    // more differential thrust than the range of the motors: scale the attitude down
+    saturated = hi - lo > MIXER_ONE;
+    if (saturated)
+    {
+        scale = (MIXER_ONE << 16) / (hi - lo);  // Q16, the only division
+        for (i = 0; i < m->numMotors; i++)
+            mix[i] = (mix[i] * scale) >> 16;
+        lo = (lo * scale) >> 16;
+        hi = (hi * scale) >> 16;
+    }
+
+    // shift the throttle so that the weakest and the strongest motor are in range
+    shifted = clamp(throttle, -lo, MIXER_ONE - hi);
+    if (saturated || shifted != throttle)
+        m->desaturated++;
+    for (i = 0; i < m->numMotors; i++)
+        value[i / 4][i % 4] = clamp(m->idle + (((shifted + mix[i]) * m->span) >> MIXER_SHIFT), 0, MAX_DUTY_CYCLE);
+    m->ticks++;
+}
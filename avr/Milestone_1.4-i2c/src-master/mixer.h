@@ -0,0 +1,90 @@
+/**
+    @file src-master/mixer.h
+    @brief fixed-point motor mixer: throttle, roll, pitch and yaw to the duty cycles of the motors
+    @author Jan Sommer
+
+    The inputs are Q12 fixed-point values (MIXER_ONE == 1.0): throttle 0..MIXER_ONE,
+    roll, pitch and yaw -MIXER_ONE..MIXER_ONE. Positive roll lowers the right side,
+    positive pitch raises the nose, positive yaw turns the nose to the right.
+
+    The motors are numbered clockwise (seen from above) starting with the first motor
+    right of the nose, the first motor spins counter-clockwise and the direction
+    alternates. Motor m is channel m % 4 of slave m / 4.
+
+    Desaturation: if the differences of roll, pitch and yaw exceed the range of the
+    motors they are scaled down together, then the throttle is shifted as little as
+    possible so that every motor is in range. The attitude always has priority over
+    the throttle (even at zero throttle the motors keep the authority to level).
+*/
+
+#ifndef MIXER_H
+#define MIXER_H
+
+#define MIXER_SHIFT         12                  ///< fraction bits of the fixed-point values
+#define MIXER_ONE           (1 << MIXER_SHIFT)  ///< 1.0 in fixed point
+#define MIXER_MAX_MOTORS    8                   ///< Maximum number of motors of a geometry
+
+/**
+    @brief the supported frames
+*/
+typedef enum
+{
+    MIXER_QUAD_X,       ///< 4 motors, the nose between the first and the last motor
+    MIXER_QUAD_PLUS,    ///< 4 motors, the first motor at the nose
+    MIXER_HEX_X,        ///< 6 motors, the nose between the first and the last motor
+    MIXER_GEOMETRIES    ///< number of geometries
+} mixerGeometry_t;
+
+/**
+    @brief the commands of the pilot or the attitude controller (fixed point)
+*/
+typedef struct
+{
+    int throttle;       ///< 0..MIXER_ONE
+    int roll;           ///< -MIXER_ONE..MIXER_ONE
+    int pitch;          ///< -MIXER_ONE..MIXER_ONE
+    int yaw;            ///< -MIXER_ONE..MIXER_ONE
+} mixerInput_t;
+
+/**
+    @brief a mixer for one geometry
+*/
+typedef struct
+{
+    int numMotors;                          ///< number of motors
+    int factor[MIXER_MAX_MOTORS][3];        ///< roll, pitch and yaw factor of each motor (fixed point)
+    int idle;                               ///< duty cycle of a motor at zero thrust
+    int span;                               ///< duty cycles from idle to full thrust
+    unsigned long ticks;                    ///< number of mixed inputs
+    unsigned long desaturated;              ///< inputs whose attitude or throttle had to be reduced
+} mixer_t;
+
+/*!
+ \brief Find a geometry by its name ("quad-x", "quad-+", "hex")
+
+ \return int the mixerGeometry_t or -1 if the name is unknown
+*/
+int mixerGeometry(const char *name);
+
+/*!
+ \brief Set up the mixer of a geometry
+
+ \param m the mixer
+ \param geometry the frame
+ \param idle the duty cycle of a motor at zero thrust (0..MAX_DUTY_CYCLE)
+ \return int 0 if successful otherwise -1 (errno is set)
+*/
+int mixerInit(mixer_t *m, mixerGeometry_t geometry, int idle);
+
+/*!
+ \brief Mix the inputs to the duty cycles of the motors
+
+ Only integer arithmetic, no division unless the attitude saturates the motors.
+
+ \param m the mixer
+ \param in the inputs (out of range values are clamped)
+ \param value the duty cycles 0..MAX_DUTY_CYCLE of the motors (the channels of (numMotors + 3) / 4 slaves)
+*/
+void mixerRun(mixer_t *m, const mixerInput_t *in, int value[][4]);
+
+#endif // MIXER_H
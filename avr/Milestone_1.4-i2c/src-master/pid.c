@@ -0,0 +1,46 @@
+/**
+    @file src-master/pid.c
+    @brief fixed-point PID controller with a fixed rate
+    @author Jan Sommer
+*/
+
+#include "pid.h"
+
+/*!
+ \brief Limit a value to the range -limit..limit
+*/
+static inline long long limitTo(long long v, long long limit)
+{
+    return v < -limit ? -limit : v > limit ? limit : v;
+}
+
+void pidInit(pidController_t *p, const pidGains_t *gains, int rate)
+{
+    p->gains = *gains;
+    p->rate = rate;
+    pidReset(p);
+}
+
+void pidReset(pidController_t *p)
+{
+    p->integral = 0;
+    p->last = 0;
+    p->started = 0;
+}
+
+int pidRun(pidController_t *p, int setpoint, int measured)
+{
+    long long error = (long long)setpoint - measured;
+    long long out, derivative = 0;
+
+    // the sum is divided by the rate only for the output, a Q16 period (65536 / rate) would truncate
+    p->integral = limitTo(p->integral + p->gains.ki * error,
+                          ((long long)p->gains.limit << PID_SHIFT) * p->rate);
+    if (p->started)
+        derivative = -(((long long)p->gains.kd * ((long long)measured - p->last) * p->rate) >> PID_SHIFT);
+    p->last = measured;
+    p->started = 1;
+
+    out = ((p->gains.kp * error) >> PID_SHIFT) + ((p->integral / p->rate) >> PID_SHIFT) + derivative;
+    return limitTo(out, p->gains.limit);
+}
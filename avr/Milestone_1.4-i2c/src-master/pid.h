@@ -0,0 +1,67 @@
+/**
+    @file src-master/pid.h
+    @brief fixed-point PID controller with a fixed rate
+    @author Jan Sommer
+
+    The gains are Q16 fixed-point values (PID_GAIN(1.0) == 65536), the products are
+    computed in 64 bit so the measurement may be in any integer unit (e.g. mdeg/s).
+    The integral is limited to the output limit (anti-windup), the derivative acts on
+    the measurement only so a step of the setpoint does not kick the output.
+*/
+
+#ifndef PID_H
+#define PID_H
+
+#define PID_SHIFT       16                                  ///< fraction bits of the gains
+#define PID_GAIN(x)     ((int)((x) * (1 << PID_SHIFT)))     ///< Q16 gain of a constant
+
+/**
+    @brief the gains of a controller
+*/
+typedef struct
+{
+    int kp;         ///< proportional gain (output per unit of the error, Q16)
+    int ki;         ///< integral gain (output per unit of the error and s, Q16)
+    int kd;         ///< derivative gain (output per unit of the error per s, Q16)
+    int limit;      ///< limit of the output and the integral term (-limit..limit)
+} pidGains_t;
+
+/**
+    @brief state of a controller
+*/
+typedef struct
+{
+    pidGains_t gains;       ///< the gains
+    int rate;               ///< rate of the controller in Hz
+    long long integral;     ///< sum of ki * error over the steps, the integral term is integral / rate (Q16)
+    int last;               ///< previous measurement for the derivative
+    int started;            ///< 0 until the first measurement
+} pidController_t;
+
+/*!
+ \brief Set up a controller (the integral starts at 0)
+
+ \param p the controller
+ \param gains the gains
+ \param rate the rate of pidRun() in Hz
+*/
+void pidInit(pidController_t *p, const pidGains_t *gains, int rate);
+
+/*!
+ \brief Clear the integral and the derivative (e.g. when the motors are disarmed)
+
+ \param p the controller
+*/
+void pidReset(pidController_t *p);
+
+/*!
+ \brief Run one step of the controller
+
+ \param p the controller
+ \param setpoint the wanted value
+ \param measured the measured value
+ \return int the output (-limit..limit)
+*/
+int pidRun(pidController_t *p, int setpoint, int measured);
+
+#endif // PID_H
@@ -0,0 +1,132 @@
+/**
+    @file src-master/plant.c
+    @brief simulated airframe: the sensor of the attitude loop when no real sensor is connected
+    @author Jan Sommer
+*/
+
+#include <stdlib.h>
+#include <unistd.h>
+#include <math.h>
+#include "plant.h"
+#include "realtime.h"
+
+/**
+    @brief state of the simulation
+*/
+struct plant
+{
+    attitude_t *attitude;                   ///< gets the samples
+    mailbox_t *motors;                      ///< the duty cycles of the attitude loop
+    const mixer_t *mixer;                   ///< geometry and idle duty cycle
+    pthread_t thread;                       ///< the simulation thread
+    volatile int running;                   ///< the thread runs until this is 0
+    int timerFd;                            ///< periodic timer of the steps
+    double thrust[MIXER_MAX_MOTORS];        ///< thrust of each motor (0..1)
+    double angle[ATT_AXES];                 ///< attitude in deg
+    double rate[ATT_AXES];                  ///< angular rate in deg/s
+    double time;                            ///< simulated time in s
+};
+
+/*!
+ \brief Integrate one step of PLANT_RATE
+*/
+static void plantStep(plant_t *p)
+{
+    const double dt = 1.0 / PLANT_RATE;
+    const mixer_t *m = p->mixer;
+    const int (*value)[4] = mailboxFront(p->motors);
+    double torque[ATT_AXES] = {0, 0, 0};
+    double mean = 0, accel;
+    int i, axis;
+
+    for (i = 0; i < m->numMotors; i++)
+    {
+        p->thrust[i] += ((double)(value[i / 4][i % 4] - m->idle) / m->span - p->thrust[i]) * dt / PLANT_MOTOR_TAU;
+        for (axis = 0; axis < ATT_AXES; axis++)
+            torque[axis] += (double)m->factor[i][axis] / MIXER_ONE * p->thrust[i];
+        mean += p->thrust[i] / m->numMotors;
+    }
+    p->time += dt;
+    if (mean < PLANT_LIFTOFF)
+    {
+        for (axis = 0; axis < ATT_AXES; axis++)
+            p->angle[axis] = p->rate[axis] = 0;     // on the ground
+        return;
+    }
+
+    // a center of gravity 3 % off to the right and a gust of 0.5 Hz
+    torque[ATT_ROLL] += 0.03 + 0.05 * sin(2 * M_PI * 0.5 * p->time);
+    torque[ATT_PITCH] += 0.02 * sin(2 * M_PI * 0.3 * p->time);
+    for (axis = 0; axis < ATT_AXES; axis++)
+    {
+        accel = (axis == ATT_YAW ? PLANT_YAW_ACCEL : PLANT_ACCEL) * torque[axis] - PLANT_DAMPING * p->rate[axis];
+        p->rate[axis] += accel * dt;
+        p->angle[axis] += p->rate[axis] * dt;
+    }
+}
+
+/*!
+ \brief Thread of the simulation: one step and one sample per expiration of the timer
+
+ \param arg the simulation
+ \return void* NULL
+*/
+static void *plantThread(void *arg)
+{
+    plant_t *p = arg;
+    sensorSample_t *s;
+    uint64_t expirations, i;
+    int axis;
+
+    while (p->running)
+    {
+        if (read(p->timerFd, &expirations, sizeof(expirations)) != sizeof(expirations))
+            continue;
+        mailboxFetch(p->motors);
+        for (i = 0; i < expirations; i++)
+            plantStep(p);
+
+        s = attitudeSensorBack(p->attitude);
+        s->time = nowNs();
+        for (axis = 0; axis < ATT_AXES; axis++)
+        {
+            s->angle[axis] = lround(p->angle[axis] * 1000);
+            s->rate[axis] = lround(p->rate[axis] * 1000);
+        }
+        attitudeSensorPublish(p->attitude);
+    }
+    return NULL;
+}
+
+plant_t *plantOpen(attitude_t *a, const mixer_t *mixer)
+{
+    plant_t *p = calloc(1, sizeof(plant_t));
+
+    if (p == NULL)
+        return NULL;
+    p->attitude = a;
+    p->motors = attitudeMotors(a);
+    p->mixer = mixer;
+    p->timerFd = periodicTimer(1000000000L / PLANT_RATE);
+    if (p->timerFd == -1)
+    {
+        free(p);
+        return NULL;
+    }
+    p->running = 1;
+    if (threadCreate(&p->thread, NULL, plantThread, p) != 0)
+    {
+        close(p->timerFd);
+        free(p);
+        return NULL;
+    }
+    return p;
+}
+
+void plantClose(plant_t *p)
+{
+    p->running = 0;
+    pthread_join(p->thread, NULL);
+    close(p->timerFd);
+    free(p);
+}
@@ -0,0 +1,46 @@
+/**
+    @file src-master/plant.h
+    @brief simulated airframe: the sensor of the attitude loop when no real sensor is connected
+    @author Jan Sommer
+
+    A thread integrates the rotation of a rigid airframe with PLANT_RATE Hz: the thrust of
+    every motor follows its newest duty cycle of the attitude loop @sa attitudeMotors with
+    the spin-up time constant PLANT_MOTOR_TAU and creates torques with the factors of the
+    mixer. A shifted center of gravity and a slow gust disturb the airframe while it flies
+    (mean thrust above PLANT_LIFTOFF), on the ground it stays level.
+    Every step publishes a sample for the attitude loop @sa attitudeSensorBack
+
+    The simulation uses floating point, it is not part of the control path.
+*/
+
+#ifndef PLANT_H
+#define PLANT_H
+
+#include "attitude.h"
+
+#define PLANT_RATE          2000    ///< Rate of the simulation and the sensor samples in Hz
+#define PLANT_MOTOR_TAU     0.015   ///< Time constant of the spin-up of a motor in s
+#define PLANT_ACCEL         2000.0  ///< Angular acceleration of roll and pitch per unit of torque in deg/s^2
+#define PLANT_YAW_ACCEL     500.0   ///< Angular acceleration of yaw per unit of torque in deg/s^2
+#define PLANT_DAMPING       1.0     ///< Damping of the rotation by the air in 1/s
+#define PLANT_LIFTOFF       0.2     ///< Mean thrust (0..1) above which the airframe flies
+
+typedef struct plant plant_t;
+
+/*!
+ \brief Start the simulation
+
+ \param a the attitude loop which gets the samples and whose motors drive the airframe
+ \param mixer the mixer of the attitude loop (geometry, idle duty cycle)
+ \return plant_t* the simulation or NULL on error (errno is set)
+*/
+plant_t *plantOpen(attitude_t *a, const mixer_t *mixer);
+
+/*!
+ \brief Stop the simulation and free it
+
+ \param p the simulation
+*/
+void plantClose(plant_t *p);
+
+#endif // PLANT_H
@@ -0,0 +1,207 @@
+/**
+    @file src-master/realtime.c
+    @brief real-time hardening of the master and a latency self-test
+    @author Jan Sommer
+*/
+
+#define _GNU_SOURCE
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <unistd.h>
+#include <sched.h>
+#include <malloc.h>
+#include <time.h>
+#include <sys/mman.h>
+#include <signal.h>
+#include <sys/timerfd.h>
+#include "realtime.h"
+
+#define RT_HEAP_SIZE    (1024 * 1024)   ///< Heap which is prefaulted and kept by malloc
+
+/**
+    @brief parameters and results of the self-test thread
+*/
+typedef struct
+{
+    int rate;
+    int samples;
+    long *latency;
+    int overruns;
+    int error;
+} selfTest_t;
+
+int realtimeLockMemory()
+{
+    char *heap;
+
+    if (mlockall(MCL_CURRENT | MCL_FUTURE) != 0)
+        return -1;
+
+    // Never give memory back to the system and never use mmap for malloc,
+    // so the prefaulted heap below is used for all later allocations
+    mallopt(M_TRIM_THRESHOLD, -1);
+    mallopt(M_MMAP_MAX, 0);
+    heap = malloc(RT_HEAP_SIZE);
+    if (heap == NULL)
+        return -1;
+    memset(heap, 0, RT_HEAP_SIZE);
+    free(heap);
+
+    realtimePrefaultStack();
+    return 0;
+}
+
+void realtimePrefaultStack()
+{
+    volatile unsigned char stack[RT_STACK_SIZE];
+    int i;
+
+    for (i = 0; i < RT_STACK_SIZE; i += 1024)
+        stack[i] = 0;
+    (void)stack[0];
+}
+
+int realtimeAttr(pthread_attr_t *attr, int cpu, int priority)
+{
+    struct sched_param param;
+    cpu_set_t cpus;
+
+    if (cpu < 0)
+        cpu = sysconf(_SC_NPROCESSORS_ONLN) - 1;
+    CPU_ZERO(&cpus);
+    CPU_SET(cpu, &cpus);
+    param.sched_priority = priority;
+
+    if (pthread_attr_init(attr) != 0 ||
+        pthread_attr_setinheritsched(attr, PTHREAD_EXPLICIT_SCHED) != 0 ||
+        pthread_attr_setschedpolicy(attr, SCHED_FIFO) != 0 ||
+        pthread_attr_setschedparam(attr, &param) != 0 ||
+        pthread_attr_setaffinity_np(attr, sizeof(cpus), &cpus) != 0 ||
+        pthread_attr_setstacksize(attr, 2 * RT_STACK_SIZE) != 0)
+        return -1;
+    return 0;
+}
+
+/*!
+ \brief Compare function for qsort
+*/
+static int compareLong(const void *a, const void *b)
+{
+    long x = *(const long *)a, y = *(const long *)b;
+    return (x > y) - (x < y);
+}
+
+/*!
+ \brief Thread of the self-test: wait for the timer ticks and store the latency of each wakeup
+
+ The timer is started at an absolute time, so the expected time of every tick is known.
+*/
+static void *selfTestThread(void *arg)
+{
+    selfTest_t *test = arg;
+    struct itimerspec period;
+    struct timespec start, now;
+    uint64_t expirations, ticks = 0;
+    long periodNs = 1000000000L / test->rate;
+    int i, tfd;
+
+    realtimePrefaultStack();
+    tfd = timerfd_create(CLOCK_MONOTONIC, 0);
+    if (tfd == -1)
+    {
+        test->error = 1;
+        return NULL;
+    }
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    start.tv_sec += 1;  // give the system some time to settle
+    period.it_interval.tv_sec  = 0;
+    period.it_interval.tv_nsec = periodNs;
+    period.it_value = start;
+    timerfd_settime(tfd, TFD_TIMER_ABSTIME, &period, NULL);
+
+    for (i = 0; i < test->samples; i++)
+    {
+        if (read(tfd, &expirations, sizeof(expirations)) != sizeof(expirations))
+        {
+            test->error = 1;
+            break;
+        }
+        clock_gettime(CLOCK_MONOTONIC, &now);
+        ticks += expirations;
+        test->overruns += expirations - 1;
+        // latency relative to the last expired tick
+        test->latency[i] = (now.tv_sec - start.tv_sec) * 1000000000L + (now.tv_nsec - start.tv_nsec)
+                           - (long)(ticks - 1) * periodNs;
+    }
+    close(tfd);
+    return NULL;
+}
+
+int realtimeSelfTest(pthread_attr_t *attr, int rate, int samples, latency_t *result)
+{
+    selfTest_t test = {rate, samples, NULL, 0, 0};
+    pthread_t thread;
+
+    test.latency = calloc(samples, sizeof(long));
+    if (test.latency == NULL)
+        return -1;
+    if (pthread_create(&thread, attr, selfTestThread, &test) != 0)
+    {
+        free(test.latency);
+        return -1;
+    }
+    pthread_join(thread, NULL);
+
+    if (test.error == 0)
+    {
+        qsort(test.latency, samples, sizeof(long), compareLong);
+        result->p50  = test.latency[samples / 2];
+        result->p99  = test.latency[(int)(samples * 0.99)];
+        result->p999 = test.latency[(int)(samples * 0.999)];
+        result->max  = test.latency[samples - 1];
+        result->samples  = samples;
+        result->overruns = test.overruns;
+    }
+    free(test.latency);
+    return test.error ? -1 : 0;
+}
+
+long long nowNs(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1000000000LL + ts.tv_nsec;
+}
+
+int periodicTimer(long periodNs)
+{
+    struct itimerspec period;
+    int tfd;
+
+    tfd = timerfd_create(CLOCK_MONOTONIC, TFD_CLOEXEC);
+    if (tfd == -1)
+        return -1;
+    period.it_interval.tv_sec  = periodNs / 1000000000L;
+    period.it_interval.tv_nsec = periodNs % 1000000000L;
+    period.it_value = period.it_interval;
+    if (timerfd_settime(tfd, 0, &period, NULL) != 0)
+    {
+        close(tfd);
+        return -1;
+    }
+    return tfd;
+}
+
+int threadCreate(pthread_t *thread, const pthread_attr_t *attr, void *(*start)(void *), void *arg)
+{
+    sigset_t all, old;
+    int result;
+
+    sigfillset(&all);
+    pthread_sigmask(SIG_SETMASK, &all, &old);   // inherited by the new thread
+    result = pthread_create(thread, attr, start, arg);
+    pthread_sigmask(SIG_SETMASK, &old, NULL);
+    return result;
+}
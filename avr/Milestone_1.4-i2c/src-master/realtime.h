@@ -0,0 +1,92 @@
+/**
+    @file src-master/realtime.h
+    @brief real-time hardening of the master and a latency self-test
+    @author Jan Sommer
+
+    In real-time mode the memory of the process is locked and prefaulted, and the
+    control thread runs with SCHED_FIFO pinned to one CPU. Before the motors are
+    armed a self-test in the style of cyclictest measures how late a thread with
+    the same settings is woken up by a timerfd on this machine.
+*/
+
+#ifndef REALTIME_H
+#define REALTIME_H
+
+#include <pthread.h>
+
+#define RT_PRIORITY     80      ///< SCHED_FIFO priority of the control thread
+#define RT_ATTITUDE_PRIORITY 75 ///< SCHED_FIFO priority of the attitude loop (below the control thread which sends its output)
+#define RT_STACK_SIZE   (64 * 1024) ///< Stack which is prefaulted for every real-time thread
+
+/**
+    @brief result of the latency self-test, all times in ns
+*/
+typedef struct
+{
+    long p50;       ///< median wakeup latency
+    long p99;       ///< 99th percentile
+    long p999;      ///< 99.9th percentile
+    long max;       ///< maximum
+    int samples;    ///< number of measured wakeups
+    int overruns;   ///< number of periods which were missed completely
+} latency_t;
+
+/*!
+ \brief Lock all current and future memory of the process and prefault the heap and the stack
+
+ \return int 0 if successful otherwise -1
+*/
+int realtimeLockMemory(void);
+
+/*!
+ \brief Touch the stack of the calling thread so that no page faults happen later
+*/
+void realtimePrefaultStack(void);
+
+/*!
+ \brief Prepare the attributes for a SCHED_FIFO thread pinned to a CPU
+
+ \param attr the attributes which are initialized
+ \param cpu the CPU to run on, -1 for the last CPU of the system
+ \param priority the SCHED_FIFO priority
+ \return int 0 if successful otherwise -1
+*/
+int realtimeAttr(pthread_attr_t *attr, int cpu, int priority);
+
+/*!
+ \brief Measure the wakeup latency of a periodic timerfd in a thread with the attributes @a attr
+
+ \param attr the attributes of the measuring thread (NULL for default attributes)
+ \param rate the rate of the timer in Hz
+ \param samples the number of wakeups to measure
+ \param result the measured latencies
+ \return int 0 if successful otherwise -1
+*/
+int realtimeSelfTest(pthread_attr_t *attr, int rate, int samples, latency_t *result);
+
+/*!
+ \brief Current time of CLOCK_MONOTONIC in ns (the clock of all timestamps of the master)
+
+ \return long long the time in ns
+*/
+long long nowNs(void);
+
+/*!
+ \brief Create a periodic timerfd (CLOCK_MONOTONIC)
+
+ \param periodNs the period in ns
+ \return int the file descriptor or -1 on error
+*/
+int periodicTimer(long periodNs);
+
+/*!
+ \brief Create a thread with all signals blocked
+
+ The signals are left to the threads of the application (e.g. a signalfd), a
+ library thread never runs the default action of a signal.
+
+ \return int 0 if successful otherwise an error number (like pthread_create)
+*/
+int threadCreate(pthread_t *thread, const pthread_attr_t *attr, void *(*start)(void *), void *arg);
+
+#endif // REALTIME_H
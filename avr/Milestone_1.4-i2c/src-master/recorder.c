@@ -0,0 +1,389 @@
+/**
+    @file src-master/recorder.c
+    @brief record of every update in a memory-mapped ring file and its replay
+    @author Jan Sommer
+
+    The queue between the control thread and the recorder thread is a single-producer
+    single-consumer ring: the control thread only writes head, the recorder thread only
+    writes tail. Page faults and the writeback of the mapped file only ever stall the
+    recorder thread.
+*/
+
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <errno.h>
+#include <time.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include "recorder.h"
+#include "realtime.h"
+
+#define RECORD_MAX      384         ///< Maximum size of an encoded record (8 slaves, 5 byte varints)
+#define RECORD_POLL     1000000L    ///< Time in ns the recorder thread sleeps if the queue is empty
+
+/*!
+ \brief Append a varint (7 bits per byte, the lowest bits first)
+*/
+static uint8_t *putVarint(uint8_t *p, uint32_t v)
+{
+    while (v >= 0x80)
+    {
+        *p++ = (v & 0x7f) | 0x80;
+        v >>= 7;
+    }
+    *p++ = v;
+    return p;
+}
+
+/*!
+ \brief Read a varint
+
+ \return const uint8_t* the byte after the varint or NULL if it does not end before @a end
+*/
+static const uint8_t *getVarint(const uint8_t *p, const uint8_t *end, uint32_t *v)
+{
+    int shift;
+
+    *v = 0;
+    for (shift = 0; p < end && shift < 35; shift += 7)
+    {
+        *v |= (uint32_t)(*p & 0x7f) << shift;
+        if (!(*p++ & 0x80))
+            return p;
+    }
+    return NULL;
+}
+
+/*!
+ \brief Map a signed value to an unsigned one with small values for small magnitudes
+*/
+static uint32_t zigzag(int v)
+{
+    return ((uint32_t)v << 1) ^ (uint32_t)(v >> 31);
+}
+
+/*!
+ \brief Inverse of zigzag()
+*/
+static int unzigzag(uint32_t v)
+{
+    return (int)(v >> 1) ^ -(int)(v & 1);
+}
+
+/*!
+ \brief Start the next block (overwrites the oldest block if the file is full)
+*/
+static void nextBlock(recorder_t *r, long long time)
+{
+    r->block = (recordBlock_t *)(r->map + (r->sequence % r->blocks) * RECORD_BLOCK);
+    r->block->magic     = 0;    // invalid while it is reused
+    r->block->used      = 0;
+    r->block->sequence  = r->sequence++;
+    r->block->start     = time;
+    r->block->numSlaves = r->numSlaves;
+    r->block->reserved  = 0;
+    r->block->magic     = RECORD_MAGIC;
+}
+
+/*!
+ \brief Encode an update as record at the end of the current block
+*/
+static void encode(recorder_t *r, const recordEntry_t *e)
+{
+    uint8_t *start, *p;
+    uint32_t mask = 0;
+    long long dt;
+    int i, n = 4 * r->numSlaves, key;
+
+    if (r->block == NULL || r->block->used + RECORD_MAX > RECORD_BLOCK - sizeof(recordBlock_t) ||
+        (e->time - r->last.time) / 1000 > UINT32_MAX)
+        nextBlock(r, e->time);      // a new block starts with a key record
+    start = p = (uint8_t *)(r->block + 1) + r->block->used;
+    key = r->block->used == 0;
+
+    // the time is rounded to us, the next difference refers to the rounded time
+    dt = key ? 0 : (e->time - r->last.time) / 1000;
+    r->last.time = key ? e->time : r->last.time + dt * 1000;
+    p = putVarint(p, dt);
+    *p++ = (e->flags & (RECORD_DELIVERED | RECORD_READBACK)) | (key ? RECORD_KEY : 0);
+
+    if (key)
+    {
+        for (i = 0; i < n; i++)
+            p = putVarint(p, e->value[i / 4][i % 4]);
+    }
+    else
+    {
+        for (i = 0; i < n; i++)
+            if (e->value[i / 4][i % 4] != r->last.value[i / 4][i % 4])
+                mask |= 1u << i;
+        p = putVarint(p, mask);
+        for (i = 0; i < n; i++)
+            if (mask & (1u << i))
+                p = putVarint(p, zigzag(e->value[i / 4][i % 4] - r->last.value[i / 4][i % 4]));
+    }
+    if (e->flags & RECORD_READBACK)
+    {
+        for (i = 0, mask = 0; i < n; i++)
+            if (e->readback[i / 4][i % 4] != e->value[i / 4][i % 4])
+                mask |= 1u << i;
+        p = putVarint(p, mask);
+        for (i = 0; i < n; i++)
+            if (mask & (1u << i))
+                p = putVarint(p, zigzag(e->readback[i / 4][i % 4] - e->value[i / 4][i % 4]));
+    }
+    memcpy(r->last.value, e->value, sizeof(r->last.value));
+
+    r->block->used += p - start;    // the record is valid from now on
+    r->bytes += p - start;
+    r->records++;
+}
+
+/*!
+ \brief Thread which encodes the queued updates into the file
+
+ \param arg the recorder
+ \return void* NULL
+*/
+static void *recorderThread(void *arg)
+{
+    recorder_t *r = arg;
+    struct timespec poll = {0, RECORD_POLL};
+    unsigned long tail;
+
+    for (;;)
+    {
+        tail = atomic_load_explicit(&r->tail, memory_order_relaxed);
+        if (tail == atomic_load_explicit(&r->head, memory_order_acquire))
+        {
+            if (!r->running)
+                break;      // everything is written
+            nanosleep(&poll, NULL);
+            continue;
+        }
+        encode(r, &r->queue[tail % RECORD_QUEUE]);
+        atomic_store_explicit(&r->tail, tail + 1, memory_order_release);
+    }
+    return NULL;
+}
+
+recorder_t *recorderOpen(const char *path, int sizeMB, int numSlaves)
+{
+    size_t bytes = (size_t)sizeMB << 20;
+    recorder_t *r;
+    int fd;
+
+    if (sizeMB < 1 || bytes / RECORD_BLOCK > RECORD_MAX_BLOCKS)
+    {
+        errno = EINVAL;
+        return NULL;
+    }
+    r = calloc(1, sizeof(recorder_t));
+    if (r == NULL)
+        return NULL;
+    fd = open(path, O_RDWR | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+    if (fd == -1 || ftruncate(fd, bytes) != 0)
+    {
+        if (fd != -1)
+            close(fd);
+        free(r);
+        return NULL;
+    }
+    r->map = mmap(NULL, bytes, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, fd, 0);    // no page faults while recording
+    close(fd);
+    if (r->map == MAP_FAILED)
+    {
+        free(r);
+        return NULL;
+    }
+    r->blocks = bytes / RECORD_BLOCK;
+    r->numSlaves = numSlaves;
+    r->running = 1;
+    if (threadCreate(&r->thread, NULL, recorderThread, r) != 0)
+    {
+        munmap(r->map, bytes);
+        free(r);
+        return NULL;
+    }
+    return r;
+}
+
+void recorderPush(recorder_t *r, const recordEntry_t *entry)
+{
+    unsigned long head = atomic_load_explicit(&r->head, memory_order_relaxed);
+
+    if (head - atomic_load_explicit(&r->tail, memory_order_acquire) >= RECORD_QUEUE)
+    {
+        r->dropped++;
+        return;
+    }
+    memcpy(&r->queue[head % RECORD_QUEUE], entry, sizeof(recordEntry_t));
+    atomic_store_explicit(&r->head, head + 1, memory_order_release);
+}
+
+void recorderClose(recorder_t *r)
+{
+    r->running = 0;
+    pthread_join(r->thread, NULL);
+    msync(r->map, r->blocks * RECORD_BLOCK, MS_SYNC);
+    munmap(r->map, r->blocks * RECORD_BLOCK);
+    free(r);
+}
+
+/*!
+ \brief Get a block of a file which is opened for reading
+*/
+static const recordBlock_t *blockAt(const recording_t *rec, int index)
+{
+    return (const recordBlock_t *)(rec->map + (size_t)index * RECORD_BLOCK);
+}
+
+int recordingOpen(const char *path, recording_t *rec)
+{
+    int valid[RECORD_MAX_BLOCKS];
+    const recordBlock_t *block;
+    struct stat st;
+    int fd, i, oldest = 0;
+
+    memset(rec, 0, sizeof(recording_t));
+    fd = open(path, O_RDONLY | O_CLOEXEC);
+    if (fd == -1)
+        return -1;
+    if (fstat(fd, &st) != 0 || st.st_size < RECORD_BLOCK || st.st_size / RECORD_BLOCK > RECORD_MAX_BLOCKS)
+    {
+        close(fd);
+        errno = EINVAL;
+        return -1;
+    }
+    rec->bytes = st.st_size;
+    rec->map = mmap(NULL, rec->bytes, PROT_READ, MAP_SHARED, fd, 0);
+    close(fd);
+    if (rec->map == MAP_FAILED)
+        return -1;
+
+    // the blocks are written round robin: in the order of the file the sequence
+    // only drops once, at the oldest block
+    for (i = 0; i < (int)(rec->bytes / RECORD_BLOCK); i++)
+    {
+        block = blockAt(rec, i);
+        if (block->magic != RECORD_MAGIC || block->used == 0 ||
+            block->used > RECORD_BLOCK - sizeof(recordBlock_t) ||
+            block->numSlaves < 1 || block->numSlaves > COPTER_MAX_SLAVES)
+            continue;
+        if (rec->numBlocks > 0 && block->sequence < blockAt(rec, valid[oldest])->sequence)
+            oldest = rec->numBlocks;
+        valid[rec->numBlocks++] = i;
+        rec->used += block->used;
+    }
+    for (i = 0; i < rec->numBlocks; i++)
+        rec->order[i] = valid[(oldest + i) % rec->numBlocks];
+    if (rec->numBlocks > 0)
+    {
+        block = blockAt(rec, rec->order[0]);
+        rec->numSlaves = block->numSlaves;
+        rec->first = block->start;
+    }
+    return 0;
+}
+
+/*!
+ \brief Decode the record at the current offset
+
+ \return int 0 if successful, -1 if the record is corrupt
+*/
+static int decode(recording_t *rec, const recordBlock_t *block, recordEntry_t *e)
+{
+    const uint8_t *p = (const uint8_t *)(block + 1) + rec->offset;
+    const uint8_t *end = (const uint8_t *)(block + 1) + block->used;
+    uint32_t v, mask;
+    int i, n = 4 * block->numSlaves;
+
+    if ((p = getVarint(p, end, &v)) == NULL || p >= end)
+        return -1;
+    e->flags = *p++;
+    if (e->flags & RECORD_KEY)
+    {
+        e->time = block->start;
+        for (i = 0; i < n; i++)
+        {
+            if ((p = getVarint(p, end, &v)) == NULL)
+                return -1;
+            e->value[i / 4][i % 4] = v;
+        }
+    }
+    else
+    {
+        if (rec->offset == 0 || (p = getVarint(p, end, &mask)) == NULL)
+            return -1;      // a block starts with a key record
+        e->time = rec->last.time + v * 1000LL;
+        memcpy(e->value, rec->last.value, sizeof(e->value));
+        for (i = 0; i < n; i++)
+        {
+            if (!(mask & (1u << i)))
+                continue;
+            if ((p = getVarint(p, end, &v)) == NULL)
+                return -1;
+            e->value[i / 4][i % 4] += unzigzag(v);
+        }
+    }
+    memcpy(e->readback, e->value, sizeof(e->readback));
+    if (e->flags & RECORD_READBACK)
+    {
+        if ((p = getVarint(p, end, &mask)) == NULL)
+            return -1;
+        for (i = 0; i < n; i++)
+        {
+            if (!(mask & (1u << i)))
+                continue;
+            if ((p = getVarint(p, end, &v)) == NULL)
+                return -1;
+            e->readback[i / 4][i % 4] += unzigzag(v);
+        }
+    }
+    rec->offset = p - (const uint8_t *)(block + 1);
+    rec->last = *e;
+    return 0;
+}
+
+int recordingNext(recording_t *rec, recordEntry_t *entry)
+{
+    const recordBlock_t *block;
+
+    while (rec->current < rec->numBlocks)
+    {
+        block = blockAt(rec, rec->order[rec->current]);
+        if (rec->offset < block->used && decode(rec, block, entry) == 0)
+        {
+            entry->time -= rec->first;
+            return 1;
+        }
+        rec->current++;     // end of the block (or the rest of the block is corrupt)
+        rec->offset = 0;
+    }
+    return 0;
+}
+
+int recordingStream(void *arg, int numSlaves, int value[][4], long long *time)
+{
+    recording_t *rec = arg;
+    recordEntry_t entry;
+
+    if (numSlaves != rec->numSlaves)
+    {
+        errno = EINVAL;
+        return -1;
+    }
+    if (recordingNext(rec, &entry) == 0)
+        return 0;
+    memcpy(value, entry.value, numSlaves * sizeof(entry.value[0]));
+    *time = entry.time;
+    return 1;
+}
+
+void recordingClose(recording_t *rec)
+{
+    if (rec->map != NULL && rec->map != MAP_FAILED)
+        munmap(rec->map, rec->bytes);
+}
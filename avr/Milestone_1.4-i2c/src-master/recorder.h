@@ -0,0 +1,164 @@
+/**
+    @file src-master/recorder.h
+    @brief record of every update in a memory-mapped ring file and its replay
+    @author Jan Sommer
+
+    The control thread of libcopter hands every update (time, setpoints, result and
+    readback) to the recorder in a lock-free queue @sa copterRecord
+    It never waits: if the queue is full the update is dropped and counted. A thread
+    of the recorder encodes the updates into the ring file, which is mapped into memory.
+
+    The file is divided into blocks of RECORD_BLOCK bytes. When the file is full the
+    oldest block is overwritten, so the file always holds the newest updates. Every
+    block starts with a full record of all duty cycles, the following records only
+    contain the time since the previous record and the channels which changed (varints
+    of zigzag encoded deltas), typically about 5 bytes per update. A block is valid up to
+    RECORD_BLOCK::used even if the master crashed.
+
+    Format of a record:
+        varint   time since the previous record in us
+        byte     flags: RECORD_DELIVERED, RECORD_READBACK, RECORD_KEY
+        RECORD_KEY:  varint of every duty cycle
+        otherwise:   varint bit mask of the changed channels, zigzag varint delta of each changed channel
+        RECORD_READBACK: varint bit mask of the channels whose readback differs from the
+                     setpoint, zigzag varint difference of each of them
+*/
+
+#ifndef RECORDER_H
+#define RECORDER_H
+
+#include <stdint.h>
+#include <pthread.h>
+#include <stdatomic.h>
+#include "copter.h"
+
+#define RECORD_BLOCK        65536   ///< Size of a block of the ring file
+#define RECORD_MAGIC        0x43505442  ///< Marks a valid block ("CPTB")
+#define RECORD_QUEUE        4096    ///< Number of updates the queue to the recorder thread holds (> 1 ms of updates)
+#define RECORD_SIZE_MB      16      ///< Default size of the ring file in MB
+#define RECORD_MAX_BLOCKS   4096    ///< Maximum number of blocks of a file (256 MB) @sa recording_t::order
+
+#define RECORD_DELIVERED    1       ///< flag: the update was delivered
+#define RECORD_READBACK     2       ///< flag: the record contains the readback (verified mode)
+#define RECORD_KEY          4       ///< flag: the record contains all duty cycles
+
+/**
+    @brief an update as the control thread hands it over
+*/
+typedef struct
+{
+    long long time;                         ///< CLOCK_MONOTONIC of the update in ns
+    int flags;                              ///< RECORD_DELIVERED, RECORD_READBACK
+    int value[COPTER_MAX_SLAVES][4];        ///< the duty cycles which were sent
+    int readback[COPTER_MAX_SLAVES][4];     ///< the duty cycles mirrored by the slaves (RECORD_READBACK)
+} recordEntry_t;
+
+/**
+    @brief header of a block of the ring file, followed by the records
+*/
+typedef struct
+{
+    uint32_t magic;         ///< RECORD_MAGIC if the block is valid
+    uint32_t used;          ///< bytes of records in the block
+    uint64_t sequence;      ///< number of the block since the start of the recording
+    int64_t start;          ///< time of the first record in ns
+    int32_t numSlaves;      ///< number of slaves
+    int32_t reserved;       ///< 0
+} recordBlock_t;
+
+/**
+    @brief the writer of a ring file
+*/
+typedef struct
+{
+    uint8_t *map;                           ///< the mapped file
+    size_t blocks;                          ///< number of blocks of the file
+    int numSlaves;                          ///< number of slaves
+    recordEntry_t queue[RECORD_QUEUE];      ///< the updates for the recorder thread
+    atomic_ulong head;                      ///< next entry written by the control thread
+    atomic_ulong tail;                      ///< next entry read by the recorder thread
+    pthread_t thread;                       ///< the recorder thread
+    volatile int running;                   ///< the recorder thread runs until this is 0
+    recordBlock_t *block;                   ///< the current block
+    uint64_t sequence;                      ///< number of the current block
+    recordEntry_t last;                     ///< the previous record of the current block
+    unsigned long records;                  ///< number of written records
+    unsigned long dropped;                  ///< updates dropped because the queue was full
+    unsigned long long bytes;               ///< number of written bytes of records
+} recorder_t;
+
+/**
+    @brief the reader of a ring file
+*/
+typedef struct
+{
+    uint8_t *map;           ///< the mapped file
+    size_t bytes;           ///< size of the file
+    int numSlaves;          ///< number of slaves
+    int order[RECORD_MAX_BLOCKS];   ///< the valid blocks, oldest first
+    int numBlocks;          ///< number of valid blocks
+    size_t used;            ///< bytes of records in the valid blocks
+    int current;            ///< index in @a order of the current block
+    uint32_t offset;        ///< offset of the next record in the current block
+    recordEntry_t last;     ///< the previous record
+    long long first;        ///< time of the first record in ns
+} recording_t;
+
+/*!
+ \brief Create the ring file and start the recorder thread
+
+ \param path the file
+ \param sizeMB the size of the file in MB
+ \param numSlaves the number of slaves
+ \return recorder_t* the recorder or NULL on error (errno is set)
+*/
+recorder_t *recorderOpen(const char *path, int sizeMB, int numSlaves);
+
+/*!
+ \brief Hand an update over to the recorder thread (never blocks, only one caller thread)
+
+ \param r the recorder
+ \param entry the update
+*/
+void recorderPush(recorder_t *r, const recordEntry_t *entry);
+
+/*!
+ \brief Stop the recorder thread after it wrote all queued updates and close the file
+
+ \param r the recorder
+*/
+void recorderClose(recorder_t *r);
+
+/*!
+ \brief Open a ring file for reading
+
+ \param path the file
+ \param rec the reader
+ \return int 0 if successful otherwise -1
+*/
+int recordingOpen(const char *path, recording_t *rec);
+
+/*!
+ \brief Read the next record
+
+ \param rec the reader
+ \param entry the update (times relative to the first record)
+ \return int 1 for a record, 0 at the end
+*/
+int recordingNext(recording_t *rec, recordEntry_t *entry);
+
+/*!
+ \brief Source of the setpoints of a recording for streamRun() @sa streamNext_t
+
+ \param arg the recording_t
+*/
+int recordingStream(void *arg, int numSlaves, int value[][4], long long *time);
+
+/*!
+ \brief Close a ring file which was opened for reading
+
+ \param rec the reader
+*/
+void recordingClose(recording_t *rec);
+
+#endif // RECORDER_H
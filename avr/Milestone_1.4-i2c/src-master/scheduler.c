@@ -0,0 +1,184 @@
+/**
+    @file src-master/scheduler.c
+    @brief deadline-aware arbitration of a bus between the motor writes, IMU reads and telemetry polls
+    @author Jan Sommer
+
+    A free bus without waiting transfers is granted at once (one lock and unlock of the
+    mutex), the queue of waiting transfers is only searched when several threads
+    compete for the bus.
+*/
+
+#include <string.h>
+#include <limits.h>
+#include "scheduler.h"
+#include "realtime.h"
+
+static _Thread_local busClass_t threadClass = BUS_TELEMETRY;   ///< @sa busSetClass
+static _Thread_local long long threadDeadline = 0;              ///< @sa busSetClass
+
+void busSetClass(busClass_t cls, long long deadline)
+{
+    threadClass = cls;
+    threadDeadline = deadline;
+}
+
+void schedulerInit(busScheduler_t *s, long tick)
+{
+    memset(s, 0, sizeof(busScheduler_t));
+    pthread_mutex_init(&s->lock, NULL);
+    pthread_cond_init(&s->granted, NULL);
+    s->start = nowNs();
+    s->stats.tick = tick;
+}
+
+void schedulerSetTick(busScheduler_t *s, long tick)
+{
+    pthread_mutex_lock(&s->lock);
+    s->stats.tick = tick;
+    s->stats.ticks = 0;             // ticks of different lengths can not be compared
+    s->stats.busyTicks = 0;
+    s->stats.maxUtilization = 0;
+    s->start = nowNs();
+    s->currentTick = 0;
+    s->busyInTick = 0;
+    s->busyTotal = 0;
+    pthread_mutex_unlock(&s->lock);
+}
+
+/*!
+ \brief Account the busy time of the current tick in the counters (the lock is held)
+*/
+static void tickFinished(const busScheduler_t *s, busScheduleStats_t *st)
+{
+    int util = s->busyInTick * 1000 / st->tick;
+
+    if (util > st->maxUtilization)
+        st->maxUtilization = util;
+    if (util > SCHED_BUSY_LIMIT)
+        st->busyTicks++;
+}
+
+/*!
+ \brief Index of the waiting transfer which gets the bus next (the lock is held)
+*/
+static int nextWaiting(const busScheduler_t *s)
+{
+    int i, best = 0;
+
+    for (i = 1; i < s->numWaiting; i++)
+    {
+        if (s->waiting[i].cls != s->waiting[best].cls ? s->waiting[i].cls < s->waiting[best].cls :
+            s->waiting[i].deadline != s->waiting[best].deadline ? s->waiting[i].deadline < s->waiting[best].deadline :
+            s->waiting[i].ticket < s->waiting[best].ticket)
+            best = i;
+    }
+    return best;
+}
+
+void schedulerAcquire(busScheduler_t *s, busRequest_t *req)
+{
+    unsigned long ticket;
+    int i;
+
+    req->cls = threadClass;
+    req->deadline = threadDeadline;
+    req->requested = nowNs();
+
+    pthread_mutex_lock(&s->lock);
+    if (!s->busy && s->numWaiting == 0)
+    {
+        s->busy = 1;
+        pthread_mutex_unlock(&s->lock);
+        req->granted = req->requested;
+        return;
+    }
+
+    while (s->numWaiting == SCHED_MAX_WAITERS)
+        pthread_cond_wait(&s->granted, &s->lock);
+    ticket = s->nextTicket++;
+    i = s->numWaiting++;
+    s->waiting[i].cls = req->cls;
+    s->waiting[i].deadline = req->deadline != 0 ? req->deadline : LLONG_MAX;
+    s->waiting[i].ticket = ticket;
+    for (;;)
+    {
+        if (!s->busy)
+        {
+            i = nextWaiting(s);
+            if (s->waiting[i].ticket == ticket)
+                break;
+        }
+        pthread_cond_wait(&s->granted, &s->lock);
+    }
+    s->waiting[i] = s->waiting[--s->numWaiting];
+    s->busy = 1;
+    pthread_mutex_unlock(&s->lock);
+    req->granted = nowNs();
+}
+
+void schedulerRelease(busScheduler_t *s, busRequest_t *req, long long end)
+{
+    busScheduleStats_t *st = &s->stats;
+    long long tick, from, tickEnd;
+    long wait = req->granted - req->requested;
+
+    pthread_mutex_lock(&s->lock);
+    s->busy = 0;
+    if (s->numWaiting > 0)
+        pthread_cond_broadcast(&s->granted);
+    if (end == 0)
+    {
+        pthread_mutex_unlock(&s->lock);
+        return;
+    }
+
+    st->transfers[req->cls]++;
+    if (req->deadline != 0 && end > req->deadline)
+        st->missed[req->cls]++;
+    if (wait > 0)
+    {
+        st->waited[req->cls]++;
+        st->sumWait[req->cls] += wait;
+        if (wait > st->maxWait[req->cls])
+            st->maxWait[req->cls] = wait;
+    }
+
+    // the busy time counts for the ticks in which the bus was busy (ticks without any transfer are idle)
+    for (from = req->granted > s->start ? req->granted : s->start; ; from = tickEnd)
+    {
+        tick = (from - s->start) / st->tick;
+        if (tick > s->currentTick)
+        {
+            tickFinished(s, st);
+            s->currentTick = tick;
+            s->busyInTick = 0;
+        }
+        tickEnd = s->start + (tick + 1) * st->tick;
+        if (end <= tickEnd)
+            break;
+        s->busyInTick += tickEnd - from;
+    }
+    s->busyInTick += end - from;
+    s->busyTotal += end - req->granted;
+    pthread_mutex_unlock(&s->lock);
+}
+
+void schedulerStats(busScheduler_t *s, busScheduleStats_t *stats)
+{
+    long long elapsed;
+
+    pthread_mutex_lock(&s->lock);
+    *stats = s->stats;
+    elapsed = nowNs() - s->start;
+    stats->utilization = elapsed > 0 ? s->busyTotal * 1000 / elapsed : 0;
+    // the last tick with a transfer is not finished in the counters yet, all ticks up to now count (the idle ones too)
+    tickFinished(s, stats);
+    stats->ticks = elapsed / stats->tick + 1;
+    pthread_mutex_unlock(&s->lock);
+}
+
+void schedulerDestroy(busScheduler_t *s)
+{
+    pthread_cond_destroy(&s->granted);
+    pthread_mutex_destroy(&s->lock);
+}
@@ -0,0 +1,148 @@
+/**
+    @file src-master/scheduler.h
+    @brief deadline-aware arbitration of a bus between the motor writes, IMU reads and telemetry polls
+    @author Jan Sommer
+
+    Every transfer of a transport passes the scheduler of the transport: if the bus is
+    busy the transfer waits, and when the bus becomes free it is granted to the waiting
+    transfer of the most important class (BUS_MOTOR before BUS_IMU before BUS_TELEMETRY),
+    within a class to the earliest deadline. A transfer which already runs is never
+    interrupted, so a motor write waits at most for one transfer of another class.
+
+    The class and the deadline belong to the calling thread @sa busSetClass
+    Threads which never set them (e.g. the UI reading registers) are BUS_TELEMETRY
+    without a deadline.
+
+    The scheduler counts the transfers, the missed deadlines (the transfer ended after
+    its deadline) and the waits of every class and the utilization of the bus in every
+    tick (busy time / length of the tick, a transfer across a tick boundary counts for both).
+*/
+
+#ifndef SCHEDULER_H
+#define SCHEDULER_H
+
+#include <pthread.h>
+
+#define SCHED_MAX_WAITERS   32          ///< Maximum number of transfers waiting for a bus
+#define SCHED_TICK          4000000L    ///< Default length of a tick in ns (one PPM frame)
+#define SCHED_BUSY_LIMIT    800         ///< Utilization of a tick in per mille above which the tick counts as busy
+
+/**
+    @brief the classes of transfers, most important first
+*/
+typedef enum
+{
+    BUS_MOTOR,          ///< duty cycles of the motors
+    BUS_IMU,            ///< burst reads of the IMU
+    BUS_TELEMETRY,      ///< polls of registers (default)
+    BUS_CLASSES         ///< number of classes
+} busClass_t;
+
+/**
+    @brief counters of the scheduler of a bus, all times in ns
+*/
+typedef struct
+{
+    unsigned long transfers[BUS_CLASSES];   ///< number of transfers
+    unsigned long missed[BUS_CLASSES];      ///< transfers which ended after their deadline
+    unsigned long waited[BUS_CLASSES];      ///< transfers which had to wait for the bus
+    long maxWait[BUS_CLASSES];              ///< longest wait for the bus
+    long long sumWait[BUS_CLASSES];         ///< sum of the waits for the average
+    unsigned long ticks;                    ///< number of ticks since the start including the current and the idle ones
+    unsigned long busyTicks;                ///< ticks with a utilization above SCHED_BUSY_LIMIT
+    int maxUtilization;                     ///< highest utilization of a tick in per mille
+    int utilization;                        ///< utilization since the start (or the last change of the tick) in per mille
+    long tick;                              ///< length of a tick
+} busScheduleStats_t;
+
+/**
+    @brief state of the scheduler of a bus
+*/
+typedef struct
+{
+    pthread_mutex_t lock;           ///< protects everything below
+    pthread_cond_t granted;         ///< signaled when the bus becomes free
+    int busy;                       ///< 1 while a transfer runs
+    int numWaiting;                 ///< number of entries of @a waiting
+    struct
+    {
+        busClass_t cls;             ///< class of the transfer
+        long long deadline;         ///< deadline of the transfer (LLONG_MAX if none)
+        unsigned long ticket;       ///< order of the requests (first come first served within the same deadline)
+    } waiting[SCHED_MAX_WAITERS];   ///< the waiting transfers
+    unsigned long nextTicket;       ///< ticket of the next request
+    long long start;                ///< time of the first tick
+    long long currentTick;          ///< number of the current tick
+    long long busyInTick;           ///< busy time in the current tick
+    long long busyTotal;            ///< busy time since the start
+    busScheduleStats_t stats;       ///< the counters
+} busScheduler_t;
+
+/**
+    @brief a transfer between schedulerAcquire() and schedulerRelease()
+*/
+typedef struct
+{
+    busClass_t cls;                 ///< class of the calling thread
+    long long deadline;             ///< deadline of the calling thread (0 == none)
+    long long requested;            ///< time of the request
+    long long granted;              ///< time when the bus was granted
+} busRequest_t;
+
+/*!
+ \brief Set the class and the deadline of the following transfers of the calling thread
+
+ \param cls the class
+ \param deadline CLOCK_MONOTONIC in ns until which the transfers should be finished, 0 == none
+*/
+void busSetClass(busClass_t cls, long long deadline);
+
+/*!
+ \brief Initialize a scheduler
+
+ \param s the scheduler
+ \param tick length of a tick for the utilization in ns
+*/
+void schedulerInit(busScheduler_t *s, long tick);
+
+/*!
+ \brief Change the length of a tick (e.g. to the period of the control thread), restarts the utilization
+
+ \param s the scheduler
+ \param tick length of a tick in ns
+*/
+void schedulerSetTick(busScheduler_t *s, long tick);
+
+/*!
+ \brief Wait until the bus is granted to a transfer of the calling thread
+
+ \param s the scheduler
+ \param req the request (filled in)
+*/
+void schedulerAcquire(busScheduler_t *s, busRequest_t *req);
+
+/*!
+ \brief Free the bus after the transfer and account it
+
+ \param s the scheduler
+ \param req the request of schedulerAcquire()
+ \param end the time when the transfer ended, 0 if the bus was held without a transfer (not accounted)
+*/
+void schedulerRelease(busScheduler_t *s, busRequest_t *req, long long end);
+
+/*!
+ \brief Get the counters (from any thread)
+
+ \param s the scheduler
+ \param stats the counters
+*/
+void schedulerStats(busScheduler_t *s, busScheduleStats_t *stats);
+
+/*!
+ \brief Free the resources of a scheduler
+
+ \param s the scheduler
+*/
+void schedulerDestroy(busScheduler_t *s);
+
+#endif // SCHEDULER_H
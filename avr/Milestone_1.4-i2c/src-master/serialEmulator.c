@@ -0,0 +1,237 @@
+/**
+    @file src-master/serialEmulator.c
+    @brief stand-in for a slave on a serial port: a pseudo terminal served by the frame
+           state machine of the USART slave driver
+    @author Jan Sommer
+
+    The serial transport opens the slave side of a pty like a real serial port (termios,
+    baud rate, timeouts), so its framing and checksums are exercised without hardware.
+    A thread reads the master side byte by byte with the state machine of
+    ISR(USART_RX_vect) @sa usartSlave.c and replies like the slave (UART_ACK, UART_NACK,
+    read frames). Valid frames are handed as messages to an emulated slave
+    @sa slaveEmulator.c, so the registers behave like the firmware. Before a reply the
+    thread waits for the time which the frame and the reply take on the line.
+*/
+
+#define _GNU_SOURCE     // posix_openpt(), ptsname()
+#include <stdlib.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <errno.h>
+#include <time.h>
+#include <poll.h>
+#include <pthread.h>
+#include "transport.h"
+#include "realtime.h"
+#include "slave.h"
+
+#define STANDIN_POLL    100         ///< Longest wait for a byte in ms (the thread notices the close within this time)
+#define UART_SYNC       0xA5        ///< @sa UART_SYNC (slave)
+#define UART_READ       0x80        ///< @sa UART_READ (slave)
+#define UART_ACK        0x79        ///< @sa UART_ACK (slave)
+#define UART_NACK       0x1F        ///< @sa UART_NACK (slave)
+
+/**
+    @brief states of the receiver @sa rxState_t (slave)
+*/
+typedef enum
+{
+    USART_WAIT_SYNC,
+    USART_HEADER,
+    USART_REGISTER,
+    USART_DATA,
+    USART_CHECKSUM
+} rxState_t;
+
+/**
+    @brief state of the stand-in
+*/
+typedef struct
+{
+    int fd;                                 ///< master side of the pty
+    int baud;                               ///< baud rate of the emulated line
+    transport_t *slave;                     ///< the emulated slave
+    pthread_t thread;                       ///< serves the frames
+    volatile int running;                   ///< the thread runs until this is 0
+    rxState_t rxState;                      ///< @sa rxState (slave)
+    uint8_t rxHeader;                       ///< @sa rxHeader (slave)
+    uint8_t rxRegister;                     ///< @sa rxRegister (slave)
+    uint8_t rxCount;                        ///< @sa rxCount (slave)
+    uint8_t rxSum;                          ///< @sa rxSum (slave)
+    uint8_t rxData[SLAVE_BUFFER_SIZE + 1];  ///< the register and the data of the frame
+} standIn_t;
+
+/*!
+ \brief Wait for the time of @a bytes on the line (10 bits each)
+*/
+static void standInLine(const standIn_t *s, int bytes)
+{
+    long long ns = bytes * 10 * 1000000000LL / s->baud;
+    struct timespec t = {ns / 1000000000LL, ns % 1000000000LL};
+
+    nanosleep(&t, NULL);
+}
+
+/*!
+ \brief Send a reply after the time of the frame and the reply on the line
+*/
+static void standInReply(standIn_t *s, const uint8_t *reply, int len, int frameLength)
+{
+    standInLine(s, frameLength + len);
+    if (write(s->fd, reply, len) != len)
+        s->running = 0;     // the transport was closed
+}
+
+/*!
+ \brief Handle a frame with a valid checksum @sa usartFrameComplete (slave)
+*/
+static void standInFrame(standIn_t *s)
+{
+    uint8_t length = s->rxHeader & ~UART_READ;
+    uint8_t reply[SLAVE_BUFFER_SIZE + 3];
+    uint8_t ack = UART_ACK, sum;
+    busMsg_t msgs[2];
+    int i;
+
+    s->rxData[0] = s->rxRegister;
+    if (s->rxHeader & UART_READ)
+    {
+        msgs[0] = (busMsg_t){PPM_SLAVE_ADDR, 0, 1, s->rxData};
+        msgs[1] = (busMsg_t){PPM_SLAVE_ADDR, BUS_READ, length, &reply[2]};
+        s->slave->transfer(s->slave, msgs, 2);
+        reply[0] = UART_SYNC;
+        reply[1] = length;
+        sum = length;
+        for (i = 0; i < length; i++)
+            sum += reply[i + 2];
+        reply[length + 2] = -sum;
+        standInReply(s, reply, length + 3, 4);
+        return;
+    }
+    if (length == 0 && s->rxRegister >= GENERAL_CALL_COMMAND)
+        msgs[0] = (busMsg_t){0, 0, 1, s->rxData};
+    else
+        msgs[0] = (busMsg_t){PPM_SLAVE_ADDR, 0, 1 + length, s->rxData};
+    s->slave->transfer(s->slave, msgs, 1);
+    standInReply(s, &ack, 1, length + 4);
+}
+
+/*!
+ \brief Receive a byte @sa ISR(USART_RX_vect) (slave)
+*/
+static void standInReceive(standIn_t *s, uint8_t data)
+{
+    uint8_t nack = UART_NACK;
+
+    s->rxSum += data;
+    switch (s->rxState)
+    {
+    case USART_WAIT_SYNC:
+        if (data == UART_SYNC)
+        {
+            s->rxSum   = 0;
+            s->rxState = USART_HEADER;
+        }
+        break;
+
+    case USART_HEADER:
+        s->rxHeader = data;
+        s->rxCount  = 0;
+        s->rxState  = USART_REGISTER;
+        break;
+
+    case USART_REGISTER:
+        s->rxRegister = data;
+        s->rxState = (s->rxHeader & UART_READ) || s->rxHeader == 0 ? USART_CHECKSUM : USART_DATA;
+        break;
+
+    case USART_DATA:
+        if (s->rxCount < SLAVE_BUFFER_SIZE)
+            s->rxData[1 + s->rxCount] = data;
+        if (++s->rxCount == s->rxHeader)
+            s->rxState = USART_CHECKSUM;
+        break;
+
+    case USART_CHECKSUM:
+        s->rxState = USART_WAIT_SYNC;
+        if (s->rxSum == 0 &&
+            (s->rxRegister + (s->rxHeader & ~UART_READ) <= SLAVE_BUFFER_SIZE ||
+             (s->rxHeader == 0 && s->rxRegister >= GENERAL_CALL_COMMAND)))
+            standInFrame(s);
+        else if (!(s->rxHeader & UART_READ))
+            standInReply(s, &nack, 1, s->rxCount + 4);
+        break;
+    }
+}
+
+/*!
+ \brief Thread of the stand-in: feeds every byte from the master to the receiver
+
+ \param arg the stand-in
+ \return void* NULL
+*/
+static void *standInThread(void *arg)
+{
+    standIn_t *s = arg;
+    struct pollfd pfd = {s->fd, POLLIN, 0};
+    uint8_t data[64];
+    int i, n;
+
+    while (s->running)
+    {
+        if (poll(&pfd, 1, STANDIN_POLL) != 1)
+            continue;
+        n = read(s->fd, data, sizeof(data));
+        if (n <= 0)
+            break;      // the slave side was closed (EIO)
+        for (i = 0; i < n && s->running; i++)
+            standInReceive(s, data[i]);
+    }
+    return NULL;
+}
+
+static void standInClose(transport_t *t)
+{
+    standIn_t *s = t->priv;
+
+    close(t->fd);
+    s->running = 0;
+    pthread_join(s->thread, NULL);
+    close(s->fd);
+    transportClose(s->slave);
+    free(s);
+}
+
+transport_t *serialEmulatorOpen(int baud)
+{
+    standIn_t *s = calloc(1, sizeof(standIn_t));
+    transport_t *t = NULL;
+
+    if (s == NULL)
+        return NULL;
+    s->baud = baud;
+    s->fd = posix_openpt(O_RDWR | O_NOCTTY | O_CLOEXEC);
+    if (s->fd != -1 && grantpt(s->fd) == 0 && unlockpt(s->fd) == 0)
+        t = serialOpen(ptsname(s->fd), baud);     // the pty must be open before the thread reads it
+    if (t != NULL)
+        s->slave = transportOpen("emu", 0);
+    s->running = 1;
+    if (s->slave == NULL || threadCreate(&s->thread, NULL, standInThread, s) != 0)
+    {
+        if (s->slave != NULL)
+            transportClose(s->slave);
+        if (t != NULL)
+        {
+            close(t->fd);
+            free(t);
+        }
+        if (s->fd != -1)
+            close(s->fd);
+        free(s);
+        return NULL;
+    }
+    t->name  = "serial emulator";
+    t->close = standInClose;
+    t->priv  = s;
+    return t;
+}
@@ -0,0 +1,399 @@
+/**
+    @file src-master/server.c
+    @brief server mode of the master: setpoints from other processes
+    @author Jan Sommer
+
+    Everything runs in one thread with an event loop over the listening socket, the
+    connections, the poll timer of the shared memory and a signalfd. Only the
+    control thread of libcopter touches the bus, the server only submits.
+
+    The mailboxes are polled instead of waking the server: a wakeup (e.g. a futex in
+    the segment) would cost the client a system call per publish, the poll costs up to
+    1 / SERVER_POLL_RATE of latency. The setpoints of a mailbox are read in place from
+    its front buffer, which only changes with the next fetch of the server.
+*/
+
+#define _GNU_SOURCE     // accept4()
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <errno.h>
+#include <signal.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <sys/signalfd.h>
+#include "server.h"
+#include "ingest.h"
+#include "eventloop.h"
+#include "realtime.h"
+
+#define LINE_LENGTH     128     ///< Maximum length of a command on the socket
+#define CLAIM_NONE      -1                  ///< @sa server::claim: the source is released
+#define CLAIM_MAILBOX   SERVER_MAX_CLIENTS  ///< @sa server::claim: the source was set by its mailbox
+
+static const char *sourceName[INGEST_SOURCES] = {"pilot", "failsafe"};
+
+typedef struct server server_t;
+
+/**
+    @brief a connection on the socket
+*/
+typedef struct
+{
+    server_t *server;           ///< the server
+    int fd;                     ///< the socket, -1 if unused
+    char line[LINE_LENGTH];     ///< the received part of the current command
+    int len;                    ///< length of @a line
+} client_t;
+
+/**
+    @brief state of the server
+*/
+struct server
+{
+    copter_t *copter;                           ///< the device handle
+    int numSlaves;                              ///< number of slaves
+    const int (*safe)[4];                       ///< the setpoints when no source is active
+    ingest_t *ingest;                           ///< the shared memory segment
+    eventLoop_t loop;                           ///< the event loop
+    int listenFd;                               ///< the listening socket
+    client_t client[SERVER_MAX_CLIENTS];        ///< the connections
+    ingestSetpoints_t source[INGEST_SOURCES];   ///< the setpoints of each source set via the socket
+    const ingestSetpoints_t *setpoints[INGEST_SOURCES]; ///< the newest setpoints of each source (@a source or the front of the mailbox)
+    int claim[INGEST_SOURCES];                  ///< who set each source: index of the connection, CLAIM_MAILBOX or CLAIM_NONE
+    long long published[INGEST_SOURCES];        ///< time of the last value from the mailbox of each source
+    int winner;                                 ///< the source whose setpoints were submitted last, -1 if none
+    int submitted[COPTER_MAX_SLAVES][4];        ///< the setpoints which were submitted last
+    unsigned long updates[INGEST_SOURCES];      ///< number of received setpoints of each source
+    unsigned long submits;                      ///< number of submitted setpoints
+    unsigned long overrides;                    ///< number of changes to a higher priority source
+    unsigned long timeouts;                     ///< number of sources released because their mailbox was silent
+};
+
+/*!
+ \brief Submit the setpoints of the active source with the highest priority (if they changed),
+        the safe setpoints once when the last source was released
+*/
+static void arbitrate(server_t *s)
+{
+    int i, winner = -1;
+
+    for (i = INGEST_SOURCES - 1; i >= 0 && winner == -1; i--)
+        if (s->claim[i] != CLAIM_NONE && s->setpoints[i]->active)
+            winner = i;
+    if (winner == -1)
+    {
+        if (s->winner == -1)
+            return;     // nothing was submitted since the start or the safe setpoints already were
+        s->winner = -1;
+        memcpy(s->submitted, s->safe, s->numSlaves * sizeof(s->submitted[0]));
+        copterSubmit(s->copter, 0, s->numSlaves, s->safe);
+        s->submits++;
+        return;
+    }
+    if (winner == s->winner &&
+        memcmp(s->submitted, s->setpoints[winner]->value, s->numSlaves * sizeof(s->submitted[0])) == 0)
+        return;
+
+    if (s->winner != -1 && winner > s->winner)
+        s->overrides++;
+    s->winner = winner;
+    memcpy(s->submitted, s->setpoints[winner]->value, s->numSlaves * sizeof(s->submitted[0]));
+    copterSubmit(s->copter, 0, s->numSlaves, (const int (*)[4])s->submitted);  // a failure is counted by the library
+    s->submits++;
+}
+
+/*!
+ \brief Release a source
+*/
+static void release(server_t *s, int src)
+{
+    s->claim[src] = CLAIM_NONE;
+    s->setpoints[src] = &s->source[src];
+}
+
+/*!
+ \brief Let a connection set a source (it keeps the setpoints of the slaves it does not set)
+*/
+static void claimBySocket(server_t *s, int src, int client)
+{
+    if (s->setpoints[src] != &s->source[src])
+        memcpy(&s->source[src], s->setpoints[src], sizeof(ingestSetpoints_t));
+    s->setpoints[src] = &s->source[src];
+    s->claim[src] = client;
+}
+
+/*!
+ \brief Handler for the poll timer: fetch the newest setpoints from the shared memory
+        and release the sources of silent mailboxes
+*/
+static void onPoll(int fd, void *arg)
+{
+    server_t *s = arg;
+    uint64_t expirations;
+    mailbox_t *mb;
+    long long now;
+    int i, changed = 0;
+
+    if (read(fd, &expirations, sizeof(expirations)) != sizeof(expirations))
+        return;
+    now = nowNs();
+    for (i = 0; i < INGEST_SOURCES; i++)
+    {
+        mb = ingestMailbox(s->ingest, i);
+        if (mailboxFetch(mb))
+        {
+            s->setpoints[i] = mailboxFront(mb);
+            s->claim[i] = CLAIM_MAILBOX;
+            s->published[i] = now;
+            s->updates[i]++;
+            changed = 1;
+        }
+        else if (s->claim[i] == CLAIM_MAILBOX && s->setpoints[i]->active &&
+                 now - s->published[i] > SERVER_SOURCE_TIMEOUT * 1000000LL)
+        {
+            release(s, i);
+            s->timeouts++;
+            changed = 1;
+        }
+    }
+    if (changed)
+        arbitrate(s);
+}
+
+/*!
+ \brief Find a source by its name
+
+ \return int the source or -1
+*/
+static int sourceByName(const char *name)
+{
+    int i;
+
+    for (i = 0; i < INGEST_SOURCES; i++)
+        if (strcmp(name, sourceName[i]) == 0)
+            return i;
+    return -1;
+}
+
+/*!
+ \brief Execute one command of a connection and answer it
+*/
+static void command(server_t *s, client_t *cl, char *line)
+{
+    char reply[LINE_LENGTH], name[16];
+    int slave, src, v[4], i;
+
+    if (sscanf(line, "set %15s %d %d %d %d %d", name, &slave, &v[0], &v[1], &v[2], &v[3]) == 6)
+    {
+        src = sourceByName(name);
+        if (src == -1 || slave < 0 || slave >= s->numSlaves)
+            snprintf(reply, sizeof(reply), "error unknown source or slave\n");
+        else
+        {
+            claimBySocket(s, src, cl - s->client);
+            for (i = 0; i < 4; i++)
+                s->source[src].value[slave][i] = v[i];
+            s->source[src].active = 1;
+            s->updates[src]++;
+            arbitrate(s);
+            snprintf(reply, sizeof(reply), "ok\n");
+        }
+    }
+    else if (sscanf(line, "release %15s", name) == 1)
+    {
+        src = sourceByName(name);
+        if (src == -1)
+            snprintf(reply, sizeof(reply), "error unknown source\n");
+        else
+        {
+            release(s, src);
+            arbitrate(s);
+            snprintf(reply, sizeof(reply), "ok\n");
+        }
+    }
+    else if (strcmp(line, "status") == 0)
+        snprintf(reply, sizeof(reply), "ok %s pilot %lu failsafe %lu submitted %lu overrides %lu timeouts %lu\n",
+                 s->winner == -1 ? "none" : sourceName[s->winner], s->updates[INGEST_PILOT],
+                 s->updates[INGEST_FAILSAFE], s->submits, s->overrides, s->timeouts);
+    else
+        snprintf(reply, sizeof(reply), "error unknown command\n");
+
+    if (send(cl->fd, reply, strlen(reply), MSG_NOSIGNAL | MSG_DONTWAIT) < 0)
+        return;     // the connection is closed by the next read
+}
+
+/*!
+ \brief Close a connection and release the sources it set (not the ones a mailbox set since)
+*/
+static void clientClose(server_t *s, client_t *cl)
+{
+    int i;
+
+    eventLoopRemove(&s->loop, cl->fd);
+    close(cl->fd);
+    cl->fd = -1;
+    for (i = 0; i < INGEST_SOURCES; i++)
+        if (s->claim[i] == cl - s->client)
+            release(s, i);
+    arbitrate(s);
+}
+
+/*!
+ \brief Handler for a connection: execute all complete commands
+*/
+static void onClient(int fd, void *arg)
+{
+    client_t *cl = arg;
+    server_t *s = cl->server;
+    char *end;
+    int n;
+
+    n = recv(fd, cl->line + cl->len, LINE_LENGTH - 1 - cl->len, MSG_DONTWAIT);
+    if (n < 0 && (errno == EAGAIN || errno == EINTR))
+        return;
+    if (n <= 0)
+    {
+        clientClose(s, cl);
+        return;
+    }
+    cl->len += n;
+    cl->line[cl->len] = '\0';
+    while ((end = strchr(cl->line, '\n')) != NULL)
+    {
+        *end = '\0';
+        if (end > cl->line && end[-1] == '\r')
+            end[-1] = '\0';
+        command(s, cl, cl->line);
+        cl->len -= end + 1 - cl->line;
+        memmove(cl->line, end + 1, cl->len + 1);
+    }
+    if (cl->len == LINE_LENGTH - 1)
+        clientClose(s, cl);     // no command is that long
+}
+
+/*!
+ \brief Handler for the listening socket: accept a connection
+*/
+static void onAccept(int fd, void *arg)
+{
+    server_t *s = arg;
+    int i, cfd;
+
+    cfd = accept4(fd, NULL, NULL, SOCK_CLOEXEC | SOCK_NONBLOCK);
+    if (cfd == -1)
+        return;
+    for (i = 0; i < SERVER_MAX_CLIENTS; i++)
+        if (s->client[i].fd == -1)
+            break;
+    if (i == SERVER_MAX_CLIENTS || eventLoopAdd(&s->loop, cfd, onClient, &s->client[i]) != 0)
+    {
+        close(cfd);     // too many connections
+        return;
+    }
+    s->client[i].fd = cfd;
+    s->client[i].len = 0;
+}
+
+/*!
+ \brief Handler for the signalfd: stop the server
+*/
+static void onSignal(int fd, void *arg)
+{
+    server_t *s = arg;
+    struct signalfd_siginfo info;
+
+    if (read(fd, &info, sizeof(info)) == sizeof(info))
+        eventLoopStop(&s->loop);
+}
+
+/*!
+ \brief Create the listening socket /tmp/<name>.sock
+*/
+static int listenSocket(const char *name)
+{
+    struct sockaddr_un addr;
+    int fd;
+
+    memset(&addr, 0, sizeof(addr));
+    addr.sun_family = AF_UNIX;
+    snprintf(addr.sun_path, sizeof(addr.sun_path), "/tmp/%s.sock", name);
+    unlink(addr.sun_path);  // left over by a crashed server
+    fd = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+    if (fd == -1)
+        return -1;
+    if (bind(fd, (struct sockaddr *)&addr, sizeof(addr)) != 0 || listen(fd, SERVER_MAX_CLIENTS) != 0)
+    {
+        close(fd);
+        return -1;
+    }
+    return fd;
+}
+
+int serverRun(copter_t *c, const char *name, int numSlaves, const int safe[][4])
+{
+    static server_t server;     // ~1 KB of setpoints, not on the stack
+    server_t *s = &server;
+    sigset_t signals;
+    char path[108];
+    int i, signalFd, pollFd, result = -1;
+
+    memset(s, 0, sizeof(server_t));
+    s->copter = c;
+    s->numSlaves = numSlaves;
+    s->safe = safe;
+    s->winner = -1;
+    for (i = 0; i < SERVER_MAX_CLIENTS; i++)
+    {
+        s->client[i].server = s;
+        s->client[i].fd = -1;
+    }
+    for (i = 0; i < INGEST_SOURCES; i++)
+        release(s, i);
+
+    //Signals are only received via the signalfd
+    sigemptyset(&signals);
+    sigaddset(&signals, SIGINT);
+    sigaddset(&signals, SIGTERM);
+    sigaddset(&signals, SIGHUP);
+    sigaddset(&signals, SIGQUIT);
+    pthread_sigmask(SIG_BLOCK, &signals, NULL);
+    signalFd = signalfd(-1, &signals, SFD_CLOEXEC);
+    pollFd = periodicTimer(1000000000L / SERVER_POLL_RATE);
+    s->ingest = ingestCreate(name, numSlaves);
+    s->listenFd = listenSocket(name);
+
+    if (signalFd != -1 && pollFd != -1 && s->ingest != NULL && s->listenFd != -1 &&
+        eventLoopInit(&s->loop) == 0)
+    {
+        if (eventLoopAdd(&s->loop, signalFd, onSignal, s) == 0 &&
+            eventLoopAdd(&s->loop, pollFd, onPoll, s) == 0 &&
+            eventLoopAdd(&s->loop, s->listenFd, onAccept, s) == 0)
+        {
+            printf("Serving setpoints on /dev/shm/%s and /tmp/%s.sock\n", name, name);
+            fflush(stdout);     // stdout may be a log file
+            result = eventLoopRun(&s->loop);
+            printf("Setpoints received: pilot %lu, failsafe %lu, submitted %lu, overrides %lu, timeouts %lu\n",
+                   s->updates[INGEST_PILOT], s->updates[INGEST_FAILSAFE], s->submits, s->overrides, s->timeouts);
+        }
+        eventLoopClose(&s->loop);
+    }
+
+    for (i = 0; i < SERVER_MAX_CLIENTS; i++)
+        if (s->client[i].fd != -1)
+            close(s->client[i].fd);
+    if (s->listenFd != -1)
+    {
+        close(s->listenFd);
+        snprintf(path, sizeof(path), "/tmp/%s.sock", name);
+        unlink(path);
+    }
+    if (s->ingest != NULL)
+        ingestClose(s->ingest);
+    if (pollFd != -1)
+        close(pollFd);
+    if (signalFd != -1)
+        close(signalFd);
+    return result;
+}
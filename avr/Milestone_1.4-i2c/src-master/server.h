@@ -0,0 +1,46 @@
+/**
+    @file src-master/server.h
+    @brief server mode of the master: setpoints from other processes
+    @author Jan Sommer
+
+    The server owns the buses (through libcopter) and takes setpoints from:
+        - the shared memory mailboxes of co-located clients @sa ingest.h
+        - a Unix domain socket (/tmp/<name>.sock) for tools, one text command per line:
+            set <source> <slave> <ch1> <ch2> <ch3> <ch4>   the duty cycles of a slave, activates the source
+            release <source>                            deactivates the source
+            status                                      the active source and the counters
+          <source> is "pilot" or "failsafe". Every command is answered with one line
+          ("ok ...", or "error ...").
+
+    A source belongs to the transport which set it last: its mailbox or one connection.
+    The sources of a connection are released when it is closed, a source of a mailbox
+    which did not publish for SERVER_SOURCE_TIMEOUT ms (e.g. the client crashed) is
+    released by the server.
+
+    Arbitration: the setpoints of the active source with the highest priority are
+    submitted to libcopter, i.e. an active failsafe overrides the pilot. When the last
+    active source is released (or times out) the safe setpoints are submitted once,
+    until then the server keeps the setpoints it started with.
+*/
+
+#ifndef SERVER_H
+#define SERVER_H
+
+#include "copter.h"
+
+#define SERVER_POLL_RATE    1000    ///< Rate in Hz at which the shared memory mailboxes are polled
+#define SERVER_MAX_CLIENTS  8       ///< Maximum number of simultaneous socket connections
+#define SERVER_SOURCE_TIMEOUT 100   ///< Time in ms after which a source of a silent mailbox is released
+
+/*!
+ \brief Run the server until SIGINT, SIGTERM, SIGHUP or SIGQUIT
+
+ \param c the started device handle
+ \param name the name of the shared memory segment and the socket
+ \param numSlaves the number of slaves of @a c
+ \param safe the setpoints when no source is active (e.g. 0 or the idle duty cycle of the motors)
+ \return int 0 if the server was stopped by a signal otherwise -1
+*/
+int serverRun(copter_t *c, const char *name, int numSlaves, const int safe[][4]);
+
+#endif // SERVER_H
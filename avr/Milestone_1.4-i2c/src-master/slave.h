@@ -0,0 +1,54 @@
+/**
+    @file src-master/slave.h
+    @brief registers and commands of the ppm-slave (Milestone 1.4 firmware)
+    @author Jan Sommer
+
+    The slave behaves like an I2C-EEPROM: the first byte of a write sets the
+    buffer address, all further bytes are written to the rxbuffer. Reads return
+    the txbuffer which mirrors the accepted values @sa usiTwiSlave.h
+*/
+
+#ifndef SLAVE_H
+#define SLAVE_H
+
+#include <stdint.h>
+
+#define PPM_SLAVE_ADDR  0b0011010   ///< Address of the I2C-slave @sa SLAVE_ADDR_ATTINY
+/**
+    The first "register" of the I2C-slave.
+    As it is only a buffer array the address space starts with 0.
+*/
+#define STARTREGISTER 0
+#define CONTROL_REGISTER    8       ///< Control register of the slave @sa CONTROL_REGISTER (slave)
+#define ADDRESS_REGISTER    9       ///< Own address of the slave (txbuffer) @sa ADDRESS_REGISTER (slave)
+#define CTRL_SYNC_LATCH     0x01    ///< Control bit for the synchronized mode @sa CTRL_SYNC_LATCH (slave)
+#define GENERAL_CALL_COMMAND 0x80   ///< First byte of a general call >= this value is a command @sa GENERAL_CALL_COMMAND
+#define GENERAL_CALL_LATCH  0x80    ///< General call command to apply staged values @sa GENERAL_CALL_LATCH (slave)
+#define PACKED_REGISTER     10      ///< First register of the packed frame @sa PACKED_REGISTER (slave)
+#define PACKED_LENGTH       7       ///< Length of the packed frame including the CRC8 @sa PACKED_LENGTH (slave)
+#define REJECTED_REGISTER   10      ///< Counter of rejected packed frames @sa REJECTED_REGISTER (slave)
+#define SLAVE_BUFFER_SIZE   17      ///< Size of the rx- and txbuffer of the slave @sa buffer_size
+#define MAX_DUTY_CYCLE      8191    ///< Largest duty cycle of a channel (2 ms pulse)
+
+#define uniq(LOW,HEIGHT)	((HEIGHT << 8)|LOW)			  // Create 16 bit number from two bytes
+#define LOW_BYTE(x)        	(x & 0xff)					    // Get low byte from 16 bit number
+#define HIGH_BYTE(x)       	((x >> 8) & 0xff)			  // Get high byte from 16 bit number
+
+/*!
+ \brief Calculate the CRC8 (polynomial 0x07, init 0) @sa _crc8_ccitt_update (avr-libc)
+
+ \param crc the CRC of the previous data
+ \param data the next byte
+ \return uint8_t the updated CRC
+*/
+static inline uint8_t crc8(uint8_t crc, uint8_t data)
+{
+    int i;
+
+    crc ^= data;
+    for (i = 0; i < 8; i++)
+        crc = (crc & 0x80) ? (crc << 1) ^ 0x07 : (crc << 1);
+    return crc;
+}
+
+#endif // SLAVE_H
@@ -0,0 +1,506 @@
+/**
+    @file src-master/slaveEmulator.c
+    @brief transport backend which emulates the ppm-slaves in the process of the master
+    @author Jan Sommer
+
+    The emulator reproduces the EEPROM-like register semantics of the USI TWI slave
+    driver (buffer address, rx-/txbuffer, general call commands) and the register
+    processing of the Milestone 1.4 firmware (16 bit and packed duty cycles, CRC8
+    check, synchronized mode with the latch at the frame boundary of the PPM signal).
+    EMU_SLAVES slaves answer on the addresses PPM_SLAVE_ADDR, PPM_SLAVE_ADDR+1, ...
+    like slaves with different strap pins.
+    An MPU-6050 compatible IMU answers on IMU_ADDR: WHO_AM_I, sleep mode and a burst
+    read of the measurements of a synthetic motion (the copter rocks around roll and
+    pitch and lies level on average).
+
+    Optionally the time on the bus is emulated: every transfer takes as long as it
+    would take on a bus with the given clock (9 bits per byte plus start and stop).
+    Optionally the main loop of the slave is emulated too: the ISR only stores the index
+    of the last received register (receivedNewValue), which the main loop picks up when it
+    is idle and processes for the given loop time. A register which is overwritten by the
+    next byte before the main loop picked it up is never processed, and a readback before
+    the processing returns the old mirror, like a slave which falls behind the bus.
+    All methods of the transport are emulated @sa transportSetMethod: without repeated
+    starts every transaction is processed (and takes its bus time) on its own, and the
+    limits of SMBus transactions are checked like the kernel does.
+*/
+
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <time.h>
+#include <math.h>
+#include <pthread.h>
+#include <stdatomic.h>
+#include "transport.h"
+#include "slaveEmulator.h"
+#include "slave.h"
+#include "imu.h"
+#include "realtime.h"
+
+#define PPM_FRAME_NS    4096000L    ///< Length of a PPM frame (2^15 clocks at 8 MHz) @sa ppmInit
+
+/**
+    @brief state of one emulated slave
+*/
+typedef struct
+{
+    uint8_t address;                        ///< 7 bit address
+    uint8_t rxbuffer[SLAVE_BUFFER_SIZE];    ///< @sa rxbuffer
+    uint8_t txbuffer[SLAVE_BUFFER_SIZE];    ///< @sa txbuffer
+    uint8_t buffer_adr;                     ///< @sa buffer_adr
+    uint8_t control;                        ///< @sa control
+    uint16_t dutyCycles[4];                 ///< applied duty cycles (without the offsets of the channels)
+    uint16_t stagedCycles[4];               ///< @sa stagedCycles
+    uint16_t latchedCycles[4];              ///< @sa latchedCycles
+    long long latchTime;                    ///< time of the frame boundary where latchedCycles are applied, 0 if none
+    int receivedNewValue;                   ///< @sa receivedNewValue (-1 == none, only with a loop time)
+    long long receivedTime;                 ///< time when receivedNewValue was written
+    long long idleTime;                     ///< time when the main loop finished the last register
+} emuSlave_t;
+
+/**
+    @brief state of the emulated IMU
+*/
+typedef struct
+{
+    uint8_t reg[128];                       ///< the registers
+    uint8_t pointer;                        ///< register of the next access
+} emuImu_t;
+
+/**
+    @brief data of the emulator backend
+*/
+typedef struct
+{
+    emuSlave_t slave[EMU_SLAVES];   ///< the emulated slaves
+    emuImu_t imu;                   ///< the emulated IMU
+    long busClock;                  ///< emulated bus clock in Hz, 0 == no bus time
+    long loopTime;                  ///< time of the main loop of a slave to process a register in ns, 0 == at once
+    atomic_llong stalledUntil;      ///< the bus hangs until this time @sa emulatorStall
+    long long start;                ///< time of the first PPM frame
+    pthread_mutex_t lock;           ///< the emulator may be used by several threads
+} emulator_t;
+
+/*!
+ \brief Apply the latched duty cycles if the frame boundary passed (ISR TIMER1_CAPT_vect)
+*/
+static void emuFrame(emuSlave_t *s, long long now)
+{
+    if (s->latchTime != 0 && now >= s->latchTime)
+    {
+        memcpy(s->dutyCycles, s->latchedCycles, sizeof(s->dutyCycles));
+        s->latchTime = 0;
+    }
+}
+
+/*!
+ \brief Apply or stage a duty cycle @sa setDutyCycle
+*/
+static void emuSetDutyCycle(emuSlave_t *s, int ch, uint16_t value)
+{
+    if (s->control & CTRL_SYNC_LATCH)
+        s->stagedCycles[ch] = value;
+    else
+        s->dutyCycles[ch] = value;
+}
+
+/*!
+ \brief Check and apply a packed frame @sa processPackedFrame
+*/
+static void emuPackedFrame(emuSlave_t *s)
+{
+    uint8_t *frame = &s->rxbuffer[PACKED_REGISTER];
+    uint8_t crc = crc8(0, PACKED_REGISTER);
+    uint16_t value[4];
+    int i;
+
+    for (i = 0; i < PACKED_LENGTH; i++)
+        crc = crc8(crc, frame[i]);
+    if (crc != 0)
+    {
+        s->txbuffer[REJECTED_REGISTER]++;
+        return;
+    }
+    value[0] = (uniq(frame[1], frame[0]) >> 4) << 1;
+    value[1] = (uniq(frame[2], frame[1]) & 0x0fff) << 1;
+    value[2] = (uniq(frame[4], frame[3]) >> 4) << 1;
+    value[3] = (uniq(frame[5], frame[4]) & 0x0fff) << 1;
+    for (i = 0; i < 4; i++)
+    {
+        emuSetDutyCycle(s, i, value[i]);
+        s->txbuffer[2*i]   = HIGH_BYTE(value[i]);
+        s->txbuffer[2*i+1] = LOW_BYTE(value[i]);
+    }
+}
+
+/*!
+ \brief Process a register which was written by the master @sa processRegister
+*/
+static void emuRegister(emuSlave_t *s, uint8_t index)
+{
+    int ch;
+
+    if (index < 8 && (index & 1))
+    {
+        ch = index / 2;
+        emuSetDutyCycle(s, ch, uniq(s->rxbuffer[index], s->rxbuffer[index - 1]));
+        s->txbuffer[index - 1] = s->rxbuffer[index - 1];
+        s->txbuffer[index]     = s->rxbuffer[index];
+    }
+    else if (index == CONTROL_REGISTER)
+    {
+        s->control = s->rxbuffer[CONTROL_REGISTER];
+        s->txbuffer[CONTROL_REGISTER] = s->control;
+    }
+    else if (index == PACKED_REGISTER + PACKED_LENGTH - 1)
+    {
+        emuPackedFrame(s);
+    }
+}
+
+/*!
+ \brief Time on the bus of @a bits in ns (0 without bus clock)
+*/
+static long long emuBusTime(const emulator_t *emu, long bits)
+{
+    return emu->busClock > 0 ? bits * 1000000000LL / emu->busClock : 0;
+}
+
+/*!
+ \brief Let the main loop of the slave run until @a now (the main loop of the firmware)
+
+ The main loop picks up the last received register as soon as it is idle. If the
+ register is overwritten before, the ISR already replaced receivedNewValue.
+*/
+static void emuMainLoop(const emulator_t *emu, emuSlave_t *s, long long now)
+{
+    long long start;
+
+    if (s->receivedNewValue < 0)
+        return;
+    start = s->idleTime > s->receivedTime ? s->idleTime : s->receivedTime;
+    if (start >= now)
+        return;
+    emuRegister(s, s->receivedNewValue);
+    s->receivedNewValue = -1;
+    s->idleTime = start + emu->loopTime;
+}
+
+/*!
+ \brief A register was received at @a time: processed at once or by the emulated main loop
+*/
+static void emuReceived(const emulator_t *emu, emuSlave_t *s, uint8_t index, long long time)
+{
+    if (emu->loopTime == 0)
+    {
+        emuRegister(s, index);
+        return;
+    }
+    s->receivedNewValue = index;
+    s->receivedTime = time;
+}
+
+/*!
+ \brief Receive a write message @sa USI_SLAVE_GET_DATA_AND_SEND_ACK
+
+ \param now the time of the start of the message
+*/
+static void emuWrite(emulator_t *emu, emuSlave_t *s, busMsg_t *msg, long long now)
+{
+    int generalCall = (msg->addr == 0);
+    long long time;
+    int i;
+
+    s->buffer_adr = 0xFF;
+    for (i = 0; i < msg->len; i++)
+    {
+        uint8_t data = msg->buf[i];
+
+        time = now + emuBusTime(emu, 1 + 9 * (2 + i));    // the byte is complete
+        if (emu->loopTime > 0)
+            emuMainLoop(emu, s, time);
+
+        if (s->buffer_adr == 0xFF)
+        {
+            if (generalCall && data >= GENERAL_CALL_COMMAND)
+            {
+                if (data == GENERAL_CALL_LATCH)
+                {
+                    memcpy(s->latchedCycles, s->stagedCycles, sizeof(s->latchedCycles));
+                    s->latchTime = emu->start + ((now - emu->start) / PPM_FRAME_NS + 1) * PPM_FRAME_NS;
+                }
+                s->buffer_adr = SLAVE_BUFFER_SIZE;
+            }
+            else
+                s->buffer_adr = data <= SLAVE_BUFFER_SIZE ? data : 0;
+        }
+        else if (s->buffer_adr < SLAVE_BUFFER_SIZE)
+        {
+            s->rxbuffer[s->buffer_adr] = data;
+            emuReceived(emu, s, s->buffer_adr, time);
+            s->buffer_adr++;
+        }
+    }
+}
+
+/*!
+ \brief Send a read message @sa USI_SLAVE_SEND_DATA
+
+ \param now the time of the start of the message
+*/
+static void emuRead(emulator_t *emu, emuSlave_t *s, busMsg_t *msg, long long now)
+{
+    int i;
+
+    if (emu->loopTime > 0)
+        emuMainLoop(emu, s, now + emuBusTime(emu, 10));   // the first byte is sent after the address
+    if (s->buffer_adr == 0xFF)
+        s->buffer_adr = 0;
+    for (i = 0; i < msg->len; i++)
+    {
+        msg->buf[i] = s->buffer_adr < SLAVE_BUFFER_SIZE ? s->txbuffer[s->buffer_adr] : 0xFF;
+        s->buffer_adr++;
+    }
+}
+
+/*!
+ \brief Store a 16 bit value big endian in the registers of the IMU
+*/
+static void emuImuValue(emuImu_t *imu, int reg, double value)
+{
+    int16_t raw = (int16_t)lround(value);
+
+    imu->reg[reg] = (uint16_t)raw >> 8;
+    imu->reg[reg + 1] = raw & 0xFF;
+}
+
+/*!
+ \brief Update the measurements of the IMU to the time @a now (unless it sleeps)
+*/
+static void emuImuMeasure(emulator_t *emu, long long now)
+{
+    emuImu_t *imu = &emu->imu;
+    double t = (now - emu->start) / 1e9;
+    double roll = 10 * sin(2 * M_PI * 0.5 * t), pitch = 5 * sin(2 * M_PI * 0.3 * t);
+
+    if (imu->reg[IMU_PWR_MGMT_1] & IMU_SLEEP)
+        return;
+    emuImuValue(imu, IMU_DATA,      -sin(pitch * M_PI / 180) * IMU_ACCEL_LSB);
+    emuImuValue(imu, IMU_DATA + 2,  sin(roll * M_PI / 180) * IMU_ACCEL_LSB);
+    emuImuValue(imu, IMU_DATA + 4,  cos(roll * M_PI / 180) * cos(pitch * M_PI / 180) * IMU_ACCEL_LSB);
+    emuImuValue(imu, IMU_DATA + 6,  (25.0 - 36.53) * 340);     // 25 deg C
+    emuImuValue(imu, IMU_DATA + 8,  10 * 2 * M_PI * 0.5 * cos(2 * M_PI * 0.5 * t) * IMU_GYRO_LSB);
+    emuImuValue(imu, IMU_DATA + 10, 5 * 2 * M_PI * 0.3 * cos(2 * M_PI * 0.3 * t) * IMU_GYRO_LSB);
+    emuImuValue(imu, IMU_DATA + 12, 0);
+}
+
+/*!
+ \brief A message to the IMU: a write sets the register pointer and writes the following
+        registers, a read returns the registers from the pointer on
+*/
+static void emuImu(emulator_t *emu, busMsg_t *msg, long long now)
+{
+    emuImu_t *imu = &emu->imu;
+    int i;
+
+    if (msg->flags & BUS_READ)
+    {
+        if (imu->pointer >= IMU_DATA && imu->pointer < IMU_DATA + IMU_DATA_LENGTH)
+            emuImuMeasure(emu, now);
+        for (i = 0; i < msg->len; i++)
+            msg->buf[i] = imu->reg[imu->pointer++ & 0x7F];
+        return;
+    }
+    if (msg->len > 0)
+        imu->pointer = msg->buf[0] & 0x7F;
+    for (i = 1; i < msg->len; i++)
+    {
+        if (imu->pointer == IMU_PWR_MGMT_1)     // the other registers are read-only here
+            imu->reg[imu->pointer] = msg->buf[i];
+        imu->pointer = (imu->pointer + 1) & 0x7F;
+    }
+}
+
+/*!
+ \brief Find the slave with the address @a addr
+*/
+static emuSlave_t *emuSlave(emulator_t *emu, int addr)
+{
+    int i;
+
+    for (i = 0; i < EMU_SLAVES; i++)
+        if (emu->slave[i].address == addr)
+            return &emu->slave[i];
+    return NULL;
+}
+
+/*!
+ \brief Check if the messages of a transaction can be sent as SMBus transaction @sa i2cSmbus
+*/
+static int emuSmbusValid(const busMsg_t *msgs, int n)
+{
+    if (n == 2)
+        return msgs[1].len <= SMBUS_BLOCK_MAX;
+    if (msgs[0].flags & BUS_READ)
+        return msgs[0].len == 1;
+    return msgs[0].len >= 1 && msgs[0].len <= SMBUS_BLOCK_MAX + 1;
+}
+
+/*!
+ \brief Process the messages of one transaction (separated by repeated starts) and wait for its bus time
+
+ \return int the number of messages acknowledged by a slave
+*/
+static int emuTransaction(emulator_t *emu, busMsg_t *msgs, int n)
+{
+    struct timespec busTime;
+    long long now = nowNs();
+    long bits = 0;
+    int i, j, done = 0;
+
+    pthread_mutex_lock(&emu->lock);
+    for (i = 0; i < EMU_SLAVES; i++)
+    {
+        emuMainLoop(emu, &emu->slave[i], now);
+        emuFrame(&emu->slave[i], now);
+    }
+
+    for (i = 0; i < n; i++)
+    {
+        emuSlave_t *s = emuSlave(emu, msgs[i].addr);
+        long long start = now + emuBusTime(emu, bits);
+
+        bits += 2 + 9 * (1 + msgs[i].len);  // (repeated) start, address, data, stop
+        if (msgs[i].addr == 0 && !(msgs[i].flags & BUS_READ))
+        {
+            for (j = 0; j < EMU_SLAVES; j++)
+                emuWrite(emu, &emu->slave[j], &msgs[i], start);
+        }
+        else if (msgs[i].addr == IMU_ADDR)
+            emuImu(emu, &msgs[i], now);
+        else if (s == NULL)
+        {
+            errno = ENXIO;  // address not acknowledged
+            break;
+        }
+        else if (msgs[i].flags & BUS_READ)
+            emuRead(emu, s, &msgs[i], start);
+        else
+            emuWrite(emu, s, &msgs[i], start);
+        done++;
+    }
+    pthread_mutex_unlock(&emu->lock);
+
+    if (emu->busClock > 0)
+    {
+        long long ns = emuBusTime(emu, bits);
+        busTime.tv_sec  = ns / 1000000000LL;
+        busTime.tv_nsec = ns % 1000000000LL;
+        nanosleep(&busTime, NULL);
+    }
+    return done;
+}
+
+static int emuTransfer(transport_t *t, busMsg_t *msgs, int n)
+{
+    emulator_t *emu = t->priv;
+    int i, len;
+
+    if (nowNs() < atomic_load(&emu->stalledUntil))
+    {
+        errno = ETIMEDOUT;  // SDA is held low, the adapter gives up
+        return -1;
+    }
+    for (i = 0; i < n; i += len)
+    {
+        len = transportTransaction(t, &msgs[i], n - i);
+        if (t->method == TRANSPORT_SMBUS && !emuSmbusValid(&msgs[i], len))
+        {
+            errno = EMSGSIZE;
+            return -1;
+        }
+        if (emuTransaction(emu, &msgs[i], len) != len)
+            return -1;      // errno is ENXIO
+    }
+    return n;
+}
+
+static void emuClose(transport_t *t)
+{
+    emulator_t *emu = t->priv;
+
+    pthread_mutex_destroy(&emu->lock);
+    free(emu);
+}
+
+transport_t *emulatorOpen(long busClock, long loopTime)
+{
+    transport_t *t = calloc(1, sizeof(transport_t));
+    emulator_t *emu = calloc(1, sizeof(emulator_t));
+    int i;
+
+    if (t == NULL || emu == NULL)
+    {
+        free(t);
+        free(emu);
+        return NULL;
+    }
+    for (i = 0; i < EMU_SLAVES; i++)
+    {
+        emu->slave[i].address = PPM_SLAVE_ADDR + i;
+        emu->slave[i].txbuffer[ADDRESS_REGISTER] = PPM_SLAVE_ADDR + i;
+        emu->slave[i].buffer_adr = 0xFF;
+        emu->slave[i].receivedNewValue = -1;
+    }
+    emu->imu.reg[IMU_WHO_AM_I] = IMU_ID;
+    emu->imu.reg[IMU_PWR_MGMT_1] = IMU_SLEEP;
+    emu->busClock = busClock;
+    emu->loopTime = loopTime;
+    emu->start = nowNs();
+    pthread_mutex_init(&emu->lock, NULL);
+
+    t->name     = "emulator";
+    t->fd       = -1;
+    t->methods  = (1 << TRANSPORT_WRITE) | (1 << TRANSPORT_SMBUS) | (1 << TRANSPORT_RDWR);
+    t->transfer = emuTransfer;
+    t->close    = emuClose;
+    t->priv     = emu;
+    return t;
+}
+
+int emulatorDutyCycles(transport_t *t, int addr, int value[4])
+{
+    emulator_t *emu = t->priv;
+    emuSlave_t *s;
+    int i;
+
+    pthread_mutex_lock(&emu->lock);
+    s = emuSlave(emu, addr);
+    if (s != NULL)
+    {
+        emuMainLoop(emu, s, nowNs());
+        emuFrame(s, nowNs());
+        for (i = 0; i < 4; i++)
+            value[i] = s->dutyCycles[i];
+    }
+    pthread_mutex_unlock(&emu->lock);
+    return s != NULL ? 0 : -1;
+}
+
+int emulatorStall(transport_t *t, long ms)
+{
+    busRequest_t req;
+    int result = 0;
+
+    schedulerAcquire(&t->scheduler, &req);      // the backend is not replaced meanwhile @sa transportReplace
+    if (t->transfer == emuTransfer)
+        atomic_store(&((emulator_t *)t->priv)->stalledUntil, nowNs() + ms * 1000000LL);
+    else
+    {
+        errno = ENODEV;
+        result = -1;
+    }
+    schedulerRelease(&t->scheduler, &req, 0);
+    return result;
+}
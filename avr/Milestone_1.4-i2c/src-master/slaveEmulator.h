@@ -0,0 +1,36 @@
+/**
+    @file src-master/slaveEmulator.h
+    @brief transport backend which emulates the ppm-slaves in the process of the master
+    @author Jan Sommer
+*/
+
+#ifndef SLAVE_EMULATOR_H
+#define SLAVE_EMULATOR_H
+
+#include "transport.h"
+
+#define EMU_SLAVES  4   ///< Number of emulated slaves (addresses PPM_SLAVE_ADDR ... PPM_SLAVE_ADDR+3)
+
+/*!
+ \brief Get the duty cycles which the emulated slave currently outputs
+
+ \param t the transport opened by emulatorOpen()
+ \param addr the address of the slave
+ \param value the duty cycles of the 4 channels (0..8191)
+ \return int 0 if successful, -1 if there is no slave with this address
+*/
+int emulatorDutyCycles(transport_t *t, int addr, int value[4]);
+
+/*!
+ \brief Let an emulated bus hang (every transfer fails with ETIMEDOUT) like a stuck I2C-bus
+
+ Only this bus hangs, other buses and handles go on. Reopening the bus (the recovery
+ of libcopter) opens a new emulator, which ends the stall.
+
+ \param t the transport opened by emulatorOpen()
+ \param ms the duration in ms
+ \return int 0 if successful, -1 if @a t is no emulator (errno is ENODEV)
+*/
+int emulatorStall(transport_t *t, long ms);
+
+#endif // SLAVE_EMULATOR_H
@@ -0,0 +1,111 @@
+/**
+    @file src-master/stream.c
+    @brief headless streaming of setpoint vectors (thrust-stand sweeps, automated tests)
+    @author Jan Sommer
+*/
+
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <errno.h>
+#include <time.h>
+#include "stream.h"
+#include "realtime.h"
+
+#define LINE_LENGTH     512     ///< Maximum length of a line of the text format
+
+int streamReadText(void *arg, int numSlaves, int value[][4], long long *time)
+{
+    char line[LINE_LENGTH];
+    char *p, *end;
+    int i;
+
+    do
+    {
+        if (fgets(line, sizeof(line), arg) == NULL)
+            return ferror((FILE *)arg) ? -1 : 0;
+        for (p = line; *p == ' ' || *p == '\t'; p++)
+            ;
+    } while (*p == '#' || *p == '\n' || *p == '\r' || *p == '\0');    // empty line or comment
+
+    *time = -1;
+    if (*p == '@')
+    {
+        *time = strtod(p + 1, &end) * 1e9;
+        if (end == p + 1)
+            return STREAM_INVALID;
+        p = end;
+    }
+    for (i = 0; i < 4 * numSlaves; i++)
+    {
+        value[i / 4][i % 4] = strtol(p, &end, 0);
+        if (end == p)
+            return STREAM_INVALID;
+        p = end;
+    }
+    return 1;
+}
+
+int streamReadBinary(void *arg, int numSlaves, int value[][4], long long *time)
+{
+    uint8_t record[STREAM_RECORD_SIZE(COPTER_MAX_SLAVES)];
+    int i;
+
+    if (fread(record, STREAM_RECORD_SIZE(numSlaves), 1, arg) != 1)
+        return ferror((FILE *)arg) ? -1 : 0;
+    *time = (record[0] | record[1] << 8 | record[2] << 16 | (uint32_t)record[3] << 24) * 1000LL;
+    for (i = 0; i < 4 * numSlaves; i++)
+        value[i / 4][i % 4] = record[4 + 2*i] | record[5 + 2*i] << 8;
+    return 1;
+}
+
+/*!
+ \brief Wait until the time of a vector
+
+ \return long the delay after the time of the vector in ns
+*/
+static long waitFor(long long deadline)
+{
+    struct timespec ts = {deadline / 1000000000LL, deadline % 1000000000LL};
+
+    while (clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &ts, NULL) == EINTR)
+        ;
+    return nowNs() - deadline;
+}
+
+int streamRun(copter_t *c, int numSlaves, streamNext_t next, void *arg, int timed, streamStats_t *stats)
+{
+    int value[COPTER_MAX_SLAVES][4];
+    long long start = 0, first = 0, time, last = 0;
+    long late;
+    int result;
+
+    memset(stats, 0, sizeof(streamStats_t));
+    while ((result = next(arg, numSlaves, value, &time)) > 0)
+    {
+        if (result == STREAM_INVALID)
+        {
+            stats->invalid++;
+            continue;
+        }
+
+        if (stats->vectors == 0)
+        {
+            first = nowNs();
+            start = first - (timed && time > 0 ? time : 0);    // the first vector is sent at once
+        }
+        if (timed && time >= 0)
+        {
+            late = waitFor(start + time);
+            if (late > stats->maxLate)
+                stats->maxLate = late;
+            stats->sumLate += late;
+        }
+        if (copterSend(c, (const int (*)[4])value) != 0)
+            stats->failed++;
+        stats->vectors++;
+        last = nowNs();
+    }
+    stats->elapsed = last - first;
+    return result;
+}
@@ -0,0 +1,79 @@
+/**
+    @file src-master/stream.h
+    @brief headless streaming of setpoint vectors (thrust-stand sweeps, automated tests)
+    @author Jan Sommer
+
+    A stream is a sequence of vectors with the 4 duty cycles of every slave, read from
+    stdin or a file in one of two formats:
+        - text: one vector per line, the duty cycles separated by white space, optionally
+          preceded by the time of the vector "@<seconds>". Empty lines and lines starting
+          with '#' are ignored. Example: "@0.004 4096 4096 4096 4096"
+        - binary: fixed records of STREAM_RECORD_SIZE(numSlaves) bytes, little endian:
+          uint32 time in us, then uint16 duty cycles (4 per slave)
+
+    Every vector is sent with copterSend() as soon as it is read, or at its time
+    (relative to the first vector) in timed mode. Other sources of vectors (e.g. a
+    recording @sa recorder.h) use the same loop with their own streamNext_t.
+*/
+
+#ifndef STREAM_H
+#define STREAM_H
+
+#include <stdio.h>
+#include "copter.h"
+
+#define STREAM_RECORD_SIZE(numSlaves)   (4 + 8 * (numSlaves))   ///< Size of a binary record in bytes
+#define STREAM_INVALID  2       ///< streamNext_t: the input was invalid and skipped
+
+/*!
+ \brief Source of the vectors of a stream
+
+ \param arg the argument given to streamRun()
+ \param numSlaves the number of slaves
+ \param value the duty cycles of the next vector
+ \param time the time of the vector in ns, -1 if it has none
+ \return int 1 for a vector, STREAM_INVALID for skipped input, 0 at the end, -1 on error
+*/
+typedef int (*streamNext_t)(void *arg, int numSlaves, int value[][4], long long *time);
+
+/**
+    @brief result of a stream, all times in ns
+*/
+typedef struct
+{
+    unsigned long vectors;      ///< number of vectors which were sent
+    unsigned long failed;       ///< vectors which were not delivered
+    unsigned long invalid;      ///< lines or records which could not be parsed (skipped)
+    long long elapsed;          ///< time from the first to the last vector
+    long maxLate;               ///< timed mode: largest delay of a vector after its time
+    long long sumLate;          ///< timed mode: sum of the delays for the average
+} streamStats_t;
+
+/*!
+ \brief Source for text lines @sa streamNext_t
+
+ \param arg the FILE of the stream
+*/
+int streamReadText(void *arg, int numSlaves, int value[][4], long long *time);
+
+/*!
+ \brief Source for binary records @sa streamNext_t
+
+ \param arg the FILE of the stream
+*/
+int streamReadBinary(void *arg, int numSlaves, int value[][4], long long *time);
+
+/*!
+ \brief Send all vectors of a stream
+
+ \param c the device handle (not started)
+ \param numSlaves the number of slaves of @a c
+ \param next the source of the vectors (e.g. streamReadText)
+ \param arg the argument of @a next
+ \param timed 1: send every vector at its time, 0: as fast as possible
+ \param stats the result
+ \return int 0 at the end of the stream, -1 on a read error
+*/
+int streamRun(copter_t *c, int numSlaves, streamNext_t next, void *arg, int timed, streamStats_t *stats);
+
+#endif // STREAM_H
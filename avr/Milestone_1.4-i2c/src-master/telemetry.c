@@ -0,0 +1,127 @@
+/**
+    @file src-master/telemetry.c
+    @brief telemetry of libcopter in shared memory for monitoring tools
+    @author Jan Sommer
+
+    Seqlock: the writer makes the sequence odd, changes the data and makes it even
+    again. A reader copies the data between two loads of the sequence and accepts
+    the copy only if both loads returned the same even value.
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <errno.h>
+#include <sched.h>
+#include <sys/mman.h>
+#include "telemetry.h"
+
+/*!
+ \brief Map the segment with the file descriptor @a fd
+*/
+static telemetry_t *telemetryMap(const char *name, int fd, int prot)
+{
+    telemetry_t *t = calloc(1, sizeof(telemetry_t));
+
+    if (t == NULL)
+        return NULL;
+    t->shm = mmap(NULL, sizeof(telemetryShm_t), prot, MAP_SHARED, fd, 0);
+    if (t->shm == MAP_FAILED)
+    {
+        free(t);
+        return NULL;
+    }
+    snprintf(t->name, sizeof(t->name), "/%s", name);
+    return t;
+}
+
+telemetry_t *telemetryCreate(const char *name)
+{
+    char path[64];
+    telemetry_t *t;
+    int fd;
+
+    snprintf(path, sizeof(path), "/%s", name);
+    shm_unlink(path);   // a segment left over by a crashed writer
+    fd = shm_open(path, O_RDWR | O_CREAT | O_EXCL | O_CLOEXEC, 0644);
+    if (fd == -1)
+        return NULL;
+    if (ftruncate(fd, sizeof(telemetryShm_t)) != 0)
+    {
+        close(fd);
+        shm_unlink(path);
+        return NULL;
+    }
+    t = telemetryMap(name, fd, PROT_READ | PROT_WRITE);
+    close(fd);
+    if (t == NULL)
+    {
+        shm_unlink(path);
+        return NULL;
+    }
+    t->owner = 1;
+    return t;
+}
+
+telemetry_t *telemetryOpen(const char *name)
+{
+    char path[64];
+    telemetry_t *t;
+    int fd;
+
+    snprintf(path, sizeof(path), "/%s", name);
+    fd = shm_open(path, O_RDONLY | O_CLOEXEC, 0);
+    if (fd == -1)
+        return NULL;
+    t = telemetryMap(name, fd, PROT_READ);
+    close(fd);
+    return t;
+}
+
+telemetryData_t *telemetryBegin(telemetry_t *t)
+{
+    unsigned seq = atomic_load_explicit(&t->shm->sequence, memory_order_relaxed);
+
+    atomic_store_explicit(&t->shm->sequence, seq + 1, memory_order_relaxed);
+    atomic_thread_fence(memory_order_release);  // the odd sequence is visible before any change of the data
+    return &t->shm->data;
+}
+
+void telemetryEnd(telemetry_t *t)
+{
+    unsigned seq = atomic_load_explicit(&t->shm->sequence, memory_order_relaxed);
+
+    atomic_store_explicit(&t->shm->sequence, seq + 1, memory_order_release);
+}
+
+void telemetryRead(telemetry_t *t, telemetryData_t *data)
+{
+    unsigned before, after;
+
+    for (;;)
+    {
+        before = atomic_load_explicit(&t->shm->sequence, memory_order_acquire);
+        if (before & 1)
+        {
+            t->retries++;
+            sched_yield();      // the writer is in the middle of an update
+            continue;
+        }
+        memcpy(data, &t->shm->data, sizeof(telemetryData_t));
+        atomic_thread_fence(memory_order_acquire);  // the copy is complete before the sequence is checked
+        after = atomic_load_explicit(&t->shm->sequence, memory_order_relaxed);
+        if (before == after)
+            return;
+        t->retries++;
+    }
+}
+
+void telemetryClose(telemetry_t *t)
+{
+    if (t->owner)
+        shm_unlink(t->name);
+    munmap(t->shm, sizeof(telemetryShm_t));
+    free(t);
+}
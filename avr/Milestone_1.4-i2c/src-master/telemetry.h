@@ -0,0 +1,122 @@
+/**
+    @file src-master/telemetry.h
+    @brief telemetry of libcopter in shared memory for monitoring tools
+    @author Jan Sommer
+
+    After every update the control thread of libcopter writes what the motors are
+    doing into a shared memory segment (/dev/shm/<name>) @sa copterExport
+    The segment is protected by a seqlock: the writer never waits for a reader and
+    never makes a system call, it only increments the sequence counter before and
+    after writing. Any number of readers (other processes) copy the telemetry and
+    retry if the sequence counter changed meanwhile. Readers only need read access
+    to the segment, no access to the bus.
+
+    Typical use by a monitoring tool:
+    @code
+    telemetry_t *t = telemetryOpen(TELEMETRY_NAME);
+    telemetryData_t data;
+    telemetryRead(t, &data);
+    @endcode
+*/
+
+#ifndef TELEMETRY_H
+#define TELEMETRY_H
+
+#include <stddef.h>
+#include <stdatomic.h>
+#include "copter.h"
+
+#define TELEMETRY_NAME  "copter-telemetry"  ///< Default name of the segment
+#define TELEMETRY_LATENCY_TICKS 50          ///< The latencies are summarized every this many updates
+
+/**
+    @brief the telemetry of one update, all times in ns
+*/
+typedef struct
+{
+    unsigned long updates;                  ///< number of updates so far
+    long long time;                         ///< CLOCK_MONOTONIC of the update
+    int delivered;                          ///< 1 if the update was delivered to all slaves
+    int numSlaves;                          ///< number of slaves
+    int numBuses;                           ///< number of buses
+    int setpoint[COPTER_MAX_SLAVES][4];     ///< the duty cycles which were sent
+    int readback[COPTER_MAX_SLAVES][4];     ///< the duty cycles which the slaves mirrored (verified mode only)
+    int verified;                           ///< 1 if @a readback is valid (verified mode)
+    int failed;                             ///< @sa copterStats_t::failed
+    int verifyFailures;                     ///< @sa copterStats_t::verifyFailures
+    int slaveFailures[COPTER_MAX_SLAVES];   ///< @sa copterStats_t::slaveFailures
+    int missedTicks;                        ///< @sa copterStats_t::missedTicks
+    unsigned long retries;                  ///< @sa copterStats_t::retries
+    unsigned long lostUpdates;              ///< @sa copterStats_t::lostUpdates
+    int recoveries;                         ///< @sa copterStats_t::recoveries
+    latency_t writeLatency[COPTER_MAX_BUSES]; ///< latency of the transfers which only write of each bus
+    latency_t readLatency[COPTER_MAX_BUSES];  ///< latency of the transfers which read of each bus
+} telemetryData_t;
+
+/**
+    @brief the shared memory segment
+*/
+typedef struct
+{
+    atomic_uint sequence;   ///< odd while the writer changes @a data
+    telemetryData_t data;   ///< the telemetry
+} telemetryShm_t;
+
+/**
+    @brief a mapping of the segment
+*/
+typedef struct
+{
+    telemetryShm_t *shm;    ///< the mapped segment
+    char name[64];          ///< name of the segment
+    int owner;              ///< 1 for the writer (removes the segment on close)
+    unsigned long retries;  ///< number of reads which had to be repeated (reader side)
+} telemetry_t;
+
+/*!
+ \brief Create the segment (writer side)
+
+ \param name the name of the segment (without '/')
+ \return telemetry_t* the segment or NULL on error (errno is set)
+*/
+telemetry_t *telemetryCreate(const char *name);
+
+/*!
+ \brief Map the segment of a running writer read-only (reader side)
+
+ \param name the name of the segment (without '/')
+ \return telemetry_t* the segment or NULL on error (errno is set)
+*/
+telemetry_t *telemetryOpen(const char *name);
+
+/*!
+ \brief Start changing the telemetry (writer side)
+
+ \param t the segment
+ \return telemetryData_t* the telemetry in the segment, valid until telemetryEnd()
+*/
+telemetryData_t *telemetryBegin(telemetry_t *t);
+
+/*!
+ \brief Finish changing the telemetry (writer side)
+
+ \param t the segment
+*/
+void telemetryEnd(telemetry_t *t);
+
+/*!
+ \brief Copy a consistent snapshot of the telemetry (reader side)
+
+ \param t the segment
+ \param data the snapshot
+*/
+void telemetryRead(telemetry_t *t, telemetryData_t *data);
+
+/*!
+ \brief Unmap the segment (and remove it on the writer side)
+
+ \param t the segment
+*/
+void telemetryClose(telemetry_t *t);
+
+#endif // TELEMETRY_H
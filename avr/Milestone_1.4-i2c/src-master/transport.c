@@ -0,0 +1,159 @@
+/**
+    @file src-master/transport.c
+    @brief interface to the bus which connects the master with the slaves
+    @author Jan Sommer
+*/
+
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include "transport.h"
+#include "realtime.h"
+
+transport_t *transportOpen(const char *device, int baud)
+{
+    const char *loop;
+    transport_t *t;
+
+    if (strcmp(device, "emu-uart") == 0)
+        t = serialEmulatorOpen(baud);
+    else if (strncmp(device, "emu", 3) == 0)
+    {
+        loop = device[3] == ':' ? strchr(&device[4], ':') : NULL;
+        t = emulatorOpen(device[3] == ':' ? atol(&device[4]) : 0, loop != NULL ? atol(loop + 1) * 1000 : 0);
+    }
+    else if (strstr(device, "tty") != NULL)
+        t = serialOpen(device, baud);
+    else
+        t = i2cOpen(device);
+    if (t != NULL)
+        schedulerInit(&t->scheduler, SCHED_TICK);
+    return t;
+}
+
+/*!
+ \brief Wait for the bus, execute a transfer and record its duration
+*/
+static int transportTransfer(transport_t *t, busMsg_t *msgs, int n)
+{
+    busRequest_t req;
+    long long endNs;
+    int i, result, read = 0;
+
+    for (i = 0; i < n; i++)
+        if (msgs[i].flags & BUS_READ)
+            read = 1;
+    schedulerAcquire(&t->scheduler, &req);
+    result = t->transfer(t, msgs, n);
+    endNs = nowNs();
+    schedulerRelease(&t->scheduler, &req, endNs);
+    histogramRecord(read ? &t->readLatency : &t->writeLatency, endNs - req.granted);
+    return result;
+}
+
+void transportClose(transport_t *t)
+{
+    if (t != NULL)
+    {
+        t->close(t);
+        schedulerDestroy(&t->scheduler);
+        free(t);
+    }
+}
+
+void transportReplace(transport_t *t, transport_t *fresh)
+{
+    busRequest_t req;
+
+    schedulerAcquire(&t->scheduler, &req);      // no transfer of another thread runs on the old device
+    t->close(t);
+    t->name     = fresh->name;
+    t->transfer = fresh->transfer;
+    t->close    = fresh->close;
+    t->fd       = fresh->fd;
+    t->methods  = fresh->methods;
+    t->priv     = fresh->priv;
+    schedulerDestroy(&fresh->scheduler);
+    free(fresh);
+    schedulerRelease(&t->scheduler, &req, 0);
+}
+
+int transportSetMethod(transport_t *t, transportMethod_t method)
+{
+    if (method != TRANSPORT_AUTO && (method >= TRANSPORT_METHODS || !(t->methods & (1 << method))))
+    {
+        errno = EOPNOTSUPP;
+        return -1;
+    }
+    t->method = method;
+    return 0;
+}
+
+int transportTransaction(transport_t *t, const busMsg_t *msgs, int n)
+{
+    switch (t->method)
+    {
+    case TRANSPORT_WRITE:
+        return 1;
+    case TRANSPORT_SMBUS:
+        if (n > 1 && !(msgs[0].flags & BUS_READ) && msgs[0].len == 1 &&
+            (msgs[1].flags & BUS_READ) && msgs[1].addr == msgs[0].addr)
+            return 2;
+        return 1;
+    default:
+        return n;
+    }
+}
+
+int transportWrite(transport_t *t, int addr, const uint8_t *data, int len)
+{
+    busMsg_t msg = {addr, 0, len, (uint8_t *)data};
+
+    return transportTransfer(t, &msg, 1) == 1 ? len : -1;
+}
+
+int transportRead(transport_t *t, int addr, uint8_t reg, uint8_t *data, int n)
+{
+    busMsg_t msgs[2] =
+    {
+        {addr, 0, 1, &reg},
+        {addr, BUS_READ, n, data}
+    };
+
+    return transportTransfer(t, msgs, 2) == 2 ? n : -1;
+}
+
+int transportWriteRead(transport_t *t, int addr, const uint8_t *data, int len,
+                       uint8_t reg, uint8_t *rdata, int n)
+{
+    busMsg_t msgs[3] =
+    {
+        {addr, 0, len, (uint8_t *)data},
+        {addr, 0, 1, &reg},         // the slave continues after the written registers otherwise
+        {addr, BUS_READ, n, rdata}
+    };
+
+    return transportTransfer(t, msgs, 3) == 3 ? n : -1;
+}
+
+int transportBatch(transport_t *t, busMsg_t *msgs, int n, int *status)
+{
+    int i, len, first, failed = 0;
+
+    memset(status, 0, n * sizeof(int));
+    if (transportTransfer(t, msgs, n) == n)
+        return 0;
+
+    for (first = 0; first < n; first += len)
+    {
+        for (len = 1; first + len < n && msgs[first + len].addr == msgs[first].addr; len++)
+            ;
+        if (transportTransfer(t, &msgs[first], len) != len)
+        {
+            for (i = first; i < first + len; i++)
+                status[i] = errno;
+            failed += len;
+        }
+    }
+    return failed;
+}
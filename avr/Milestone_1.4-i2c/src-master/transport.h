@@ -0,0 +1,194 @@
+/**
+    @file src-master/transport.h
+    @brief interface to the bus which connects the master with the slaves
+    @author Jan Sommer
+
+    A transport executes transfers: a list of messages which are sent as one
+    transaction (like I2C_RDWR: the messages are separated by repeated starts).
+    The duration of every transfer is recorded in the latency histograms of the transport.
+    The transfers of several threads are serialized by the scheduler of the transport
+    @sa scheduler.h
+    Backends:
+        - i2c-dev (/dev/i2c-N)
+        - serial port (slave compiled with TRANSPORT = uart, the address is ignored)
+        - in-process emulator of the slave firmware (no hardware needed)
+        - the emulator behind a pty served like the USART slave ("emu-uart")
+*/
+
+#ifndef TRANSPORT_H
+#define TRANSPORT_H
+
+#include <stdint.h>
+#include "histogram.h"
+#include "scheduler.h"
+
+#define BUS_READ    0x0001      ///< Message flag: read from the slave (same value as I2C_M_RD)
+#define SMBUS_BLOCK_MAX 32      ///< Maximum number of data bytes of an SMBus block (I2C_SMBUS_BLOCK_MAX)
+
+/**
+    @brief how the messages of a transfer are handed to the bus (the kernel path on i2c-dev)
+*/
+typedef enum
+{
+    TRANSPORT_AUTO,     ///< a single message with write()/read(), several with I2C_RDWR (default)
+    TRANSPORT_WRITE,    ///< every message with its own write()/read() after I2C_SLAVE
+    TRANSPORT_SMBUS,    ///< every message as SMBus I2C-block transfer (I2C_SMBUS ioctl), a register
+                        ///< write followed by a read is one I2C-block read
+    TRANSPORT_RDWR,     ///< all messages in one I2C_RDWR, even a single one
+    TRANSPORT_METHODS   ///< number of methods
+} transportMethod_t;
+
+/**
+    @brief one message of a transfer
+*/
+typedef struct
+{
+    uint16_t addr;      ///< 7 bit address of the slave (0 == general call)
+    uint16_t flags;     ///< BUS_READ for reads
+    uint16_t len;       ///< number of bytes
+    uint8_t *buf;       ///< data to write or buffer for the read data
+} busMsg_t;
+
+typedef struct transport transport_t;
+
+/**
+    @brief a backend of the transport
+*/
+struct transport
+{
+    const char *name;   ///< name of the backend
+    /*!
+     \brief execute the messages as one transaction
+     \return int the number of messages transferred, -1 on error (errno is set)
+    */
+    int (*transfer)(transport_t *t, busMsg_t *msgs, int n);
+    /*!
+     \brief close the backend (the device and priv), @a t itself is freed by transportClose()
+    */
+    void (*close)(transport_t *t);
+    int fd;             ///< file descriptor of the device (-1 if there is none)
+    unsigned methods;   ///< bit mask of the supported transportMethod_t (TRANSPORT_AUTO is always supported)
+    transportMethod_t method;   ///< the current method @sa transportSetMethod
+    void *priv;         ///< data of the backend
+    histogram_t writeLatency;   ///< duration of the transfers which only write
+    histogram_t readLatency;    ///< duration of the transfers which read (and write)
+    busScheduler_t scheduler;   ///< arbitration of the bus between the threads
+};
+
+/*!
+ \brief Open a transport
+
+ \param device "emu" or "emu:<bus clock in Hz>[:<loop time in us>]" for the emulator, "emu-uart"
+               for the emulator behind a pty, a serial port (name contains "tty") or an I2C-device
+ \param baud baud rate if @a device is a serial port
+ \return transport_t* the transport or NULL on error
+*/
+transport_t *transportOpen(const char *device, int baud);
+
+/*!
+ \brief Close the transport
+
+ \param t the transport
+*/
+void transportClose(transport_t *t);
+
+/*!
+ \brief Replace the backend of a transport with a freshly opened one
+
+ Used to recover a stuck bus: the old device is closed, @a t keeps its address,
+ its latency histograms and its scheduler, so other threads may still use them.
+
+ \param t the transport
+ \param fresh the newly opened transport for the same device, it is freed
+*/
+void transportReplace(transport_t *t, transport_t *fresh);
+
+/*!
+ \brief Write registers of a slave
+
+ \param t the transport
+ \param addr the address of the slave
+ \param data the first register followed by the values
+ \param len the length of @a data
+ \return int the number of bytes written like write(), -1 on error
+*/
+int transportWrite(transport_t *t, int addr, const uint8_t *data, int len);
+
+/*!
+ \brief Read registers of a slave (from its txbuffer)
+
+ \param t the transport
+ \param addr the address of the slave
+ \param reg the first register
+ \param data buffer for the values of the registers
+ \param n the number of registers to read
+ \return int the number of bytes read, -1 on error
+*/
+int transportRead(transport_t *t, int addr, uint8_t reg, uint8_t *data, int n);
+
+/*!
+ \brief Write registers of a slave and read registers back in one transfer
+
+ The read follows the write after a repeated start (one I2C_RDWR on i2c-dev), so the
+ master can verify what the slave accepted without a second arbitration of the bus.
+
+ \param t the transport
+ \param addr the address of the slave
+ \param data the first register followed by the values
+ \param len the length of @a data
+ \param reg the first register to read back
+ \param rdata buffer for the values read back
+ \param n the number of registers to read back
+ \return int the number of bytes read back, -1 on error
+*/
+int transportWriteRead(transport_t *t, int addr, const uint8_t *data, int len,
+                       uint8_t reg, uint8_t *rdata, int n);
+
+/*!
+ \brief Execute the messages for several slaves as one transfer and report errors per message
+
+ The messages are submitted in one transfer (one I2C_RDWR on i2c-dev). If it fails
+ (I2C_RDWR aborts at the first NACK without telling which message failed) each group of
+ consecutive messages to the same address is transferred again on its own to find the
+ slaves which did not respond. Only use it for messages which can be repeated (writes of
+ registers, reads).
+
+ \param t the transport
+ \param msgs the messages
+ \param n the number of messages
+ \param status the result of each message: 0 or the errno of the failed transfer
+ \return int the number of failed messages
+*/
+int transportBatch(transport_t *t, busMsg_t *msgs, int n, int *status);
+
+/*!
+ \brief Select how the messages of the following transfers are handed to the bus
+
+ Without repeated starts (TRANSPORT_WRITE, TRANSPORT_SMBUS) the messages of a transfer
+ are separate transactions, i.e. another master may use the bus in between.
+
+ \param t the transport
+ \param method the method
+ \return int 0 if successful, -1 if the backend does not support it (errno is EOPNOTSUPP)
+*/
+int transportSetMethod(transport_t *t, transportMethod_t method);
+
+/*!
+ \brief Number of messages at the start of @a msgs which form one transaction with the current method
+
+ Used by the backends: all messages with TRANSPORT_AUTO and TRANSPORT_RDWR, one message with
+ TRANSPORT_WRITE, a register write and the following read of the same slave with TRANSPORT_SMBUS.
+
+ \param t the transport
+ \param msgs the remaining messages
+ \param n the number of remaining messages
+ \return int the number of messages of the transaction
+*/
+int transportTransaction(transport_t *t, const busMsg_t *msgs, int n);
+
+transport_t *i2cOpen(const char *device);
+transport_t *serialOpen(const char *device, int baud);
+transport_t *emulatorOpen(long busClock, long loopTime);
+transport_t *serialEmulatorOpen(int baud);
+
+#endif // TRANSPORT_H
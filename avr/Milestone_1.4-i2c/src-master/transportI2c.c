@@ -0,0 +1,181 @@
+/**
+    @file src-master/transportI2c.c
+    @brief transport backend for an I2C-device of the linux /dev-tree (i2c-dev)
+    @author Jan Sommer
+
+    A single message is sent with write() or read() after selecting the slave with
+    the I2C_SLAVE ioctl (only if the address changed). Several messages are combined
+    with repeated starts in one I2C_RDWR ioctl.
+    The other kernel paths can be selected for comparison @sa transportSetMethod
+    (only those which the adapter reports with I2C_FUNCS).
+*/
+
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <errno.h>
+#include <sys/ioctl.h>
+#include <linux/i2c.h>
+#include <linux/i2c-dev.h>
+#include "transport.h"
+
+#define I2C_TIMEOUT_10MS    2   ///< Timeout of a transfer in units of 10 ms (I2C_TIMEOUT)
+
+/**
+    @brief data of the i2c-dev backend
+*/
+typedef struct
+{
+    int addr;       ///< address selected with I2C_SLAVE, -1 if none
+} i2cBus_t;
+
+_Static_assert(sizeof(busMsg_t) == sizeof(struct i2c_msg), "busMsg_t must match struct i2c_msg");
+
+/*!
+ \brief Select the slave for write() and read()
+*/
+static int i2cSelect(transport_t *t, int addr)
+{
+    i2cBus_t *bus = t->priv;
+
+    if (bus->addr == addr)
+        return 0;
+    if (ioctl(t->fd, I2C_SLAVE, addr) < 0)
+    {
+        bus->addr = -1;
+        return -1;
+    }
+    bus->addr = addr;
+    return 0;
+}
+
+/*!
+ \brief Send one message with write() or read()
+*/
+static int i2cMessage(transport_t *t, busMsg_t *msg)
+{
+    int len;
+
+    if (i2cSelect(t, msg->addr) != 0)
+        return -1;
+    if (msg->flags & BUS_READ)
+        len = read(t->fd, msg->buf, msg->len);
+    else
+        len = write(t->fd, msg->buf, msg->len);
+    if (len != msg->len)
+    {
+        if (len >= 0)
+            errno = EIO;
+        return -1;
+    }
+    return 0;
+}
+
+/*!
+ \brief Send one SMBus transaction: an I2C-block write, a byte write, an I2C-block read
+        of a register (@a n == 2) or a byte read
+
+ The first byte of a write is the SMBus command (the register of the slave).
+*/
+static int i2cSmbus(transport_t *t, busMsg_t *msgs, int n)
+{
+    struct i2c_smbus_ioctl_data args;
+    union i2c_smbus_data data;
+    busMsg_t *rd = n == 2 ? &msgs[1] : (msgs[0].flags & BUS_READ) ? &msgs[0] : NULL;
+
+    if ((rd == NULL && msgs[0].len > SMBUS_BLOCK_MAX + 1) || (rd != NULL && rd->len > SMBUS_BLOCK_MAX) ||
+        (n == 1 && rd != NULL && rd->len != 1) || msgs[0].len == 0)
+    {
+        errno = EMSGSIZE;   // not expressible as SMBus transaction
+        return -1;
+    }
+    if (i2cSelect(t, msgs[0].addr) != 0)
+        return -1;
+
+    args.read_write = rd != NULL ? I2C_SMBUS_READ : I2C_SMBUS_WRITE;
+    args.command    = rd != &msgs[0] ? msgs[0].buf[0] : 0;
+    args.size       = (n == 1 && (rd != NULL || msgs[0].len == 1)) ? I2C_SMBUS_BYTE : I2C_SMBUS_I2C_BLOCK_DATA;
+    args.data       = &data;
+    if (args.size == I2C_SMBUS_BYTE && rd == NULL)
+        args.data = NULL;   // the byte is the command
+    else if (rd != NULL)
+        data.block[0] = rd->len;
+    else
+    {
+        data.block[0] = msgs[0].len - 1;
+        memcpy(&data.block[1], &msgs[0].buf[1], msgs[0].len - 1);
+    }
+    if (ioctl(t->fd, I2C_SMBUS, &args) < 0)
+        return -1;
+    if (rd != NULL && args.size == I2C_SMBUS_BYTE)
+        rd->buf[0] = data.byte;
+    else if (rd != NULL)
+        memcpy(rd->buf, &data.block[1], rd->len);
+    return 0;
+}
+
+static int i2cTransfer(transport_t *t, busMsg_t *msgs, int n)
+{
+    struct i2c_rdwr_ioctl_data rdwr;
+    int i, len, result;
+
+    for (i = 0; i < n; i += len)
+    {
+        len = transportTransaction(t, &msgs[i], n - i);
+        if (t->method == TRANSPORT_SMBUS)
+            result = i2cSmbus(t, &msgs[i], len);
+        else if (len == 1 && t->method != TRANSPORT_RDWR)
+            result = i2cMessage(t, &msgs[i]);
+        else
+        {
+            // busMsg_t has the same layout as struct i2c_msg
+            rdwr.msgs  = (struct i2c_msg *)&msgs[i];
+            rdwr.nmsgs = len;
+            result = ioctl(t->fd, I2C_RDWR, &rdwr) == len ? 0 : -1;
+        }
+        if (result != 0)
+            return -1;
+    }
+    return n;
+}
+
+static void i2cClose(transport_t *t)
+{
+    close(t->fd);
+    free(t->priv);
+}
+
+transport_t *i2cOpen(const char *device)
+{
+    transport_t *t = calloc(1, sizeof(transport_t));
+    i2cBus_t *bus = calloc(1, sizeof(i2cBus_t));
+    unsigned long funcs = 0;
+
+    if (t == NULL || bus == NULL)
+    {
+        free(t);
+        free(bus);
+        return NULL;
+    }
+    t->fd = open(device, O_RDWR | O_NOCTTY);
+    if (t->fd == -1)
+    {
+        free(t);
+        free(bus);
+        return NULL;
+    }
+    // give up after 20 ms instead of the default of the adapter, a stuck bus is recovered by the master
+    ioctl(t->fd, I2C_TIMEOUT, I2C_TIMEOUT_10MS);
+    ioctl(t->fd, I2C_FUNCS, &funcs);
+    if (funcs & I2C_FUNC_I2C)
+        t->methods |= (1 << TRANSPORT_WRITE) | (1 << TRANSPORT_RDWR);
+    if ((funcs & I2C_FUNC_SMBUS_I2C_BLOCK) == I2C_FUNC_SMBUS_I2C_BLOCK && (funcs & I2C_FUNC_SMBUS_BYTE) == I2C_FUNC_SMBUS_BYTE)
+        t->methods |= 1 << TRANSPORT_SMBUS;
+    bus->addr   = -1;
+    t->name     = "i2c";
+    t->transfer = i2cTransfer;
+    t->close    = i2cClose;
+    t->priv     = bus;
+    return t;
+}
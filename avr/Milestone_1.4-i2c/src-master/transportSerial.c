@@ -0,0 +1,198 @@
+/**
+    @file src-master/transportSerial.c
+    @brief transport backend for a slave connected to a serial port
+    @author Jan Sommer
+
+    The registers of the slave are written with checksummed frames @sa usartSlave.h
+    A write message is sent as write frame, a write of the register followed by a
+    read message as read frame. A write of a single command byte (e.g. the general
+    call GENERAL_CALL_LATCH) is sent as command frame. The address is ignored as
+    the serial port is a point-to-point connection.
+
+    The slave runs the USART in double speed mode from 8 MHz, which produces only
+    250000, 500000 and 1000000 baud exactly @sa USART_BAUD (slave). 250000 baud has no
+    Bxxx constant, so the speed is set with termios2 and BOTHER.
+*/
+
+#include <stdlib.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <errno.h>
+#include <poll.h>
+#include <sys/ioctl.h>
+#include <asm/termbits.h>   // struct termios2, BOTHER (conflicts with <termios.h>)
+#include "transport.h"
+
+#define SERIAL_TIMEOUT  10          ///< Time to wait for the reply of the slave in ms
+#define UART_SYNC       0xA5        ///< First byte of every serial frame @sa UART_SYNC (slave)
+#define UART_ACK        0x79        ///< Reply of the slave to a valid frame @sa UART_ACK (slave)
+#define UART_READ       0x80        ///< Header flag of a read frame @sa UART_READ (slave)
+
+/*!
+ \brief Receive exactly @a n bytes within SERIAL_TIMEOUT per byte
+*/
+static int serialReceive(int fd, uint8_t *data, int n)
+{
+    struct pollfd pfd = {fd, POLLIN, 0};
+    int i, len = 0;
+
+    while (len < n)
+    {
+        if (poll(&pfd, 1, SERIAL_TIMEOUT) != 1)
+        {
+            errno = ETIMEDOUT;
+            return -1;
+        }
+        i = read(fd, &data[len], n - len);
+        if (i <= 0)
+            return -1;
+        len += i;
+    }
+    return 0;
+}
+
+/*!
+ \brief Send a write frame to the slave and wait for its acknowledge
+
+ \param fd the serial port
+ \param reg the first register (or a command if @a n is 0)
+ \param data the values for the registers
+ \param n the number of registers to write
+ \return int 0 if the slave acknowledged the frame otherwise -1
+*/
+static int serialWrite(int fd, uint8_t reg, const uint8_t *data, int n)
+{
+    uint8_t frame[n + 4];
+    uint8_t sum, reply;
+    int i;
+
+    frame[0] = UART_SYNC;
+    frame[1] = n;
+    frame[2] = reg;
+    sum = frame[1] + frame[2];
+    for (i = 0; i < n; i++)
+    {
+        frame[i + 3] = data[i];
+        sum += data[i];
+    }
+    frame[n + 3] = -sum;
+
+    ioctl(fd, TCFLSH, TCIFLUSH);    // drop stale replies
+    if (write(fd, frame, n + 4) != n + 4 || serialReceive(fd, &reply, 1) != 0)
+        return -1;
+    if (reply != UART_ACK)
+    {
+        errno = EIO;
+        return -1;
+    }
+    return 0;
+}
+
+/*!
+ \brief Read registers of the slave
+
+ \param fd the serial port
+ \param reg the first register
+ \param data buffer for the values of the registers
+ \param n the number of registers to read
+ \return int 0 if a valid reply was received otherwise -1
+*/
+static int serialRead(int fd, uint8_t reg, uint8_t *data, int n)
+{
+    uint8_t frame[4] = {UART_SYNC, UART_READ | n, reg, -((UART_READ | n) + reg)};
+    uint8_t reply[n + 3];
+    uint8_t sum = 0;
+    int i;
+
+    ioctl(fd, TCFLSH, TCIFLUSH);
+    if (write(fd, frame, 4) != 4 || serialReceive(fd, reply, n + 3) != 0)
+        return -1;
+    for (i = 1; i < n + 3; i++)
+        sum += reply[i];
+    if (reply[0] != UART_SYNC || reply[1] != n || sum != 0)
+    {
+        errno = EIO;
+        return -1;
+    }
+    for (i = 0; i < n; i++)
+        data[i] = reply[i + 2];
+    return 0;
+}
+
+static int serialTransfer(transport_t *t, busMsg_t *msgs, int n)
+{
+    int i;
+
+    for (i = 0; i < n; i++)
+    {
+        if (msgs[i].flags & BUS_READ || msgs[i].len == 0)
+        {
+            errno = EINVAL;     // a read needs the register of the preceding write
+            return -1;
+        }
+        if (i + 1 < n && (msgs[i + 1].flags & BUS_READ))
+        {
+            if (serialRead(t->fd, msgs[i].buf[msgs[i].len - 1], msgs[i + 1].buf, msgs[i + 1].len) != 0)
+                return -1;
+            i++;
+        }
+        else if (serialWrite(t->fd, msgs[i].buf[0], &msgs[i].buf[1], msgs[i].len - 1) != 0)
+            return -1;
+    }
+    return n;
+}
+
+static void serialClose(transport_t *t)
+{
+    close(t->fd);
+}
+
+/*!
+ \brief Raw mode with 8N1 and any baud rate (like cfmakeraw() and cfsetspeed())
+*/
+static int serialSetup(int fd, int baud)
+{
+    struct termios2 tio;
+
+    if (ioctl(fd, TCGETS2, &tio) < 0)
+        return -1;
+    tio.c_iflag &= ~(IGNBRK | BRKINT | PARMRK | ISTRIP | INLCR | IGNCR | ICRNL | IXON);
+    tio.c_oflag &= ~OPOST;
+    tio.c_lflag &= ~(ECHO | ECHONL | ICANON | ISIG | IEXTEN);
+    tio.c_cflag &= ~(CSIZE | CSTOPB | PARENB | CBAUD | (CBAUD << IBSHIFT));
+    tio.c_cflag |= CS8 | CLOCAL | CREAD | BOTHER | (BOTHER << IBSHIFT);
+    tio.c_ispeed = baud;
+    tio.c_ospeed = baud;
+    tio.c_cc[VMIN]  = 1;
+    tio.c_cc[VTIME] = 0;
+    return ioctl(fd, TCSETS2, &tio);
+}
+
+transport_t *serialOpen(const char *device, int baud)
+{
+    transport_t *t;
+
+    if (baud != 250000 && baud != 500000 && baud != 1000000)
+    {
+        errno = EINVAL;     // the slave cannot produce it within the tolerance of the USART
+        return NULL;
+    }
+
+    t = calloc(1, sizeof(transport_t));
+    if (t == NULL)
+        return NULL;
+    t->fd = open(device, O_RDWR | O_NOCTTY | O_NDELAY);
+    if (t->fd == -1 || serialSetup(t->fd, baud) < 0)
+    {
+        if (t->fd != -1)
+            close(t->fd);
+        free(t);
+        return NULL;
+    }
+    ioctl(t->fd, TCFLSH, TCIOFLUSH);
+
+    t->name     = "serial";
+    t->transfer = serialTransfer;
+    t->close    = serialClose;
+    return t;
+}